@@ -0,0 +1,192 @@
+#include "Benchmarks.hpp"
+
+#include "tiny_obj_loader.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <thread>
+
+namespace gps {
+
+    // Distance between two floats in units in the last place
+    static int64_t UlpDistance(float a, float b)
+    {
+        int32_t ia, ib;
+        memcpy(&ia, &a, sizeof(float));
+        memcpy(&ib, &b, sizeof(float));
+        // map the sign-magnitude encoding onto a monotonic integer line
+        int64_t la = ia < 0 ? -static_cast<int64_t>(ia & 0x7fffffff) : ia;
+        int64_t lb = ib < 0 ? -static_cast<int64_t>(ib & 0x7fffffff) : ib;
+        return la > lb ? la - lb : lb - la;
+    }
+
+    // Largest ulp distance between two arrays, or -1 when their sizes differ
+    static int64_t MaxUlpDistance(const std::vector<float>& a, const std::vector<float>& b)
+    {
+        if (a.size() != b.size()) {
+            return -1;
+        }
+        int64_t worst = 0;
+        for (size_t i = 0; i < a.size(); i++) {
+            int64_t distance = UlpDistance(a[i], b[i]);
+            if (distance > worst) {
+                worst = distance;
+            }
+        }
+        return worst;
+    }
+
+    static bool SameIndices(const std::vector<tinyobj::index_t>& a, const std::vector<tinyobj::index_t>& b)
+    {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); i++) {
+            if (a[i].vertex_index != b[i].vertex_index ||
+                a[i].normal_index != b[i].normal_index ||
+                a[i].texcoord_index != b[i].texcoord_index) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool SameObj(const tinyobj::attrib_t& attribA, const std::vector<tinyobj::shape_t>& shapesA,
+        const tinyobj::attrib_t& attribB, const std::vector<tinyobj::shape_t>& shapesB)
+    {
+        // the parallel parser rounds numbers correctly, the serial one may be 1 ulp off
+        int64_t v = MaxUlpDistance(attribA.vertices, attribB.vertices);
+        int64_t vn = MaxUlpDistance(attribA.normals, attribB.normals);
+        int64_t vt = MaxUlpDistance(attribA.texcoords, attribB.texcoords);
+        if (v < 0 || v > 1 || vn < 0 || vn > 1 || vt < 0 || vt > 1 ||
+            shapesA.size() != shapesB.size()) {
+            return false;
+        }
+        for (size_t s = 0; s < shapesA.size(); s++) {
+            const tinyobj::mesh_t& a = shapesA[s].mesh;
+            const tinyobj::mesh_t& b = shapesB[s].mesh;
+            if (shapesA[s].name != shapesB[s].name ||
+                !SameIndices(a.indices, b.indices) ||
+                a.num_face_vertices != b.num_face_vertices ||
+                a.material_ids != b.material_ids ||
+                a.tags.size() != b.tags.size()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Best of `runs` wall-clock times, in seconds
+    template <typename Fn>
+    static double TimeBest(int runs, Fn fn)
+    {
+        double best = 1e30;
+        for (int r = 0; r < runs; r++) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            fn();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if (elapsed.count() < best) {
+                best = elapsed.count();
+            }
+        }
+        return best;
+    }
+
+    void RunObjParseBenchmark(const std::vector<std::string>& fileNames)
+    {
+        const int runs = 3;
+        unsigned int maxThreads = std::thread::hardware_concurrency();
+        if (maxThreads == 0) {
+            maxThreads = 1;
+        }
+
+        // 1, 2, 4, ... and finally all hardware threads
+        std::vector<unsigned int> threadCounts;
+        for (unsigned int threads = 1; threads < maxThreads; threads *= 2) {
+            threadCounts.push_back(threads);
+        }
+        threadCounts.push_back(maxThreads);
+
+        for (size_t f = 0; f < fileNames.size(); f++) {
+            const std::string& fileName = fileNames[f];
+            std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
+
+            tinyobj::attrib_t serialAttrib;
+            std::vector<tinyobj::shape_t> serialShapes;
+            std::vector<tinyobj::material_t> serialMaterials;
+            std::string err;
+
+            std::ifstream file(fileName.c_str(), std::ios::binary | std::ios::ate);
+            if (!file) {
+                std::cerr << "ERROR: could not open " << fileName << std::endl;
+                continue;
+            }
+            double megabytes = static_cast<double>(file.tellg()) / (1024.0 * 1024.0);
+            file.close();
+
+            double serial = TimeBest(runs, [&]() {
+                serialMaterials.clear();
+                tinyobj::LoadObj(&serialAttrib, &serialShapes, &serialMaterials, &err, fileName.c_str(), basePath.c_str(), true);
+            });
+
+            printf("%s (%.2f MB)\n", fileName.c_str(), megabytes);
+            printf("  LoadObj          : %8.1f MB/s\n", megabytes / serial);
+
+            for (size_t t = 0; t < threadCounts.size(); t++) {
+                unsigned int threads = threadCounts[t];
+                tinyobj::attrib_t attrib;
+                std::vector<tinyobj::shape_t> shapes;
+                std::vector<tinyobj::material_t> materials;
+
+                double parallel = TimeBest(runs, [&]() {
+                    materials.clear();
+                    tinyobj::LoadObjParallel(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), true, threads);
+                });
+
+                bool same = SameObj(serialAttrib, serialShapes, attrib, shapes) && materials.size() == serialMaterials.size();
+                printf("  LoadObjParallel %2u thread(s): %8.1f MB/s  (x%.2f)%s\n", threads, megabytes / parallel,
+                    serial / parallel, same ? "" : "  MISMATCH");
+            }
+        }
+    }
+
+    void RunObjNumberBenchmark(const std::vector<std::string>& fileNames)
+    {
+        const int runs = 5;
+
+        for (size_t f = 0; f < fileNames.size(); f++) {
+            const std::string& fileName = fileNames[f];
+
+            std::ifstream file(fileName.c_str(), std::ios::binary);
+            if (!file) {
+                std::cerr << "ERROR: could not open " << fileName << std::endl;
+                continue;
+            }
+            std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            double megabytes = static_cast<double>(text.size()) / (1024.0 * 1024.0);
+
+            std::vector<float> reference;
+            std::vector<float> fast;
+            double referenceTime = TimeBest(runs, [&]() {
+                reference.clear();
+                tinyobj::ParseObjAttributes(text.data(), text.size(), &reference, true);
+            });
+            double fastTime = TimeBest(runs, [&]() {
+                fast.clear();
+                tinyobj::ParseObjAttributes(text.data(), text.size(), &fast, false);
+            });
+
+            int64_t ulps = MaxUlpDistance(reference, fast);
+            printf("%s (%.2f MB, %zu numbers)\n", fileName.c_str(), megabytes, reference.size());
+            printf("  reference : %8.1f MB/s per core\n", megabytes / referenceTime);
+            printf("  fast      : %8.1f MB/s per core  (x%.2f)  max %lld ulp%s\n", megabytes / fastTime,
+                referenceTime / fastTime, static_cast<long long>(ulps), (ulps < 0 || ulps > 1) ? "  MISMATCH" : "");
+        }
+    }
+
+}
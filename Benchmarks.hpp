@@ -0,0 +1,19 @@
+#ifndef Benchmarks_hpp
+#define Benchmarks_hpp
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Parses each .obj with the serial and the parallel tinyobj parsers,
+    // checks that both produce the same data and prints MB/s per thread count
+    void RunObjParseBenchmark(const std::vector<std::string>& fileNames);
+
+    // Times the number parsing of the v/vn/vt lines alone, reference versus
+    // fast path, on one thread; prints MB/s per core and the largest ulp error
+    void RunObjNumberBenchmark(const std::vector<std::string>& fileNames);
+
+}
+
+#endif /* Benchmarks_hpp */
@@ -0,0 +1,465 @@
+#include "CompressedTexture.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace gps {
+
+    static const unsigned char DDS_MAGIC[4] = { 'D', 'D', 'S', ' ' };
+    static const unsigned char KTX_MAGIC[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+    // DDS_HEADER follows the magic; a DDS_HEADER_DXT10 follows it for "DX10" files
+    static const size_t DDS_HEADER_END = 128;
+    static const size_t DDS_DX10_HEADER_END = 148;
+    static const uint32_t DDPF_FOURCC = 0x4;
+    static const uint32_t DDSCAPS2_CUBEMAP = 0x200;
+    static const uint32_t DDSCAPS2_CUBEMAP_ALLFACES = 0xFC00;
+    static const uint32_t DDSCAPS2_VOLUME = 0x200000;
+    static const uint32_t D3D10_RESOURCE_DIMENSION_TEXTURE2D = 3;
+    static const uint32_t D3D10_RESOURCE_MISC_TEXTURECUBE = 0x4;
+
+    static const size_t KTX_HEADER_END = 64;
+    static const uint32_t KTX_ENDIAN_REF = 0x04030201;
+
+    static uint32_t ReadU32(const unsigned char* bytes)
+    {
+        uint32_t value;
+        memcpy(&value, bytes, sizeof(value));
+        return value;
+    }
+
+    static uint32_t FourCC(char a, char b, char c, char d)
+    {
+        return static_cast<uint32_t>(static_cast<unsigned char>(a)) |
+            (static_cast<uint32_t>(static_cast<unsigned char>(b)) << 8) |
+            (static_cast<uint32_t>(static_cast<unsigned char>(c)) << 16) |
+            (static_cast<uint32_t>(static_cast<unsigned char>(d)) << 24);
+    }
+
+    static size_t BlockBytes(BlockCompression compression)
+    {
+        return compression == BLOCK_BC1 || compression == BLOCK_BC4 ? 8 : 16;
+    }
+
+    static size_t MipSize(BlockCompression compression, int width, int height)
+    {
+        size_t blocksX = static_cast<size_t>((width + 3) / 4);
+        size_t blocksY = static_cast<size_t>((height + 3) / 4);
+        return blocksX * blocksY * BlockBytes(compression);
+    }
+
+    // Legacy DXTn files carry no colour space; they are treated as sRGB like
+    // the RGBA8 textures, except the BC4/BC5 channel formats, which are data
+    static bool LegacyFormat(uint32_t fourCC, BlockCompression* compression, GLenum* internalFormat)
+    {
+        if (fourCC == FourCC('D', 'X', 'T', '1')) {
+            *compression = BLOCK_BC1;
+            *internalFormat = GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+        }
+        else if (fourCC == FourCC('D', 'X', 'T', '2') || fourCC == FourCC('D', 'X', 'T', '3')) {
+            *compression = BLOCK_BC2;
+            *internalFormat = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT;
+        }
+        else if (fourCC == FourCC('D', 'X', 'T', '4') || fourCC == FourCC('D', 'X', 'T', '5')) {
+            *compression = BLOCK_BC3;
+            *internalFormat = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+        }
+        else if (fourCC == FourCC('A', 'T', 'I', '1') || fourCC == FourCC('B', 'C', '4', 'U')) {
+            *compression = BLOCK_BC4;
+            *internalFormat = GL_COMPRESSED_RED_RGTC1;
+        }
+        else if (fourCC == FourCC('A', 'T', 'I', '2') || fourCC == FourCC('B', 'C', '5', 'U')) {
+            *compression = BLOCK_BC5;
+            *internalFormat = GL_COMPRESSED_RG_RGTC2;
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    static bool DxgiFormat(uint32_t dxgiFormat, BlockCompression* compression, GLenum* internalFormat)
+    {
+        switch (dxgiFormat) {
+        case 71: *compression = BLOCK_BC1; *internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; break;
+        case 72: *compression = BLOCK_BC1; *internalFormat = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT; break;
+        case 74: *compression = BLOCK_BC2; *internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; break;
+        case 75: *compression = BLOCK_BC2; *internalFormat = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT; break;
+        case 77: *compression = BLOCK_BC3; *internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; break;
+        case 78: *compression = BLOCK_BC3; *internalFormat = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT; break;
+        case 80: *compression = BLOCK_BC4; *internalFormat = GL_COMPRESSED_RED_RGTC1; break;
+        case 83: *compression = BLOCK_BC5; *internalFormat = GL_COMPRESSED_RG_RGTC2; break;
+        case 98: *compression = BLOCK_BC7; *internalFormat = GL_COMPRESSED_RGBA_BPTC_UNORM; break;
+        case 99: *compression = BLOCK_BC7; *internalFormat = GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM; break;
+        default: return false;
+        }
+        return true;
+    }
+
+    static bool KtxFormat(GLenum internalFormat, BlockCompression* compression)
+    {
+        switch (internalFormat) {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+            *compression = BLOCK_BC1; break;
+        case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT:
+            *compression = BLOCK_BC2; break;
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+            *compression = BLOCK_BC3; break;
+        case GL_COMPRESSED_RED_RGTC1:
+            *compression = BLOCK_BC4; break;
+        case GL_COMPRESSED_RG_RGTC2:
+            *compression = BLOCK_BC5; break;
+        case GL_COMPRESSED_RGBA_BPTC_UNORM:
+        case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+            *compression = BLOCK_BC7; break;
+        default:
+            return false;
+        }
+        return true;
+    }
+
+    // Mirroring whole blocks only works when no block straddles the middle row;
+    // BC7 partitions and modes cannot be mirrored without re-encoding
+    static bool CanFlip(const CompressedTexture& texture)
+    {
+        if (texture.compression == BLOCK_BC7) {
+            return false;
+        }
+        for (size_t i = 0; i < texture.mips.size(); i++) {
+            int height = texture.mips[i].height;
+            if (height > 4 && height % 4 != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Appends the level sizes and file offsets of the first face and checks every face fits in the file
+    static bool LayoutMips(CompressedTexture* texture, size_t mipCount, size_t dataStart, size_t fileSize, bool ktx,
+        const unsigned char* file)
+    {
+        texture->mips.clear();
+        texture->dataSize = 0;
+
+        size_t fileOffset = dataStart;
+        int width = texture->width;
+        int height = texture->height;
+        for (size_t level = 0; level < mipCount; level++) {
+            CompressedMip mip;
+            mip.width = width;
+            mip.height = height;
+            mip.size = MipSize(texture->compression, width, height);
+            if (ktx) {
+                // each KTX level starts with its imageSize and is padded to 4 bytes
+                if (fileOffset + 4 > fileSize || ReadU32(file + fileOffset) != mip.size) {
+                    return false;
+                }
+                fileOffset += 4;
+            }
+            mip.fileOffset = fileOffset;
+            mip.offset = texture->dataSize;
+            if (fileOffset + mip.size > fileSize) {
+                return false;
+            }
+            fileOffset += ktx ? (mip.size + 3) & ~static_cast<size_t>(3) : mip.size;
+            texture->dataSize += mip.size;
+            texture->mips.push_back(mip);
+
+            if (width == 1 && height == 1) {
+                break;
+            }
+            width = width > 1 ? width / 2 : 1;
+            height = height > 1 ? height / 2 : 1;
+        }
+
+        // DDS faces follow each other with no padding
+        texture->faceSize = texture->dataSize;
+        texture->dataSize *= texture->faces;
+        if (dataStart + texture->dataSize > fileSize) {
+            return false;
+        }
+        return !texture->mips.empty();
+    }
+
+    static bool ParseDds(const unsigned char* file, size_t size, const char* name, CompressedTexture* texture)
+    {
+        if (size < DDS_HEADER_END || ReadU32(file + 4) != 124) {
+            fprintf(stderr, "ERROR: %s has a malformed DDS header\n", name);
+            return false;
+        }
+
+        uint32_t height = ReadU32(file + 12);
+        uint32_t width = ReadU32(file + 16);
+        uint32_t mipCount = ReadU32(file + 28);
+        uint32_t pixelFlags = ReadU32(file + 80);
+        uint32_t fourCC = ReadU32(file + 84);
+        uint32_t caps2 = ReadU32(file + 112);
+
+        if ((caps2 & DDSCAPS2_VOLUME) != 0) {
+            fprintf(stderr, "ERROR: %s is a volume, only 2D textures and cube maps are supported\n", name);
+            return false;
+        }
+        bool cube = (caps2 & DDSCAPS2_CUBEMAP) != 0;
+        if (cube && (caps2 & DDSCAPS2_CUBEMAP_ALLFACES) != DDSCAPS2_CUBEMAP_ALLFACES) {
+            fprintf(stderr, "ERROR: %s is a cube map without all six faces\n", name);
+            return false;
+        }
+        if ((pixelFlags & DDPF_FOURCC) == 0) {
+            fprintf(stderr, "ERROR: %s is an uncompressed DDS, only BC formats are supported\n", name);
+            return false;
+        }
+
+        size_t dataStart = DDS_HEADER_END;
+        if (fourCC == FourCC('D', 'X', '1', '0')) {
+            if (size < DDS_DX10_HEADER_END) {
+                fprintf(stderr, "ERROR: %s has a malformed DX10 header\n", name);
+                return false;
+            }
+            uint32_t dxgiFormat = ReadU32(file + 128);
+            uint32_t dimension = ReadU32(file + 132);
+            uint32_t miscFlags = ReadU32(file + 136);
+            uint32_t arraySize = ReadU32(file + 140);
+            cube = (miscFlags & D3D10_RESOURCE_MISC_TEXTURECUBE) != 0;
+            if (dimension != D3D10_RESOURCE_DIMENSION_TEXTURE2D || arraySize > 1) {
+                fprintf(stderr, "ERROR: %s is not a single 2D texture\n", name);
+                return false;
+            }
+            if (!DxgiFormat(dxgiFormat, &texture->compression, &texture->internalFormat)) {
+                fprintf(stderr, "ERROR: %s uses unsupported DXGI format %u\n", name, dxgiFormat);
+                return false;
+            }
+            dataStart = DDS_DX10_HEADER_END;
+        }
+        else if (!LegacyFormat(fourCC, &texture->compression, &texture->internalFormat)) {
+            fprintf(stderr, "ERROR: %s uses unsupported format %.4s\n", name, reinterpret_cast<const char*>(file + 84));
+            return false;
+        }
+
+        if (cube && width != height) {
+            fprintf(stderr, "ERROR: %s is a cube map with faces that are not square\n", name);
+            return false;
+        }
+
+        texture->width = static_cast<int>(width);
+        texture->height = static_cast<int>(height);
+        texture->faces = cube ? 6 : 1;
+        // DDS rows run top to bottom, like GL addresses cube map faces
+        texture->flip = !cube;
+        return LayoutMips(texture, mipCount > 0 ? mipCount : 1, dataStart, size, false, file);
+    }
+
+    static bool ParseKtx(const unsigned char* file, size_t size, const char* name, CompressedTexture* texture)
+    {
+        if (size < KTX_HEADER_END || ReadU32(file + 12) != KTX_ENDIAN_REF) {
+            fprintf(stderr, "ERROR: %s has a malformed or big-endian KTX header\n", name);
+            return false;
+        }
+
+        GLenum internalFormat = ReadU32(file + 28);
+        uint32_t width = ReadU32(file + 36);
+        uint32_t height = ReadU32(file + 40);
+        uint32_t depth = ReadU32(file + 44);
+        uint32_t arrayElements = ReadU32(file + 48);
+        uint32_t faces = ReadU32(file + 52);
+        uint32_t mipCount = ReadU32(file + 56);
+        uint32_t keyValueBytes = ReadU32(file + 60);
+
+        if (height == 0 || depth > 0 || arrayElements > 0 || faces != 1) {
+            fprintf(stderr, "ERROR: %s is not a single 2D texture\n", name);
+            return false;
+        }
+        if (!KtxFormat(internalFormat, &texture->compression)) {
+            fprintf(stderr, "ERROR: %s uses unsupported internal format 0x%X\n", name, internalFormat);
+            return false;
+        }
+        if (KTX_HEADER_END + keyValueBytes > size) {
+            fprintf(stderr, "ERROR: %s has truncated key/value data\n", name);
+            return false;
+        }
+
+        // rows run top to bottom unless KTXorientation says the T axis points up
+        texture->flip = true;
+        size_t offset = KTX_HEADER_END;
+        size_t end = KTX_HEADER_END + keyValueBytes;
+        while (offset + 4 <= end) {
+            uint32_t pairBytes = ReadU32(file + offset);
+            offset += 4;
+            if (offset + pairBytes > end) {
+                break;
+            }
+            std::string pair(reinterpret_cast<const char*>(file + offset), pairBytes);
+            if (pair.compare(0, 15, std::string("KTXorientation\0", 15)) == 0 && pair.find("T=u") != std::string::npos) {
+                texture->flip = false;
+            }
+            offset += (pairBytes + 3) & ~static_cast<uint32_t>(3);
+        }
+
+        texture->internalFormat = internalFormat;
+        texture->width = static_cast<int>(width);
+        texture->height = static_cast<int>(height);
+        texture->faces = 1;
+        return LayoutMips(texture, mipCount > 0 ? mipCount : 1, end, size, true, file);
+    }
+
+    bool IsCompressedTextureFile(const unsigned char* file, size_t size)
+    {
+        return (size >= sizeof(DDS_MAGIC) && memcmp(file, DDS_MAGIC, sizeof(DDS_MAGIC)) == 0) ||
+            (size >= sizeof(KTX_MAGIC) && memcmp(file, KTX_MAGIC, sizeof(KTX_MAGIC)) == 0);
+    }
+
+    bool ParseCompressedTexture(const unsigned char* file, size_t size, const char* name, CompressedTexture* texture)
+    {
+        bool parsed = false;
+        if (size >= sizeof(DDS_MAGIC) && memcmp(file, DDS_MAGIC, sizeof(DDS_MAGIC)) == 0) {
+            parsed = ParseDds(file, size, name, texture);
+        }
+        else if (size >= sizeof(KTX_MAGIC) && memcmp(file, KTX_MAGIC, sizeof(KTX_MAGIC)) == 0) {
+            parsed = ParseKtx(file, size, name, texture);
+        }
+        if (!parsed) {
+            return false;
+        }
+        if (texture->width <= 0 || texture->height <= 0) {
+            fprintf(stderr, "ERROR: %s has no pixels\n", name);
+            return false;
+        }
+
+        if (texture->flip && !CanFlip(*texture)) {
+            fprintf(stderr, "WARNING: texture %s cannot be flipped for GL and will appear upside down\n", name);
+            texture->flip = false;
+        }
+        return true;
+    }
+
+    // Reverses the first `rows` 2-bit index rows of a BC1 colour block
+    static void FlipColorBlock(const unsigned char* source, unsigned char* destination, int rows)
+    {
+        memcpy(destination, source, 8);
+        for (int row = 0; row < rows; row++) {
+            destination[4 + row] = source[4 + rows - 1 - row];
+        }
+    }
+
+    // BC2 alpha: one 16-bit row of 4-bit alphas per pixel row
+    static void FlipExplicitAlphaBlock(const unsigned char* source, unsigned char* destination, int rows)
+    {
+        memcpy(destination, source, 8);
+        for (int row = 0; row < rows; row++) {
+            destination[2 * row] = source[2 * (rows - 1 - row)];
+            destination[2 * row + 1] = source[2 * (rows - 1 - row) + 1];
+        }
+    }
+
+    // BC3 alpha and BC4/BC5 channels: two endpoints, then 12 bits of 3-bit indices per row
+    static void FlipInterpolatedBlock(const unsigned char* source, unsigned char* destination, int rows)
+    {
+        uint64_t indices = 0;
+        for (int i = 0; i < 6; i++) {
+            indices |= static_cast<uint64_t>(source[2 + i]) << (8 * i);
+        }
+
+        uint64_t flipped = indices;
+        for (int row = 0; row < rows; row++) {
+            uint64_t bits = (indices >> (12 * (rows - 1 - row))) & 0xFFF;
+            flipped &= ~(static_cast<uint64_t>(0xFFF) << (12 * row));
+            flipped |= bits << (12 * row);
+        }
+
+        destination[0] = source[0];
+        destination[1] = source[1];
+        for (int i = 0; i < 6; i++) {
+            destination[2 + i] = static_cast<unsigned char>(flipped >> (8 * i));
+        }
+    }
+
+    static void FlipBlock(BlockCompression compression, const unsigned char* source, unsigned char* destination, int rows)
+    {
+        switch (compression) {
+        case BLOCK_BC1:
+            FlipColorBlock(source, destination, rows);
+            break;
+        case BLOCK_BC2:
+            FlipExplicitAlphaBlock(source, destination, rows);
+            FlipColorBlock(source + 8, destination + 8, rows);
+            break;
+        case BLOCK_BC3:
+            FlipInterpolatedBlock(source, destination, rows);
+            FlipColorBlock(source + 8, destination + 8, rows);
+            break;
+        case BLOCK_BC4:
+            FlipInterpolatedBlock(source, destination, rows);
+            break;
+        case BLOCK_BC5:
+            FlipInterpolatedBlock(source, destination, rows);
+            FlipInterpolatedBlock(source + 8, destination + 8, rows);
+            break;
+        case BLOCK_BC7:
+            memcpy(destination, source, 16);
+            break;
+        }
+    }
+
+    void CopyCompressedMips(const unsigned char* file, const CompressedTexture& texture, unsigned char* destination)
+    {
+        size_t blockBytes = BlockBytes(texture.compression);
+
+        for (int face = 0; face < texture.faces; face++) {
+            size_t faceOffset = face * texture.faceSize;
+            for (size_t i = 0; i < texture.mips.size(); i++) {
+                const CompressedMip& mip = texture.mips[i];
+                const unsigned char* source = file + mip.fileOffset + faceOffset;
+                unsigned char* target = destination + mip.offset + faceOffset;
+                if (!texture.flip) {
+                    memcpy(target, source, mip.size);
+                    continue;
+                }
+
+                // block rows swap ends, and the pixel rows inside each block reverse
+                size_t blocksX = static_cast<size_t>((mip.width + 3) / 4);
+                size_t blocksY = static_cast<size_t>((mip.height + 3) / 4);
+                size_t rowBytes = blocksX * blockBytes;
+                int rows = mip.height < 4 ? mip.height : 4;
+                for (size_t y = 0; y < blocksY; y++) {
+                    const unsigned char* sourceRow = source + (blocksY - 1 - y) * rowBytes;
+                    unsigned char* targetRow = target + y * rowBytes;
+                    for (size_t x = 0; x < blocksX; x++) {
+                        FlipBlock(texture.compression, sourceRow + x * blockBytes, targetRow + x * blockBytes, rows);
+                    }
+                }
+            }
+        }
+    }
+
+    bool IsCompressedFormatSupported(GLenum internalFormat)
+    {
+        switch (internalFormat) {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+            return GLEW_EXT_texture_compression_s3tc != 0;
+        case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+            return GLEW_EXT_texture_compression_s3tc && GLEW_EXT_texture_sRGB;
+        case GL_COMPRESSED_RED_RGTC1:
+        case GL_COMPRESSED_RG_RGTC2:
+            // core since GL 3.0
+            return true;
+        case GL_COMPRESSED_RGBA_BPTC_UNORM:
+        case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+            return GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc;
+        default:
+            return false;
+        }
+    }
+
+}
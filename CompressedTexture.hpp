@@ -0,0 +1,67 @@
+#ifndef CompressedTexture_hpp
+#define CompressedTexture_hpp
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+    enum BlockCompression
+    {
+        BLOCK_BC1,
+        BLOCK_BC2,
+        BLOCK_BC3,
+        BLOCK_BC4,
+        BLOCK_BC5,
+        BLOCK_BC7
+    };
+
+    struct CompressedMip
+    {
+        int width;
+        int height;
+        // where the level starts in the file, and in the packed copy made by CopyCompressedMips
+        size_t fileOffset;
+        size_t offset;
+        size_t size;
+    };
+
+    // Layout of a block-compressed 2D texture or cube map inside a DDS or KTX
+    // file. The blocks go to the GPU as they are; nothing is decoded on the CPU.
+    struct CompressedTexture
+    {
+        BlockCompression compression;
+        GLenum internalFormat;
+        int width;
+        int height;
+        std::vector<CompressedMip> mips;
+        // 6 for a cube map: faces +X, -X, +Y, -Y, +Z, -Z, each a chain laid out
+        // like `mips` and `faceSize` bytes after the previous one
+        int faces;
+        size_t faceSize;
+        // bytes of every level of every face packed back to back
+        size_t dataSize;
+        // rows are stored top-down and CopyCompressedMips turns them bottom-up for GL
+        bool flip;
+    };
+
+    // True for files starting with the DDS or KTX 1 signature
+    bool IsCompressedTextureFile(const unsigned char* file, size_t size);
+
+    // Reads the header and mip layout of a DDS (legacy or DX10 header) or KTX 1 file
+    // holding a BC1, BC2, BC3, BC4, BC5 or BC7 texture. DDS cube maps with all six
+    // faces are read too; arrays, volumes and KTX cube maps are rejected.
+    bool ParseCompressedTexture(const unsigned char* file, size_t size, const char* name, CompressedTexture* texture);
+
+    // Packs every level of every face into `destination` (texture.dataSize bytes),
+    // mirroring the blocks vertically when texture.flip is set
+    void CopyCompressedMips(const unsigned char* file, const CompressedTexture& texture, unsigned char* destination);
+
+    // GL thread: whether the driver samples this format
+    bool IsCompressedFormatSupported(GLenum internalFormat);
+
+}
+
+#endif /* CompressedTexture_hpp */
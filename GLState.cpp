@@ -0,0 +1,197 @@
+#include "GLState.hpp"
+
+namespace gps {
+
+    // never a valid name, so the first bind after Invalidate always reaches GL
+    static const GLuint UNKNOWN_NAME = ~0u;
+    static const GLenum UNKNOWN_ENUM = 0;
+
+    GLState::GLState()
+    {
+        Invalidate();
+        ResetCounters();
+    }
+
+    GLState& GLState::Instance()
+    {
+        static GLState* state = new GLState();
+        return *state;
+    }
+
+    template <typename T>
+    bool GLState::Skip(T& current, T value, Kind kind)
+    {
+        if (current == value) {
+            counters[kind].skipped++;
+            return true;
+        }
+        current = value;
+        counters[kind].issued++;
+        return false;
+    }
+
+    int GLState::TargetIndex(GLenum target)
+    {
+        switch (target) {
+        case GL_TEXTURE_2D:
+            return 0;
+        case GL_TEXTURE_2D_ARRAY:
+            return 1;
+        case GL_TEXTURE_CUBE_MAP:
+            return 2;
+        default:
+            return -1;
+        }
+    }
+
+    void GLState::UseProgram(GLuint program)
+    {
+        if (!Skip(this->program, program, STATE_PROGRAM)) {
+            glUseProgram(program);
+        }
+    }
+
+    void GLState::BindVertexArray(GLuint vertexArray)
+    {
+        if (!Skip(this->vertexArray, vertexArray, STATE_VERTEX_ARRAY)) {
+            glBindVertexArray(vertexArray);
+        }
+    }
+
+    void GLState::BindTexture(GLuint unit, GLenum target, GLuint texture)
+    {
+        int targetIndex = TargetIndex(target);
+        if (unit < MAX_UNITS && targetIndex >= 0 && textures[unit][targetIndex] == texture) {
+            counters[STATE_TEXTURE].skipped++;
+            return;
+        }
+        if (activeUnit != unit) {
+            activeUnit = unit;
+            glActiveTexture(GL_TEXTURE0 + unit);
+            counters[STATE_TEXTURE].issued++;
+        }
+        BindTexture(target, texture);
+    }
+
+    void GLState::BindTexture(GLenum target, GLuint texture)
+    {
+        int targetIndex = TargetIndex(target);
+        if (activeUnit < MAX_UNITS && targetIndex >= 0) {
+            if (!Skip(textures[activeUnit][targetIndex], texture, STATE_TEXTURE)) {
+                glBindTexture(target, texture);
+            }
+            return;
+        }
+        // units past MAX_UNITS and other targets are not tracked
+        glBindTexture(target, texture);
+        counters[STATE_TEXTURE].issued++;
+    }
+
+    GLuint GLState::BoundTexture(GLuint unit, GLenum target) const
+    {
+        int targetIndex = TargetIndex(target);
+        if (unit >= MAX_UNITS || targetIndex < 0 || textures[unit][targetIndex] == UNKNOWN_NAME) {
+            return 0;
+        }
+        return textures[unit][targetIndex];
+    }
+
+    void GLState::SetDepthTest(bool enabled)
+    {
+        if (!Skip(depthTest, enabled ? 1 : 0, STATE_DEPTH)) {
+            if (enabled) {
+                glEnable(GL_DEPTH_TEST);
+            }
+            else {
+                glDisable(GL_DEPTH_TEST);
+            }
+        }
+    }
+
+    void GLState::SetDepthFunc(GLenum func)
+    {
+        if (!Skip(depthFunc, func, STATE_DEPTH)) {
+            glDepthFunc(func);
+        }
+    }
+
+    void GLState::SetCullFace(bool enabled)
+    {
+        if (!Skip(cullFace, enabled ? 1 : 0, STATE_CULL)) {
+            if (enabled) {
+                glEnable(GL_CULL_FACE);
+            }
+            else {
+                glDisable(GL_CULL_FACE);
+            }
+        }
+    }
+
+    void GLState::SetCullFaceMode(GLenum mode)
+    {
+        if (!Skip(cullFaceMode, mode, STATE_CULL)) {
+            glCullFace(mode);
+        }
+    }
+
+    void GLState::DeleteTexture(GLuint texture)
+    {
+        glDeleteTextures(1, &texture);
+        // GL unbinds a deleted texture from every unit
+        for (GLuint unit = 0; unit < MAX_UNITS; unit++) {
+            for (int target = 0; target < TARGET_COUNT; target++) {
+                if (textures[unit][target] == texture) {
+                    textures[unit][target] = 0;
+                }
+            }
+        }
+    }
+
+    void GLState::DeleteVertexArray(GLuint vertexArray)
+    {
+        glDeleteVertexArrays(1, &vertexArray);
+        if (this->vertexArray == vertexArray) {
+            this->vertexArray = 0;
+        }
+    }
+
+    void GLState::Invalidate()
+    {
+        program = UNKNOWN_NAME;
+        vertexArray = UNKNOWN_NAME;
+        activeUnit = UNKNOWN_NAME;
+        for (GLuint unit = 0; unit < MAX_UNITS; unit++) {
+            for (int target = 0; target < TARGET_COUNT; target++) {
+                textures[unit][target] = UNKNOWN_NAME;
+            }
+        }
+        depthTest = -1;
+        cullFace = -1;
+        depthFunc = UNKNOWN_ENUM;
+        cullFaceMode = UNKNOWN_ENUM;
+    }
+
+    GLState::Counters GLState::GetCounters(Kind kind) const
+    {
+        return counters[kind];
+    }
+
+    GLState::Counters GLState::GetTotalCounters() const
+    {
+        Counters total = { 0, 0 };
+        for (int kind = 0; kind < STATE_KIND_COUNT; kind++) {
+            total.issued += counters[kind].issued;
+            total.skipped += counters[kind].skipped;
+        }
+        return total;
+    }
+
+    void GLState::ResetCounters()
+    {
+        for (int kind = 0; kind < STATE_KIND_COUNT; kind++) {
+            counters[kind].issued = 0;
+            counters[kind].skipped = 0;
+        }
+    }
+
+}
@@ -0,0 +1,92 @@
+#ifndef GLState_hpp
+#define GLState_hpp
+
+#include <GL/glew.h>
+
+#include <cstdint>
+
+namespace gps {
+
+// Shadow copy of the GL state the renderer changes per draw: the program,
+// the vertex array, the textures of each unit, depth testing and face
+// culling. Setting a value that is already current skips the GL call; the
+// counters tell how many calls went to the driver and how many were saved.
+// Code that changes this state must go through here, or call Invalidate.
+class GLState
+{
+public:
+    enum Kind
+    {
+        STATE_PROGRAM,
+        STATE_VERTEX_ARRAY,
+        STATE_TEXTURE,
+        STATE_DEPTH,
+        STATE_CULL,
+        STATE_KIND_COUNT
+    };
+
+    struct Counters
+    {
+        uint64_t issued;
+        uint64_t skipped;
+    };
+
+    static GLState& Instance();
+
+    void UseProgram(GLuint program);
+    void BindVertexArray(GLuint vertexArray);
+
+    // Binds on texture unit `unit` (0-based), switching the active unit only when needed
+    void BindTexture(GLuint unit, GLenum target, GLuint texture);
+    // Binds on whichever unit is active, for uploads that do not care
+    void BindTexture(GLenum target, GLuint texture);
+    // Texture bound to `target` on `unit`, as far as the cache knows; 0 when unknown
+    GLuint BoundTexture(GLuint unit, GLenum target) const;
+
+    void SetDepthTest(bool enabled);
+    void SetDepthFunc(GLenum func);
+    void SetCullFace(bool enabled);
+    void SetCullFaceMode(GLenum mode);
+
+    // Delete GL objects and forget the bindings GL drops with them, so a
+    // recycled name is not mistaken for the bound one
+    void DeleteTexture(GLuint texture);
+    void DeleteVertexArray(GLuint vertexArray);
+
+    // Forgets everything; the next call of each kind goes to GL
+    void Invalidate();
+
+    Counters GetCounters(Kind kind) const;
+    Counters GetTotalCounters() const;
+    void ResetCounters();
+
+private:
+    GLState();
+    GLState(const GLState&);
+    GLState& operator=(const GLState&);
+
+    // units cached; binds on higher ones always go to GL
+    static const GLuint MAX_UNITS = 32;
+    // GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY and GL_TEXTURE_CUBE_MAP; other targets are not cached
+    static const int TARGET_COUNT = 3;
+
+    GLuint program;
+    GLuint vertexArray;
+    GLuint activeUnit;
+    GLuint textures[MAX_UNITS][TARGET_COUNT];
+    // -1 unknown, else 0 or 1
+    int depthTest;
+    int cullFace;
+    GLenum depthFunc;
+    GLenum cullFaceMode;
+    Counters counters[STATE_KIND_COUNT];
+
+    static int TargetIndex(GLenum target);
+    // true when `current` already holds `value`; otherwise stores it and counts the call
+    template <typename T>
+    bool Skip(T& current, T value, Kind kind);
+};
+
+}
+
+#endif /* GLState_hpp */
@@ -0,0 +1,221 @@
+#include "GeometryPool.hpp"
+#include "GLState.hpp"
+
+#include <algorithm>
+
+namespace gps {
+
+    // Sizes the pools start at, grown by doubling
+    static const size_t INITIAL_VERTEX_COUNT = 256 * 1024;
+    static const size_t INITIAL_INDEX_BYTES = 4 * 1024 * 1024;
+    // index slices start on 4 bytes, valid for either index type
+    static const size_t INDEX_ALIGNMENT = 4;
+
+    static size_t AlignIndexBytes(size_t bytes)
+    {
+        return (bytes + INDEX_ALIGNMENT - 1) / INDEX_ALIGNMENT * INDEX_ALIGNMENT;
+    }
+
+    bool GeometryPool::FreeList::Allocate(size_t size, size_t* offset)
+    {
+        for (std::map<size_t, size_t>::iterator it = ranges.begin(); it != ranges.end(); ++it) {
+            if (it->second < size) {
+                continue;
+            }
+            *offset = it->first;
+            size_t rest = it->second - size;
+            ranges.erase(it);
+            if (rest > 0) {
+                ranges[*offset + size] = rest;
+            }
+            used += size;
+            return true;
+        }
+        return false;
+    }
+
+    void GeometryPool::FreeList::Free(size_t offset, size_t size)
+    {
+        used -= size;
+        std::map<size_t, size_t>::iterator next = ranges.lower_bound(offset);
+        // merge with the free range right after, then the one right before
+        if (next != ranges.end() && next->first == offset + size) {
+            size += next->second;
+            next = ranges.erase(next);
+        }
+        if (next != ranges.begin()) {
+            std::map<size_t, size_t>::iterator previous = next;
+            --previous;
+            if (previous->first + previous->second == offset) {
+                previous->second += size;
+                return;
+            }
+        }
+        ranges[offset] = size;
+    }
+
+    void GeometryPool::FreeList::Grow(size_t newCapacity)
+    {
+        size_t oldCapacity = capacity;
+        capacity = newCapacity;
+        // the grown space is free, like a freed range at the old end
+        used += newCapacity - oldCapacity;
+        Free(oldCapacity, newCapacity - oldCapacity);
+    }
+
+    GeometryPool::GeometryPool()
+    {
+        pools[VERTEX_FORMAT_FULL].stride = sizeof(Vertex);
+        pools[VERTEX_FORMAT_COMPACT].stride = sizeof(CompactVertex);
+        for (int format = 0; format < 2; format++) {
+            pools[format].vertexArray = 0;
+            pools[format].vertexBuffer = 0;
+            pools[format].indexBuffer = 0;
+        }
+    }
+
+    GeometryPool& GeometryPool::Instance()
+    {
+        static GeometryPool* pool = new GeometryPool();
+        return *pool;
+    }
+
+    void GeometryPool::SetVertexAttributes(VertexFormat format)
+    {
+        if (format == VERTEX_FORMAT_FULL) {
+            // Vertex Positions
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
+            // Vertex Normals
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
+            // Vertex Texture Coords
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+            return;
+        }
+
+        // Vertex Positions, normalized to [0, 1]
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(CompactVertex), (GLvoid*)offsetof(CompactVertex, Position));
+        // Vertex Normals, octahedral in [-1, 1]
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(CompactVertex), (GLvoid*)offsetof(CompactVertex, Normal));
+        // Vertex Texture Coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(CompactVertex), (GLvoid*)offsetof(CompactVertex, TexCoords));
+    }
+
+    GeometryPool::Pool& GeometryPool::PoolFor(VertexFormat format)
+    {
+        Pool& pool = pools[format];
+        if (pool.vertexArray != 0) {
+            return pool;
+        }
+
+        glGenVertexArrays(1, &pool.vertexArray);
+        glGenBuffers(1, &pool.vertexBuffer);
+        glGenBuffers(1, &pool.indexBuffer);
+        pool.vertices.Grow(INITIAL_VERTEX_COUNT);
+        pool.indices.Grow(INITIAL_INDEX_BYTES);
+
+        GLState::Instance().BindVertexArray(pool.vertexArray);
+        glBindBuffer(GL_ARRAY_BUFFER, pool.vertexBuffer);
+        glBufferData(GL_ARRAY_BUFFER, INITIAL_VERTEX_COUNT * pool.stride, NULL, GL_STATIC_DRAW);
+        SetVertexAttributes(format);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.indexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, INITIAL_INDEX_BYTES, NULL, GL_STATIC_DRAW);
+        GLState::Instance().BindVertexArray(0);
+        return pool;
+    }
+
+    void GeometryPool::GrowBuffer(VertexFormat format, GLuint* buffer, size_t oldBytes, size_t newBytes)
+    {
+        Pool& pool = pools[format];
+        GLuint grown;
+        glGenBuffers(1, &grown);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+        glBufferData(GL_COPY_WRITE_BUFFER, newBytes, NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_READ_BUFFER, *buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldBytes);
+        glDeleteBuffers(1, buffer);
+        *buffer = grown;
+
+        // the vertex array keeps the buffers its attributes were set up with
+        GLState::Instance().BindVertexArray(pool.vertexArray);
+        glBindBuffer(GL_ARRAY_BUFFER, pool.vertexBuffer);
+        SetVertexAttributes(format);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.indexBuffer);
+        GLState::Instance().BindVertexArray(0);
+    }
+
+    Buffers GeometryPool::Allocate(VertexFormat format, const void* vertexData, size_t vertexCount, const void* indexData, size_t indexBytes)
+    {
+        Pool& pool = PoolFor(format);
+        size_t alignedIndexBytes = AlignIndexBytes(indexBytes);
+
+        size_t firstVertex = 0;
+        while (vertexCount > 0 && !pool.vertices.Allocate(vertexCount, &firstVertex)) {
+            size_t capacity = pool.vertices.Capacity();
+            size_t grown = std::max(capacity * 2, capacity + vertexCount);
+            GrowBuffer(format, &pool.vertexBuffer, capacity * pool.stride, grown * pool.stride);
+            pool.vertices.Grow(grown);
+        }
+        size_t indexOffset = 0;
+        while (alignedIndexBytes > 0 && !pool.indices.Allocate(alignedIndexBytes, &indexOffset)) {
+            size_t capacity = pool.indices.Capacity();
+            size_t grown = std::max(capacity * 2, capacity + alignedIndexBytes);
+            GrowBuffer(format, &pool.indexBuffer, capacity, grown);
+            pool.indices.Grow(grown);
+        }
+
+        // the copy targets leave the vertex array's element buffer alone
+        if (vertexCount > 0) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, pool.vertexBuffer);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, firstVertex * pool.stride, vertexCount * pool.stride, vertexData);
+        }
+        if (indexBytes > 0) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, pool.indexBuffer);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, indexOffset, indexBytes, indexData);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        Buffers buffers;
+        buffers.VAO = pool.vertexArray;
+        buffers.baseVertex = static_cast<GLint>(firstVertex);
+        buffers.vertexCount = vertexCount;
+        buffers.indexOffset = indexOffset;
+        buffers.indexBytes = alignedIndexBytes;
+        return buffers;
+    }
+
+    void GeometryPool::Free(VertexFormat format, const Buffers& buffers)
+    {
+        Pool& pool = pools[format];
+        if (buffers.vertexCount > 0) {
+            pool.vertices.Free(buffers.baseVertex, buffers.vertexCount);
+        }
+        if (buffers.indexBytes > 0) {
+            pool.indices.Free(buffers.indexOffset, buffers.indexBytes);
+        }
+    }
+
+    size_t GeometryPool::UsedBytes() const
+    {
+        size_t bytes = 0;
+        for (int format = 0; format < 2; format++) {
+            bytes += pools[format].vertices.Used() * pools[format].stride + pools[format].indices.Used();
+        }
+        return bytes;
+    }
+
+    size_t GeometryPool::CapacityBytes() const
+    {
+        size_t bytes = 0;
+        for (int format = 0; format < 2; format++) {
+            bytes += pools[format].vertices.Capacity() * pools[format].stride + pools[format].indices.Capacity();
+        }
+        return bytes;
+    }
+
+}
@@ -0,0 +1,80 @@
+#ifndef GeometryPool_hpp
+#define GeometryPool_hpp
+
+#include "Mesh.hpp"
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <map>
+
+namespace gps {
+
+// Vertex and index buffers shared by every mesh of a vertex format, behind
+// one vertex array. Meshes get a slice of each, drawn through a base vertex
+// and an index byte offset, and hand it back when they are unloaded. The
+// buffers grow (copied on the GPU) when no free range is large enough.
+class GeometryPool
+{
+public:
+    static GeometryPool& Instance();
+
+    // GL thread: copies `vertexCount` vertices laid out for `format` and
+    // `indexBytes` bytes of indices into the pool
+    Buffers Allocate(VertexFormat format, const void* vertexData, size_t vertexCount, const void* indexData, size_t indexBytes);
+
+    // GL thread: returns a slice to the pool
+    void Free(VertexFormat format, const Buffers& buffers);
+
+    // Bytes in use and reserved, over both formats
+    size_t UsedBytes() const;
+    size_t CapacityBytes() const;
+
+private:
+    GeometryPool();
+    GeometryPool(const GeometryPool&);
+    GeometryPool& operator=(const GeometryPool&);
+
+    // First-fit allocator over [0, capacity), in the units of its buffer
+    class FreeList
+    {
+    public:
+        FreeList() : capacity(0), used(0) {}
+        // false when no free range is large enough
+        bool Allocate(size_t size, size_t* offset);
+        void Free(size_t offset, size_t size);
+        // adds [capacity, newCapacity) as free space
+        void Grow(size_t newCapacity);
+        size_t Capacity() const { return capacity; }
+        size_t Used() const { return used; }
+
+    private:
+        // free ranges by offset, never adjacent to each other
+        std::map<size_t, size_t> ranges;
+        size_t capacity;
+        size_t used;
+    };
+
+    struct Pool
+    {
+        GLuint vertexArray;
+        GLuint vertexBuffer;
+        GLuint indexBuffer;
+        size_t stride;
+        // in vertices
+        FreeList vertices;
+        // in bytes, 4-byte aligned
+        FreeList indices;
+    };
+
+    Pool pools[2];
+
+    Pool& PoolFor(VertexFormat format);
+    // Replaces `*buffer` by a larger copy; the vertex array is pointed at it again
+    void GrowBuffer(VertexFormat format, GLuint* buffer, size_t oldBytes, size_t newBytes);
+    static void SetVertexAttributes(VertexFormat format);
+};
+
+}
+
+#endif /* GeometryPool_hpp */
@@ -0,0 +1,82 @@
+#include "InstanceBuffer.hpp"
+
+#include "glm/gtc/matrix_inverse.hpp"
+
+#include <algorithm>
+#include <cstddef>
+
+namespace gps {
+
+    InstanceBuffer::InstanceBuffer()
+        : buffer(0), count(0), boundsCenter(0.0f), boundsRadius(0.0f), maxScale(0.0f)
+    {
+    }
+
+    InstanceBuffer::~InstanceBuffer()
+    {
+        if (buffer != 0) {
+            glDeleteBuffers(1, &buffer);
+        }
+    }
+
+    void InstanceBuffer::Update(const std::vector<glm::mat4>& models)
+    {
+        staging.resize(models.size());
+        glm::vec3 minOrigin(0.0f);
+        glm::vec3 maxOrigin(0.0f);
+        maxScale = 0.0f;
+        for (size_t i = 0; i < models.size(); i++) {
+            const glm::mat4& model = models[i];
+            staging[i].model = model;
+            staging[i].normalMatrix = glm::inverseTranspose(glm::mat3(model));
+
+            glm::vec3 origin = glm::vec3(model[3]);
+            minOrigin = i == 0 ? origin : glm::min(minOrigin, origin);
+            maxOrigin = i == 0 ? origin : glm::max(maxOrigin, origin);
+            maxScale = std::max(maxScale, std::max(glm::length(glm::vec3(model[0])),
+                std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2])))));
+        }
+        boundsCenter = (minOrigin + maxOrigin) * 0.5f;
+        boundsRadius = 0.0f;
+        for (size_t i = 0; i < models.size(); i++) {
+            boundsRadius = std::max(boundsRadius, glm::length(glm::vec3(models[i][3]) - boundsCenter));
+        }
+        count = models.size();
+
+        if (buffer == 0) {
+            glGenBuffers(1, &buffer);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferData(GL_ARRAY_BUFFER, staging.size() * sizeof(Instance), staging.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void InstanceBuffer::BindAttributes() const
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        // one column per location, advancing once per instance
+        for (GLuint column = 0; column < 4; column++) {
+            GLuint location = FIRST_ATTRIBUTE + column;
+            glEnableVertexAttribArray(location);
+            glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                (GLvoid*)(offsetof(Instance, model) + column * sizeof(glm::vec4)));
+            glVertexAttribDivisor(location, 1);
+        }
+        for (GLuint column = 0; column < 3; column++) {
+            GLuint location = FIRST_ATTRIBUTE + 4 + column;
+            glEnableVertexAttribArray(location);
+            glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                (GLvoid*)(offsetof(Instance, normalMatrix) + column * sizeof(glm::vec3)));
+            glVertexAttribDivisor(location, 1);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void InstanceBuffer::UnbindAttributes()
+    {
+        for (GLuint location = FIRST_ATTRIBUTE; location < FIRST_ATTRIBUTE + ATTRIBUTE_COUNT; location++) {
+            glDisableVertexAttribArray(location);
+        }
+    }
+
+}
@@ -0,0 +1,62 @@
+#ifndef InstanceBuffer_hpp
+#define InstanceBuffer_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+// Per-instance transforms of Model3D::DrawInstanced, in a vertex buffer read
+// through instanced attributes: the model matrix at locations 3-6 and the
+// inverse transpose of its upper 3x3 at 7-9. Shaders turn the latter into
+// the normal matrix with the rotation of the view.
+class InstanceBuffer
+{
+public:
+    // First attribute location; the model matrix takes 4, the normal matrix 3
+    static const GLuint FIRST_ATTRIBUTE = 3;
+    static const GLuint ATTRIBUTE_COUNT = 7;
+
+    InstanceBuffer();
+    ~InstanceBuffer();
+
+    // GL thread: replaces the instances with `models`
+    void Update(const std::vector<glm::mat4>& models);
+
+    size_t Count() const { return count; }
+
+    // Sphere around the instance origins, and the largest axis scale of any instance
+    const glm::vec3& BoundsCenter() const { return boundsCenter; }
+    float BoundsRadius() const { return boundsRadius; }
+    float MaxScale() const { return maxScale; }
+
+    // Points the instanced attributes of the bound vertex array at this buffer;
+    // UnbindAttributes disables them again so other draws of the array never
+    // read a buffer that may be gone
+    void BindAttributes() const;
+    static void UnbindAttributes();
+
+private:
+    InstanceBuffer(const InstanceBuffer&);
+    InstanceBuffer& operator=(const InstanceBuffer&);
+
+    struct Instance
+    {
+        glm::mat4 model;
+        glm::mat3 normalMatrix;
+    };
+
+    GLuint buffer;
+    size_t count;
+    glm::vec3 boundsCenter;
+    float boundsRadius;
+    float maxScale;
+    std::vector<Instance> staging;
+};
+
+}
+
+#endif /* InstanceBuffer_hpp */
@@ -1,6 +1,24 @@
 #include "Mesh.hpp"
+#include "GeometryPool.hpp"
+#include "GLState.hpp"
+#include "InstanceBuffer.hpp"
+#include "MeshClusters.hpp"
+#include "RenderQueue.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
 namespace gps {
 
+	// Half floats keep at least 1/1024 of a texture repeat below 2 (1/512 from
+	// there to 4); meshes with larger (tiled) coordinates stay at full floats
+	static const float COMPACT_MAX_TEXCOORD = 2.0f;
+	// Largest quantization step of a position, in object units (about a
+	// millimetre at the scale of the models here). Positions use 65536 steps
+	// over the bounds of the whole mesh, so a large merged mesh stays at full floats.
+	static const float COMPACT_MAX_POSITION_STEP = 1.0f / 1024.0f;
+
 	/* Mesh Constructor */
 	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures)
 	{
@@ -8,64 +26,427 @@ namespace gps {
 		this->indices = indices;
 		this->textures = textures;
 
+		SubMesh submesh;
+		submesh.firstIndex = 0;
+		submesh.indexCount = static_cast<GLsizei>(indices.size());
+		submesh.baseVertex = 0;
+		submesh.vertexCount = static_cast<GLsizei>(vertices.size());
+		submesh.textures = textures;
+		submesh.uvDensity = 0.0f;
+		this->submeshes.push_back(submesh);
+		this->lodErrors.push_back(0.0f);
+		this->format = VERTEX_FORMAT_FULL;
+
 		this->setupMesh();
 	}
 
+	Mesh::Mesh(const Vertex* vertexData, size_t vertexCount, const GLuint* indexData, size_t indexCount, std::vector<SubMesh> submeshes,
+		std::vector<float> lodErrors, VertexFormat format)
+	{
+		this->submeshes = submeshes;
+		this->lodErrors = lodErrors;
+		if (this->lodErrors.empty())
+			this->lodErrors.push_back(0.0f);
+		this->format = format;
+
+		this->setupMesh(vertexData, vertexCount, indexData, indexCount);
+	}
+
+	// Textures mesh draws left bound, plain and array units. Draws no longer
+	// unbind at the end; a later range with fewer textures clears a unit only
+	// while it still holds what a mesh put there, not what other code bound.
+	static GLuint meshTextures[2][TEXTURE_ARRAY_UNIT_BASE];
+
+	static void BindMeshTexture(GLuint unit, GLenum target, GLuint id)
+	{
+		bool array = target == GL_TEXTURE_2D_ARRAY;
+		GLState::Instance().BindTexture(array ? TEXTURE_ARRAY_UNIT_BASE + unit : unit, target, id);
+		meshTextures[array][unit] = id;
+	}
+
+	static void ClearMeshTexture(GLuint unit, GLenum target)
+	{
+		bool array = target == GL_TEXTURE_2D_ARRAY;
+		GLuint stateUnit = array ? TEXTURE_ARRAY_UNIT_BASE + unit : unit;
+		if (meshTextures[array][unit] != 0 && GLState::Instance().BoundTexture(stateUnit, target) == meshTextures[array][unit])
+			GLState::Instance().BindTexture(stateUnit, target, 0);
+		meshTextures[array][unit] = 0;
+	}
+
+	static bool SameTextures(const std::vector<Texture>& a, const std::vector<Texture>& b)
+	{
+		if (a.size() != b.size())
+			return false;
+		for (size_t i = 0; i < a.size(); i++) {
+			if (a[i].id != b[i].id || a[i].layer != b[i].layer || a[i].type != b[i].type)
+				return false;
+		}
+		return true;
+	}
+
 	Buffers Mesh::getBuffers() {
 	    return this->buffers;
 	}
 
-	/* Mesh drawing function - also applies associated textures */
+	void Mesh::Release() {
+		GeometryPool::Instance().Free(this->format, this->buffers);
+		this->buffers.vertexCount = 0;
+		this->buffers.indexBytes = 0;
+	}
+
+	/* Mesh drawing function - one draw per material range, textures only change between ranges */
 	void Mesh::Draw(gps::Shader shader)
+	{
+		this->Draw(shader, 0);
+	}
+
+	void Mesh::Draw(gps::Shader shader, int lod, const ClusterCulling* culling, const ClusterLod* clusterLod)
 	{
 		shader.useShaderProgram();
+		this->drawRanges(shader, lod, culling, clusterLod, NULL);
+	}
 
-		//set textures
-		for (GLuint i = 0; i < textures.size(); i++)
+	void Mesh::DrawInstanced(gps::Shader shader, const InstanceBuffer& instances, int lod)
+	{
+		shader.useShaderProgram();
+		// the shaders take the transforms from the instance attributes while this is set
+		glUniform1i(shader.uniformLocation("instanced"), 1);
+		this->drawRanges(shader, lod, NULL, NULL, &instances);
+		glUniform1i(shader.uniformLocation("instanced"), 0);
+	}
+
+	void Mesh::drawRanges(const gps::Shader& shader, int lod, const ClusterCulling* culling, const ClusterLod* clusterLod,
+		const InstanceBuffer* instances)
+	{
+		this->bindVertexFormat(shader);
+
+		const std::vector<Texture>* boundTextures = NULL;
+		for (size_t s = 0; s < this->submeshes.size(); s++)
+		{
+			const SubMesh& submesh = this->submeshes[s];
+			drawCounts.clear();
+			drawOffsets.clear();
+			this->collectRuns(submesh, lod, culling, clusterLod, drawCounts, drawOffsets);
+			if (drawCounts.empty())
+				continue;
+
+			bindTextures(shader, submesh.textures, boundTextures);
+			boundTextures = &submesh.textures;
+			this->drawRuns(submesh, drawCounts.data(), drawOffsets.data(), drawCounts.size(), instances);
+		}
+	}
+
+	void Mesh::Enqueue(RenderQueue& queue, const gps::Shader& shader, uint32_t transform, float depth, int lod, const ClusterCulling* culling,
+		const ClusterLod* clusterLod)
+	{
+		this->enqueueRanges(queue, shader, transform, depth, lod, culling, clusterLod, NULL);
+	}
+
+	void Mesh::EnqueueInstanced(RenderQueue& queue, const gps::Shader& shader, const InstanceBuffer& instances, float depth, int lod)
+	{
+		// no queue transform: each instance brings its own
+		this->enqueueRanges(queue, shader, ~0u, depth, lod, NULL, NULL, &instances);
+	}
+
+	void Mesh::enqueueRanges(RenderQueue& queue, const gps::Shader& shader, uint32_t transform, float depth, int lod,
+		const ClusterCulling* culling, const ClusterLod* clusterLod, const InstanceBuffer* instances)
+	{
+		for (size_t s = 0; s < this->submeshes.size(); s++)
 		{
-			glActiveTexture(GL_TEXTURE0 + i);
-			glUniform1i(glGetUniformLocation(shader.shaderProgram, this->textures[i].type.c_str()), i);
-			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
+			const SubMesh& submesh = this->submeshes[s];
+			drawCounts.clear();
+			drawOffsets.clear();
+			this->collectRuns(submesh, lod, culling, clusterLod, drawCounts, drawOffsets);
+			if (!drawCounts.empty())
+				queue.Push(shader, *this, submesh, transform, depth, drawCounts, drawOffsets, instances);
 		}
+	}
 
-		glBindVertexArray(this->buffers.VAO);
-		glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+	void Mesh::bindVertexFormat(const gps::Shader& shader) const
+	{
+		// decode of compact vertices; identity for full floats
+		glUniform3f(shader.uniformLocation("positionScale"), positionScale.x, positionScale.y, positionScale.z);
+		glUniform3f(shader.uniformLocation("positionOffset"), positionOffset.x, positionOffset.y, positionOffset.z);
+		glUniform1i(shader.uniformLocation("octahedralNormals"), format == VERTEX_FORMAT_COMPACT);
 
-        for(GLuint i = 0; i < this->textures.size(); i++)
-        {
-            glActiveTexture(GL_TEXTURE0 + i);
-            glBindTexture(GL_TEXTURE_2D, 0);
-        }
+		GLState::Instance().BindVertexArray(this->buffers.VAO);
+	}
+
+	// Index runs to draw: the whole range or level, or the visible clusters (each at
+	// its own level) merged into runs
+	void Mesh::collectRuns(const SubMesh& submesh, int lod, const ClusterCulling* culling, const ClusterLod* clusterLod,
+		std::vector<GLsizei>& counts, std::vector<GLvoid*>& offsets) const
+	{
+		size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		size_t base = this->buffers.indexOffset;
+		bool perCluster = !submesh.clusters.empty() &&
+			(clusterLod != NULL || (culling != NULL && (lod <= 0 || submesh.lods.empty())));
+		if (perCluster)
+		{
+			// clusters at the same level sit next to each other and merge too
+			GLuint runEnd = ~0u;
+			for (size_t c = 0; c < submesh.clusters.size(); c++)
+			{
+				const Cluster& cluster = submesh.clusters[c];
+				int level = clusterLod != NULL ? SelectClusterLod(cluster, *clusterLod) : 0;
+				GLuint firstIndex = cluster.firstIndex;
+				GLsizei indexCount = cluster.indexCount;
+				if (level > 0)
+				{
+					firstIndex = cluster.lods[level - 1].firstIndex;
+					indexCount = cluster.lods[level - 1].indexCount;
+				}
+				// the backface cone only holds for the full-detail triangles
+				if (culling != NULL && !(level > 0 ? IsSphereVisible(cluster.center, cluster.radius, *culling) : IsClusterVisible(cluster, *culling)))
+					continue;
+				if (indexCount == 0)
+					continue;
+				if (firstIndex == runEnd)
+					counts.back() += indexCount;
+				else
+				{
+					counts.push_back(indexCount);
+					offsets.push_back((GLvoid*)(base + firstIndex * indexSize));
+				}
+				runEnd = firstIndex + indexCount;
+			}
+		}
+		else if (lod > 0 && !submesh.lods.empty())
+		{
+			const LodRange& range = submesh.lods[std::min<size_t>(lod, submesh.lods.size()) - 1];
+			counts.push_back(range.indexCount);
+			offsets.push_back((GLvoid*)(base + range.firstIndex * indexSize));
+		}
+		else
+		{
+			counts.push_back(submesh.indexCount);
+			offsets.push_back((GLvoid*)(base + submesh.firstIndex * indexSize));
+		}
+	}
 
-    }
+	bool Mesh::bindTextures(const gps::Shader& shader, const std::vector<Texture>& textures, const std::vector<Texture>* boundTextures)
+	{
+		if (boundTextures != NULL && SameTextures(*boundTextures, textures))
+			return false;
+
+		for (GLuint i = 0; i < textures.size(); i++)
+		{
+			const Texture& texture = textures[i];
+			// "<type>", "<type>Layer" and "<type>Array", hashed without building the strings
+			uint32_t typeHash = Shader::hashName(texture.type.c_str());
+			GLint layerLocation = shader.uniformLocation(Shader::hashName("Layer", typeHash));
+			// another layer of the array already bound only needs a new index
+			if (boundTextures != NULL && i < boundTextures->size() && (*boundTextures)[i].id == texture.id &&
+				(*boundTextures)[i].type == texture.type)
+			{
+				glUniform1i(layerLocation, texture.layer);
+				continue;
+			}
+			if (texture.layer < 0)
+			{
+				glUniform1i(shader.uniformLocation(typeHash), i);
+				BindMeshTexture(i, GL_TEXTURE_2D, texture.id);
+			}
+			else
+			{
+				glUniform1i(shader.uniformLocation(Shader::hashName("Array", typeHash)), TEXTURE_ARRAY_UNIT_BASE + i);
+				BindMeshTexture(i, GL_TEXTURE_2D_ARRAY, texture.id);
+			}
+			glUniform1i(layerLocation, texture.layer);
+		}
+		// a range with fewer textures must not sample the previous range's
+		for (GLuint i = textures.size(); i < TEXTURE_ARRAY_UNIT_BASE; i++)
+		{
+			ClearMeshTexture(i, GL_TEXTURE_2D);
+			ClearMeshTexture(i, GL_TEXTURE_2D_ARRAY);
+		}
+		return true;
+	}
+
+	void Mesh::drawRuns(const SubMesh& submesh, const GLsizei* counts, GLvoid* const* offsets, size_t runCount,
+		const InstanceBuffer* instances)
+	{
+		GLint baseVertex = this->buffers.baseVertex + submesh.baseVertex;
+		if (instances != NULL)
+		{
+			// the base vertex variant, since the mesh lives in the shared pool buffers
+			instances->BindAttributes();
+			for (size_t r = 0; r < runCount; r++)
+			{
+				glDrawElementsInstancedBaseVertex(GL_TRIANGLES, counts[r], indexType, offsets[r],
+					static_cast<GLsizei>(instances->Count()), baseVertex);
+			}
+			InstanceBuffer::UnbindAttributes();
+		}
+		else if (runCount == 1)
+		{
+			glDrawElementsBaseVertex(GL_TRIANGLES, counts[0], indexType, offsets[0], baseVertex);
+		}
+		else
+		{
+			drawBaseVertices.assign(runCount, baseVertex);
+			glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts, indexType, offsets,
+				static_cast<GLsizei>(runCount), drawBaseVertices.data());
+		}
+	}
 
 	// Initializes all the buffer objects/arrays
 	void Mesh::setupMesh(){
-		// Create buffers/arrays
-		glGenVertexArrays(1, &this->buffers.VAO);
-		glGenBuffers(1, &this->buffers.VBO);
-		glGenBuffers(1, &this->buffers.EBO);
-
-		glBindVertexArray(this->buffers.VAO);
-		// Load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.VBO);
-		glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers.EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
-
-		// Set the vertex attribute pointers
-		// Vertex Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
-		// Vertex Normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
-		// Vertex Texture Coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
-
-		glBindVertexArray(0);
+		this->setupMesh(this->vertices.data(), this->vertices.size(), this->indices.data(), this->indices.size());
+	}
+
+	void Mesh::setupMesh(const Vertex* vertexData, size_t vertexCount, const GLuint* indexData, size_t indexCount){
+		// Suballocate from the buffers shared by the vertex format
+		std::vector<CompactVertex> compact;
+		std::vector<GLushort> indices16;
+		const void* vertices = this->setupVertices(vertexData, vertexCount, compact);
+		const void* indices = this->setupIndices(indexData, indexCount, indices16);
+		size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		this->buffers = GeometryPool::Instance().Allocate(this->format, vertices, vertexCount, indices, indexCount * indexSize);
+	}
+
+	static bool CanCompact(const Vertex* vertexData, size_t vertexCount, const glm::vec3& extent)
+	{
+		for (int k = 0; k < 3; k++) {
+			if (extent[k] / 65535.0f > COMPACT_MAX_POSITION_STEP)
+				return false;
+		}
+		for (size_t i = 0; i < vertexCount; i++) {
+			const glm::vec2& uv = vertexData[i].TexCoords;
+			if (std::fabs(uv.x) > COMPACT_MAX_TEXCOORD || std::fabs(uv.y) > COMPACT_MAX_TEXCOORD)
+				return false;
+		}
+		return true;
+	}
+
+	// Round-to-nearest-even float to IEEE half conversion
+	static GLhalf FloatToHalf(float value)
+	{
+		GLuint bits;
+		memcpy(&bits, &value, sizeof(bits));
+		GLuint sign = (bits >> 16) & 0x8000;
+		int exponent = static_cast<int>((bits >> 23) & 0xff) - 127 + 15;
+		GLuint mantissa = bits & 0x7fffff;
+
+		// inf and nan
+		if (((bits >> 23) & 0xff) == 0xff)
+			return static_cast<GLhalf>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+		// overflow
+		if (exponent >= 31)
+			return static_cast<GLhalf>(sign | 0x7c00);
+		// subnormal or zero
+		if (exponent <= 0) {
+			if (exponent < -10)
+				return static_cast<GLhalf>(sign);
+			mantissa |= 0x800000;
+			GLuint shift = static_cast<GLuint>(14 - exponent);
+			GLuint half = mantissa >> shift;
+			GLuint rest = mantissa & ((1u << shift) - 1);
+			GLuint halfway = 1u << (shift - 1);
+			if (rest > halfway || (rest == halfway && (half & 1)))
+				half++;
+			return static_cast<GLhalf>(sign | half);
+		}
+
+		GLuint half = (static_cast<GLuint>(exponent) << 10) | (mantissa >> 13);
+		GLuint rest = mantissa & 0x1fff;
+		// a carry out of the mantissa correctly bumps the exponent
+		if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+			half++;
+		return static_cast<GLhalf>(sign | half);
+	}
+
+	// Maps a unit normal onto the [-1, 1] square of an octahedron unfolded over the xy plane
+	static glm::vec2 OctahedralEncode(glm::vec3 n)
+	{
+		float sum = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+		if (sum == 0.0f)
+			return glm::vec2(0.0f);
+		n /= sum;
+
+		glm::vec2 p(n.x, n.y);
+		if (n.z < 0.0f) {
+			// fold the lower hemisphere over the diagonals
+			p.x = (1.0f - std::fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+			p.y = (1.0f - std::fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+		}
+		return p;
+	}
+
+	static GLshort ToSnorm16(float value)
+	{
+		value = glm::clamp(value, -1.0f, 1.0f);
+		return static_cast<GLshort>(std::floor(value * 32767.0f + 0.5f));
+	}
+
+	const void* Mesh::setupVertices(const Vertex* vertexData, size_t vertexCount, std::vector<CompactVertex>& compact){
+		glm::vec3 minPosition(0.0f);
+		glm::vec3 maxPosition(0.0f);
+		if (vertexCount > 0) {
+			minPosition = maxPosition = vertexData[0].Position;
+		}
+		for (size_t i = 1; i < vertexCount; i++) {
+			minPosition = glm::min(minPosition, vertexData[i].Position);
+			maxPosition = glm::max(maxPosition, vertexData[i].Position);
+		}
+
+		// sphere around the box center, used to pick a detail level
+		this->boundsCenter = (minPosition + maxPosition) * 0.5f;
+		this->boundsRadius = 0.0f;
+		for (size_t i = 0; i < vertexCount; i++) {
+			this->boundsRadius = std::max(this->boundsRadius, glm::length(vertexData[i].Position - this->boundsCenter));
+		}
+
+		this->positionScale = glm::vec3(1.0f);
+		this->positionOffset = glm::vec3(0.0f);
+		if (this->format == VERTEX_FORMAT_COMPACT && !CanCompact(vertexData, vertexCount, maxPosition - minPosition))
+			this->format = VERTEX_FORMAT_FULL;
+
+		if (this->format == VERTEX_FORMAT_FULL)
+			return vertexData;
+
+		// positions are stored relative to the mesh bounds
+		glm::vec3 extent = maxPosition - minPosition;
+		this->positionOffset = minPosition;
+		this->positionScale = extent;
+
+		compact.resize(vertexCount);
+		for (size_t i = 0; i < vertexCount; i++) {
+			const Vertex& vertex = vertexData[i];
+			CompactVertex& packed = compact[i];
+			for (int k = 0; k < 3; k++) {
+				float t = extent[k] > 0.0f ? (vertex.Position[k] - minPosition[k]) / extent[k] : 0.0f;
+				packed.Position[k] = static_cast<GLushort>(std::floor(glm::clamp(t, 0.0f, 1.0f) * 65535.0f + 0.5f));
+			}
+			packed.Position[3] = 0;
+
+			glm::vec2 octahedral = OctahedralEncode(vertex.Normal);
+			packed.Normal[0] = ToSnorm16(octahedral.x);
+			packed.Normal[1] = ToSnorm16(octahedral.y);
+
+			packed.TexCoords[0] = FloatToHalf(vertex.TexCoords.x);
+			packed.TexCoords[1] = FloatToHalf(vertex.TexCoords.y);
+		}
+
+		return compact.data();
+	}
+
+	const void* Mesh::setupIndices(const GLuint* indexData, size_t indexCount, std::vector<GLushort>& indices16){
+		// indices are relative to each range's base vertex, so the ranges decide
+		bool shortIndices = true;
+		for (size_t s = 0; s < this->submeshes.size(); s++) {
+			if (this->submeshes[s].vertexCount > 65536)
+				shortIndices = false;
+		}
+
+		if (shortIndices) {
+			indices16.resize(indexCount);
+			for (size_t i = 0; i < indexCount; i++)
+				indices16[i] = static_cast<GLushort>(indexData[i]);
+			this->indexType = GL_UNSIGNED_SHORT;
+			return indices16.data();
+		}
+		this->indexType = GL_UNSIGNED_INT;
+		return indexData;
 	}
 }
@@ -6,6 +6,7 @@
 
 #include "Shader.hpp"
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -19,9 +20,35 @@ struct Vertex
     glm::vec2 TexCoords;
 };
 
+// Texture arrays go on the units from here on, the i-th texture of a range on
+// TEXTURE_ARRAY_UNIT_BASE + i, clear of the plain textures and the shadow map.
+// Samplers of different types may not share a unit.
+const GLuint TEXTURE_ARRAY_UNIT_BASE = 8;
+
+// Layout of a mesh's vertex buffer on the GPU
+enum VertexFormat
+{
+    // gps::Vertex as is, 32 bytes
+    VERTEX_FORMAT_FULL,
+    // gps::CompactVertex, 16 bytes
+    VERTEX_FORMAT_COMPACT
+};
+
+// Quantized vertex. Positions are normalized to the mesh bounds and decoded
+// in the vertex shader as positionOffset + Position * positionScale, normals
+// are octahedral-encoded and texture coordinates are half floats.
+struct CompactVertex
+{
+    GLushort Position[4];
+    GLshort Normal[2];
+    GLhalf TexCoords[2];
+};
+
 struct Texture
 {
     GLuint id;
+    // layer of a GL_TEXTURE_2D_ARRAY shared with other textures, or -1 for a plain GL_TEXTURE_2D
+    GLint layer;
     //ambientTexture, diffuseTexture, specularTexture
     std::string type;
     std::string path;
@@ -34,31 +61,199 @@ struct Material
         glm::vec3 specular;
     };
 
+// Detail levels per mesh, including the full-detail one
+const int MAX_LOD_LEVELS = 4;
+
+// Simplified copy of a range's (or a cluster's) triangles, stored further
+// along the same index buffer and indexing the same vertex slice
+struct LodRange
+{
+    GLuint firstIndex;
+    GLsizei indexCount;
+    // object-space error of the simplified surface
+    float error;
+};
+
+// Spatially compact run of a range's full-detail triangles (up to 128 vertices
+// and 128 triangles) with the bounds used to cull it
+struct Cluster
+{
+    GLuint firstIndex;
+    GLsizei indexCount;
+    glm::vec3 center;
+    float radius;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    // every triangle faces away from an eye inside the cone that opens from
+    // coneApex along -coneAxis; coneCutoff > 1 when the normals spread too far
+    glm::vec3 coneApex;
+    glm::vec3 coneAxis;
+    float coneCutoff;
+    // levels 1, 2, ... of this cluster alone, with its border kept in place so
+    // neighbours at other levels still meet; each level of the range holds
+    // these in cluster order
+    std::vector<LodRange> lods;
+};
+
+// View to cull clusters against, in the object space of the mesh
+struct ClusterCulling
+{
+    // inward-facing frustum planes, normalized
+    glm::vec4 planes[6];
+    glm::vec3 eye;
+    bool cullBackfaces;
+};
+
+// View to pick the detail level of each cluster from its own bounding sphere,
+// in the object space of the mesh
+struct ClusterLod
+{
+    glm::vec3 eye;
+    // a level is fine for a cluster whose sphere is at least its error times
+    // this far from the eye
+    float errorScale;
+};
+
+// Range of a mesh's index buffer drawn with one material. Indices are
+// relative to baseVertex, so each range addresses its own vertex slice.
+struct SubMesh
+{
+    GLuint firstIndex;
+    GLsizei indexCount;
+    GLint baseVertex;
+    GLsizei vertexCount;
+    std::vector<Texture> textures;
+    // texture coordinate units per object-space unit of surface, from the ratio
+    // of UV to surface area; 0 when unknown
+    float uvDensity;
+    // levels 1, 2, ...; a range may have fewer levels than its mesh
+    std::vector<LodRange> lods;
+    // partition of the full-detail triangles, in index buffer order
+    std::vector<Cluster> clusters;
+};
+
+// Geometry of one mesh before it is uploaded. The data either lives in the
+// vectors (freshly parsed) or in memory owned elsewhere (a mapped cache file).
+struct MeshData
+{
+    std::vector<Vertex> vertices;
+    std::vector<GLuint> indices;
+    const Vertex* mappedVertices;
+    const GLuint* mappedIndices;
+    size_t mappedVertexCount;
+    size_t mappedIndexCount;
+    // one range per material; texture ids are filled in at upload time
+    std::vector<SubMesh> submeshes;
+    // object-space error of each detail level, starting with 0 for full detail
+    std::vector<float> lodErrors;
+
+    MeshData() : mappedVertices(NULL), mappedIndices(NULL), mappedVertexCount(0), mappedIndexCount(0) {}
+
+    const Vertex* VertexData() const { return mappedVertices ? mappedVertices : vertices.data(); }
+    const GLuint* IndexData() const { return mappedIndices ? mappedIndices : indices.data(); }
+    size_t VertexCount() const { return mappedVertices ? mappedVertexCount : vertices.size(); }
+    size_t IndexCount() const { return mappedIndices ? mappedIndexCount : indices.size(); }
+};
+
+// Where a mesh lives in the GeometryPool: the vertex array shared by its
+// vertex format, its first vertex and the byte offset of its indices
 struct Buffers {
     GLuint VAO;
-    GLuint VBO;
-    GLuint EBO;
+    GLint baseVertex;
+    size_t vertexCount;
+    size_t indexOffset;
+    size_t indexBytes;
 };
 
+class InstanceBuffer;
+class RenderQueue;
+
 class Mesh
 {
 public:
     std::vector<Vertex> vertices;
     std::vector<GLuint> indices;
     std::vector<Texture> textures;
+    std::vector<SubMesh> submeshes;
 
+	// Single range drawn with `textures`
 	Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures);
 
+	// Uploads straight from caller-owned memory (e.g. a mapped cache file) without keeping a CPU copy.
+	// VERTEX_FORMAT_COMPACT falls back to full floats when the mesh can't be quantized well.
+	Mesh(const Vertex* vertexData, size_t vertexCount, const GLuint* indexData, size_t indexCount, std::vector<SubMesh> submeshes,
+		std::vector<float> lodErrors, VertexFormat format = VERTEX_FORMAT_FULL);
+
 	Buffers getBuffers();
 
+	// Hands the vertices and indices back to the geometry pool; the mesh can't be drawn afterwards
+	void Release();
+
 	void Draw(gps::Shader shader);
 
+	// Draws detail level `lod`, or the coarsest one a range has. At full detail,
+	// clusters rejected by `culling` (if any) are skipped. With `clusterLod`,
+	// ranges split into clusters pick a level per cluster instead.
+	void Draw(gps::Shader shader, int lod, const ClusterCulling* culling = NULL, const ClusterLod* clusterLod = NULL);
+
+	// Queues the ranges Draw would draw, with the model matrix `transform` of
+	// the queue, at `depth` in front of its view
+	void Enqueue(RenderQueue& queue, const gps::Shader& shader, uint32_t transform, float depth, int lod,
+		const ClusterCulling* culling = NULL, const ClusterLod* clusterLod = NULL);
+
+	// Draws detail level `lod` once per instance of `instances`, or queues it
+	void DrawInstanced(gps::Shader shader, const InstanceBuffer& instances, int lod);
+	void EnqueueInstanced(RenderQueue& queue, const gps::Shader& shader, const InstanceBuffer& instances, float depth, int lod);
+
+	// Object-space error of each detail level, starting with 0 for full detail
+	std::vector<float> lodErrors;
+
+	// Object-space bounding sphere of the vertices
+	glm::vec3 boundsCenter;
+	float boundsRadius;
+
 private:
     /*  Render data  */
     Buffers buffers;
+    VertexFormat format;
+    // GL_UNSIGNED_SHORT when every range addresses fewer than 65536 vertices
+    GLenum indexType;
+    // decode of compact positions
+    glm::vec3 positionScale;
+    glm::vec3 positionOffset;
+    // index runs of the visible clusters of a range, reused between draws
+    std::vector<GLsizei> drawCounts;
+    std::vector<GLvoid*> drawOffsets;
+    std::vector<GLint> drawBaseVertices;
 
 	// Initializes all the buffer objects/arrays
 	void setupMesh();
+	void setupMesh(const Vertex* vertexData, size_t vertexCount, const GLuint* indexData, size_t indexCount);
+
+	// Settles this->format and the bounds; returns the vertices laid out in that format, packed into `compact` if needed
+	const void* setupVertices(const Vertex* vertexData, size_t vertexCount, std::vector<CompactVertex>& compact);
+	// Settles this->indexType; returns the indices in that type, narrowed into `indices16` if needed
+	const void* setupIndices(const GLuint* indexData, size_t indexCount, std::vector<GLushort>& indices16);
+
+	// Shared by the plain and instanced Draw and Enqueue; `instances` is NULL for a single copy
+	void drawRanges(const gps::Shader& shader, int lod, const ClusterCulling* culling, const ClusterLod* clusterLod,
+		const InstanceBuffer* instances);
+	void enqueueRanges(RenderQueue& queue, const gps::Shader& shader, uint32_t transform, float depth, int lod,
+		const ClusterCulling* culling, const ClusterLod* clusterLod, const InstanceBuffer* instances);
+
+	// Decode uniforms and vertex array of this mesh
+	void bindVertexFormat(const gps::Shader& shader) const;
+	// Appends the index runs of `submesh` at `lod` (or at the level `clusterLod` picks
+	// for each cluster), leaving out clusters `culling` rejects
+	void collectRuns(const SubMesh& submesh, int lod, const ClusterCulling* culling, const ClusterLod* clusterLod,
+		std::vector<GLsizei>& counts, std::vector<GLvoid*>& offsets) const;
+	// Binds a range's textures unless `boundTextures` (the last range drawn, or NULL) has the same; true if it did
+	static bool bindTextures(const gps::Shader& shader, const std::vector<Texture>& textures, const std::vector<Texture>* boundTextures);
+	void drawRuns(const SubMesh& submesh, const GLsizei* counts, GLvoid* const* offsets, size_t runCount,
+		const InstanceBuffer* instances = NULL);
+
+	// submits queued ranges through the helpers above
+	friend class RenderQueue;
 
 };
 
@@ -0,0 +1,551 @@
+#include "MeshCache.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace gps {
+
+    static const char MESH_CACHE_MAGIC[4] = { 'G', 'P', 'S', 'M' };
+    static const uint32_t MESH_CACHE_VERSION = 9;
+
+    MappedFile::MappedFile()
+        : data(NULL), size(0), fileHandle(NULL), mappingHandle(NULL)
+    {
+    }
+
+    MappedFile::~MappedFile()
+    {
+        Close();
+    }
+
+    bool MappedFile::Open(const std::string& fileName)
+    {
+        Close();
+#ifdef _WIN32
+        HANDLE fh = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (fh == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(fh, &fileSize) || fileSize.QuadPart == 0) {
+            CloseHandle(fh);
+            return false;
+        }
+        HANDLE mh = CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mh == NULL) {
+            CloseHandle(fh);
+            return false;
+        }
+        void* view = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+        if (view == NULL) {
+            CloseHandle(mh);
+            CloseHandle(fh);
+            return false;
+        }
+        fileHandle = fh;
+        mappingHandle = mh;
+        data = static_cast<const unsigned char*>(view);
+        size = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int fd = open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        void* view = mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (view == MAP_FAILED) {
+            return false;
+        }
+        data = static_cast<const unsigned char*>(view);
+        size = static_cast<size_t>(st.st_size);
+#endif
+        return true;
+    }
+
+    void MappedFile::Close()
+    {
+        if (data == NULL) {
+            return;
+        }
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+        CloseHandle(static_cast<HANDLE>(mappingHandle));
+        CloseHandle(static_cast<HANDLE>(fileHandle));
+#else
+        munmap(const_cast<unsigned char*>(data), size);
+#endif
+        data = NULL;
+        size = 0;
+        fileHandle = NULL;
+        mappingHandle = NULL;
+    }
+
+    const unsigned char* MappedFile::Data() const
+    {
+        return data;
+    }
+
+    size_t MappedFile::Size() const
+    {
+        return size;
+    }
+
+    MeshCache::MeshCache()
+        : header(NULL)
+    {
+    }
+
+    bool MeshCache::GetSourceStamp(const std::string& sourceFileName, uint64_t* size, int64_t* mtime)
+    {
+#ifdef _WIN32
+        struct _stat64 st;
+        if (_stat64(sourceFileName.c_str(), &st) != 0) {
+            return false;
+        }
+#else
+        struct stat st;
+        if (stat(sourceFileName.c_str(), &st) != 0) {
+            return false;
+        }
+#endif
+        *size = static_cast<uint64_t>(st.st_size);
+        *mtime = static_cast<int64_t>(st.st_mtime);
+        return true;
+    }
+
+    void MeshCache::GetMaterialFileStamp(const std::string& fileName, uint64_t* size, int64_t* mtime)
+    {
+        // the cache also goes stale when a missing .mtl shows up
+        if (!GetSourceStamp(fileName, size, mtime)) {
+            *size = ~static_cast<uint64_t>(0);
+            *mtime = 0;
+        }
+    }
+
+    std::string MeshCache::CacheFileName(const std::string& sourceFileName)
+    {
+        return sourceFileName + ".meshcache";
+    }
+
+    // `count` entries of `entrySize` bytes at an aligned `offset` lie inside a file of `fileSize` bytes
+    static bool FitsInFile(uint64_t offset, uint64_t count, uint64_t entrySize, uint64_t fileSize)
+    {
+        return offset % 16 == 0 && offset <= fileSize && count <= (fileSize - offset) / entrySize;
+    }
+
+    // [first, first + count) lies inside [0, total)
+    static bool FitsInRange(uint64_t first, uint64_t count, uint64_t total)
+    {
+        return first <= total && count <= total - first;
+    }
+
+    bool MeshCache::ValidateTables() const
+    {
+        const MeshCacheHeader& h = *header;
+        uint64_t size = file.Size();
+        if (!FitsInFile(h.texturesOffset, h.textureCount, sizeof(MeshCacheTexture), size) ||
+            !FitsInFile(h.materialsOffset, h.materialCount, sizeof(MeshCacheMaterial), size) ||
+            !FitsInFile(h.meshesOffset, h.meshCount, sizeof(MeshCacheMesh), size) ||
+            !FitsInFile(h.rangesOffset, h.rangeCount, sizeof(MeshCacheRange), size) ||
+            !FitsInFile(h.clustersOffset, h.clusterCount, sizeof(MeshCacheCluster), size) ||
+            !FitsInFile(h.materialFilesOffset, h.materialFileCount, sizeof(MeshCacheMaterialFile), size) ||
+            !FitsInFile(h.stringsOffset, 0, 1, size) ||
+            !FitsInFile(h.verticesOffset, h.vertexCount, sizeof(Vertex), size) ||
+            !FitsInFile(h.indicesOffset, h.indexCount, sizeof(GLuint), size)) {
+            return false;
+        }
+
+        uint64_t stringsSize = size - h.stringsOffset;
+        const MeshCacheTexture* textures = reinterpret_cast<const MeshCacheTexture*>(file.Data() + h.texturesOffset);
+        for (uint32_t t = 0; t < h.textureCount; t++) {
+            if (!FitsInRange(textures[t].typeOffset, textures[t].typeLength, stringsSize) ||
+                !FitsInRange(textures[t].pathOffset, textures[t].pathLength, stringsSize)) {
+                return false;
+            }
+        }
+        const MeshCacheMaterialFile* materialFiles = reinterpret_cast<const MeshCacheMaterialFile*>(file.Data() + h.materialFilesOffset);
+        for (uint32_t f = 0; f < h.materialFileCount; f++) {
+            if (!FitsInRange(materialFiles[f].pathOffset, materialFiles[f].pathLength, stringsSize)) {
+                return false;
+            }
+        }
+        for (uint32_t m = 0; m < h.materialCount; m++) {
+            const MeshCacheMaterial& material = Material(m);
+            if (material.textureCount > 3) {
+                return false;
+            }
+            for (uint32_t t = 0; t < material.textureCount; t++) {
+                if (material.textures[t] >= h.textureCount) {
+                    return false;
+                }
+            }
+        }
+
+        // ranges and clusters are only reached through their mesh, and index into its slices
+        for (uint32_t m = 0; m < h.meshCount; m++) {
+            const MeshCacheMesh& mesh = Mesh(m);
+            if (!FitsInRange(mesh.firstVertex, mesh.vertexCount, h.vertexCount) ||
+                !FitsInRange(mesh.firstIndex, mesh.indexCount, h.indexCount) ||
+                !FitsInRange(mesh.firstRange, mesh.rangeCount, h.rangeCount)) {
+                return false;
+            }
+            for (uint32_t r = mesh.firstRange; r < mesh.firstRange + mesh.rangeCount; r++) {
+                const MeshCacheRange& range = Range(r);
+                if (range.material >= h.materialCount ||
+                    !FitsInRange(range.baseVertex, range.vertexCount, mesh.vertexCount) ||
+                    !FitsInRange(range.firstIndex, range.indexCount, mesh.indexCount) ||
+                    range.lodCount > MAX_LOD_LEVELS - 1 ||
+                    !FitsInRange(range.firstCluster, range.clusterCount, h.clusterCount)) {
+                    return false;
+                }
+                for (uint32_t l = 0; l < range.lodCount; l++) {
+                    if (!FitsInRange(range.lodFirstIndex[l], range.lodIndexCount[l], mesh.indexCount)) {
+                        return false;
+                    }
+                }
+                for (uint32_t c = range.firstCluster; c < range.firstCluster + range.clusterCount; c++) {
+                    const MeshCacheCluster& cluster = Cluster(c);
+                    if (!FitsInRange(cluster.firstIndex, cluster.indexCount, mesh.indexCount) ||
+                        cluster.lodCount > MAX_LOD_LEVELS - 1) {
+                        return false;
+                    }
+                    for (uint32_t l = 0; l < cluster.lodCount; l++) {
+                        if (!FitsInRange(cluster.lodFirstIndex[l], cluster.lodIndexCount[l], mesh.indexCount)) {
+                            return false;
+                        }
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    bool MeshCache::Open(const std::string& cacheFileName, const std::string& sourceFileName, uint32_t flags)
+    {
+        header = NULL;
+
+        uint64_t sourceSize;
+        int64_t sourceMtime;
+        if (!GetSourceStamp(sourceFileName, &sourceSize, &sourceMtime)) {
+            return false;
+        }
+
+        if (!file.Open(cacheFileName)) {
+            return false;
+        }
+
+        if (file.Size() < sizeof(MeshCacheHeader)) {
+            file.Close();
+            return false;
+        }
+
+        const MeshCacheHeader* h = reinterpret_cast<const MeshCacheHeader*>(file.Data());
+        bool valid = memcmp(h->magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC)) == 0 &&
+            h->version == MESH_CACHE_VERSION &&
+            h->sourceSize == sourceSize &&
+            h->sourceMtime == sourceMtime &&
+            h->flags == flags;
+        if (valid) {
+            header = h;
+            valid = ValidateTables();
+        }
+
+        // a changed .mtl changes the textures of the ranges
+        if (valid) {
+            const MeshCacheMaterialFile* materialFiles = reinterpret_cast<const MeshCacheMaterialFile*>(file.Data() + h->materialFilesOffset);
+            const char* strings = reinterpret_cast<const char*>(file.Data() + h->stringsOffset);
+            for (uint32_t f = 0; valid && f < h->materialFileCount; f++) {
+                uint64_t size;
+                int64_t mtime;
+                GetMaterialFileStamp(std::string(strings + materialFiles[f].pathOffset, materialFiles[f].pathLength), &size, &mtime);
+                valid = size == materialFiles[f].sourceSize && mtime == materialFiles[f].sourceMtime;
+            }
+        }
+
+        if (!valid) {
+            header = NULL;
+            file.Close();
+            return false;
+        }
+        return true;
+    }
+
+    const MeshCacheHeader& MeshCache::Header() const
+    {
+        return *header;
+    }
+
+    const MeshCacheMaterial& MeshCache::Material(uint32_t i) const
+    {
+        return reinterpret_cast<const MeshCacheMaterial*>(file.Data() + header->materialsOffset)[i];
+    }
+
+    const MeshCacheMesh& MeshCache::Mesh(uint32_t i) const
+    {
+        return reinterpret_cast<const MeshCacheMesh*>(file.Data() + header->meshesOffset)[i];
+    }
+
+    const MeshCacheRange& MeshCache::Range(uint32_t i) const
+    {
+        return reinterpret_cast<const MeshCacheRange*>(file.Data() + header->rangesOffset)[i];
+    }
+
+    const MeshCacheCluster& MeshCache::Cluster(uint32_t i) const
+    {
+        return reinterpret_cast<const MeshCacheCluster*>(file.Data() + header->clustersOffset)[i];
+    }
+
+    std::string MeshCache::TextureType(uint32_t i) const
+    {
+        const MeshCacheTexture& t = reinterpret_cast<const MeshCacheTexture*>(file.Data() + header->texturesOffset)[i];
+        const char* strings = reinterpret_cast<const char*>(file.Data() + header->stringsOffset);
+        return std::string(strings + t.typeOffset, t.typeLength);
+    }
+
+    std::string MeshCache::TexturePath(uint32_t i) const
+    {
+        const MeshCacheTexture& t = reinterpret_cast<const MeshCacheTexture*>(file.Data() + header->texturesOffset)[i];
+        const char* strings = reinterpret_cast<const char*>(file.Data() + header->stringsOffset);
+        return std::string(strings + t.pathOffset, t.pathLength);
+    }
+
+    const Vertex* MeshCache::Vertices() const
+    {
+        return reinterpret_cast<const Vertex*>(file.Data() + header->verticesOffset);
+    }
+
+    const GLuint* MeshCache::Indices() const
+    {
+        return reinterpret_cast<const GLuint*>(file.Data() + header->indicesOffset);
+    }
+
+    // rounds a byte offset up so the next section stays 16-byte aligned
+    static uint64_t AlignOffset(uint64_t offset)
+    {
+        return (offset + 15) & ~static_cast<uint64_t>(15);
+    }
+
+    static void WritePadding(std::ofstream& out, uint64_t from, uint64_t to)
+    {
+        static const char zeros[16] = { 0 };
+        out.write(zeros, static_cast<std::streamsize>(to - from));
+    }
+
+    bool MeshCache::Write(const std::string& cacheFileName, const std::string& sourceFileName, const std::vector<std::string>& materialFiles,
+        const std::vector<MeshData>& meshes, uint32_t flags)
+    {
+        MeshCacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC));
+        header.version = MESH_CACHE_VERSION;
+        header.flags = flags;
+        if (!GetSourceStamp(sourceFileName, &header.sourceSize, &header.sourceMtime)) {
+            return false;
+        }
+
+        // build the texture/material tables, sharing identical textures
+        std::vector<MeshCacheTexture> textures;
+        std::vector<MeshCacheMaterial> materials;
+        std::vector<MeshCacheMesh> meshTable;
+        std::vector<MeshCacheRange> ranges;
+        std::vector<MeshCacheCluster> clusters;
+        std::vector<MeshCacheMaterialFile> materialFileTable;
+        std::string strings;
+        std::map<std::string, uint32_t> textureIds;
+
+        for (size_t f = 0; f < materialFiles.size(); f++) {
+            MeshCacheMaterialFile entry;
+            entry.pathOffset = static_cast<uint32_t>(strings.size());
+            entry.pathLength = static_cast<uint32_t>(materialFiles[f].size());
+            strings += materialFiles[f];
+            GetMaterialFileStamp(materialFiles[f], &entry.sourceSize, &entry.sourceMtime);
+            materialFileTable.push_back(entry);
+        }
+
+        for (size_t m = 0; m < meshes.size(); m++) {
+            MeshCacheMesh mesh;
+            mesh.firstVertex = static_cast<uint32_t>(header.vertexCount);
+            mesh.vertexCount = static_cast<uint32_t>(meshes[m].VertexCount());
+            mesh.firstIndex = static_cast<uint32_t>(header.indexCount);
+            mesh.indexCount = static_cast<uint32_t>(meshes[m].IndexCount());
+            mesh.firstRange = static_cast<uint32_t>(ranges.size());
+            mesh.rangeCount = static_cast<uint32_t>(meshes[m].submeshes.size());
+            mesh.lodCount = static_cast<uint32_t>(std::min<size_t>(std::max<size_t>(meshes[m].lodErrors.size(), 1), MAX_LOD_LEVELS));
+            memset(mesh.lodErrors, 0, sizeof(mesh.lodErrors));
+            for (uint32_t l = 0; l < mesh.lodCount && l < meshes[m].lodErrors.size(); l++) {
+                mesh.lodErrors[l] = meshes[m].lodErrors[l];
+            }
+
+            for (size_t s = 0; s < meshes[m].submeshes.size(); s++) {
+                const SubMesh& submesh = meshes[m].submeshes[s];
+
+                MeshCacheMaterial material;
+                memset(&material, 0, sizeof(material));
+                for (size_t t = 0; t < submesh.textures.size() && t < 3; t++) {
+                    const Texture& texture = submesh.textures[t];
+                    std::string key = texture.type + "|" + texture.path;
+                    std::map<std::string, uint32_t>::iterator it = textureIds.find(key);
+                    if (it == textureIds.end()) {
+                        MeshCacheTexture entry;
+                        entry.typeOffset = static_cast<uint32_t>(strings.size());
+                        entry.typeLength = static_cast<uint32_t>(texture.type.size());
+                        strings += texture.type;
+                        entry.pathOffset = static_cast<uint32_t>(strings.size());
+                        entry.pathLength = static_cast<uint32_t>(texture.path.size());
+                        strings += texture.path;
+                        it = textureIds.insert(std::make_pair(key, static_cast<uint32_t>(textures.size()))).first;
+                        textures.push_back(entry);
+                    }
+                    material.textures[material.textureCount++] = it->second;
+                }
+
+                MeshCacheRange range;
+                range.firstIndex = submesh.firstIndex;
+                range.indexCount = static_cast<uint32_t>(submesh.indexCount);
+                range.baseVertex = static_cast<uint32_t>(submesh.baseVertex);
+                range.vertexCount = static_cast<uint32_t>(submesh.vertexCount);
+                range.material = static_cast<uint32_t>(materials.size());
+                memset(range.lodFirstIndex, 0, sizeof(range.lodFirstIndex));
+                memset(range.lodIndexCount, 0, sizeof(range.lodIndexCount));
+                memset(range.lodErrors, 0, sizeof(range.lodErrors));
+                range.lodCount = static_cast<uint32_t>(std::min<size_t>(submesh.lods.size(), MAX_LOD_LEVELS - 1));
+                for (uint32_t l = 0; l < range.lodCount; l++) {
+                    range.lodFirstIndex[l] = submesh.lods[l].firstIndex;
+                    range.lodIndexCount[l] = static_cast<uint32_t>(submesh.lods[l].indexCount);
+                    range.lodErrors[l] = submesh.lods[l].error;
+                }
+                range.firstCluster = static_cast<uint32_t>(clusters.size());
+                range.clusterCount = static_cast<uint32_t>(submesh.clusters.size());
+                for (size_t c = 0; c < submesh.clusters.size(); c++) {
+                    const gps::Cluster& cluster = submesh.clusters[c];
+                    MeshCacheCluster entry;
+                    memset(&entry, 0, sizeof(entry));
+                    entry.firstIndex = cluster.firstIndex;
+                    entry.indexCount = static_cast<uint32_t>(cluster.indexCount);
+                    memcpy(entry.center, &cluster.center, sizeof(entry.center));
+                    entry.radius = cluster.radius;
+                    memcpy(entry.boundsMin, &cluster.boundsMin, sizeof(entry.boundsMin));
+                    memcpy(entry.boundsMax, &cluster.boundsMax, sizeof(entry.boundsMax));
+                    memcpy(entry.coneApex, &cluster.coneApex, sizeof(entry.coneApex));
+                    memcpy(entry.coneAxis, &cluster.coneAxis, sizeof(entry.coneAxis));
+                    entry.coneCutoff = cluster.coneCutoff;
+                    entry.lodCount = static_cast<uint32_t>(std::min<size_t>(cluster.lods.size(), MAX_LOD_LEVELS - 1));
+                    for (uint32_t l = 0; l < entry.lodCount; l++) {
+                        entry.lodFirstIndex[l] = cluster.lods[l].firstIndex;
+                        entry.lodIndexCount[l] = static_cast<uint32_t>(cluster.lods[l].indexCount);
+                        entry.lodErrors[l] = cluster.lods[l].error;
+                    }
+                    clusters.push_back(entry);
+                }
+                materials.push_back(material);
+                ranges.push_back(range);
+            }
+
+            meshTable.push_back(mesh);
+            header.vertexCount += mesh.vertexCount;
+            header.indexCount += mesh.indexCount;
+        }
+
+        header.textureCount = static_cast<uint32_t>(textures.size());
+        header.materialCount = static_cast<uint32_t>(materials.size());
+        header.meshCount = static_cast<uint32_t>(meshTable.size());
+        header.rangeCount = static_cast<uint32_t>(ranges.size());
+        header.clusterCount = static_cast<uint32_t>(clusters.size());
+        header.materialFileCount = static_cast<uint32_t>(materialFileTable.size());
+
+        header.texturesOffset = AlignOffset(sizeof(MeshCacheHeader));
+        header.materialsOffset = AlignOffset(header.texturesOffset + textures.size() * sizeof(MeshCacheTexture));
+        header.meshesOffset = AlignOffset(header.materialsOffset + materials.size() * sizeof(MeshCacheMaterial));
+        header.rangesOffset = AlignOffset(header.meshesOffset + meshTable.size() * sizeof(MeshCacheMesh));
+        header.clustersOffset = AlignOffset(header.rangesOffset + ranges.size() * sizeof(MeshCacheRange));
+        header.materialFilesOffset = AlignOffset(header.clustersOffset + clusters.size() * sizeof(MeshCacheCluster));
+        header.stringsOffset = AlignOffset(header.materialFilesOffset + materialFileTable.size() * sizeof(MeshCacheMaterialFile));
+        header.verticesOffset = AlignOffset(header.stringsOffset + strings.size());
+        header.indicesOffset = AlignOffset(header.verticesOffset + header.vertexCount * sizeof(Vertex));
+
+        // write to a temporary file first so a crash never leaves a valid-looking partial cache
+        std::string tempFileName = cacheFileName + ".tmp";
+        std::ofstream out(tempFileName.c_str(), std::ios::binary | std::ios::trunc);
+        if (!out) {
+            return false;
+        }
+
+        uint64_t offset = 0;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        offset += sizeof(header);
+
+        WritePadding(out, offset, header.texturesOffset);
+        out.write(reinterpret_cast<const char*>(textures.data()), textures.size() * sizeof(MeshCacheTexture));
+        offset = header.texturesOffset + textures.size() * sizeof(MeshCacheTexture);
+
+        WritePadding(out, offset, header.materialsOffset);
+        out.write(reinterpret_cast<const char*>(materials.data()), materials.size() * sizeof(MeshCacheMaterial));
+        offset = header.materialsOffset + materials.size() * sizeof(MeshCacheMaterial);
+
+        WritePadding(out, offset, header.meshesOffset);
+        out.write(reinterpret_cast<const char*>(meshTable.data()), meshTable.size() * sizeof(MeshCacheMesh));
+        offset = header.meshesOffset + meshTable.size() * sizeof(MeshCacheMesh);
+
+        WritePadding(out, offset, header.rangesOffset);
+        out.write(reinterpret_cast<const char*>(ranges.data()), ranges.size() * sizeof(MeshCacheRange));
+        offset = header.rangesOffset + ranges.size() * sizeof(MeshCacheRange);
+
+        WritePadding(out, offset, header.clustersOffset);
+        out.write(reinterpret_cast<const char*>(clusters.data()), clusters.size() * sizeof(MeshCacheCluster));
+        offset = header.clustersOffset + clusters.size() * sizeof(MeshCacheCluster);
+
+        WritePadding(out, offset, header.materialFilesOffset);
+        out.write(reinterpret_cast<const char*>(materialFileTable.data()), materialFileTable.size() * sizeof(MeshCacheMaterialFile));
+        offset = header.materialFilesOffset + materialFileTable.size() * sizeof(MeshCacheMaterialFile);
+
+        WritePadding(out, offset, header.stringsOffset);
+        out.write(strings.data(), strings.size());
+        offset = header.stringsOffset + strings.size();
+
+        WritePadding(out, offset, header.verticesOffset);
+        for (size_t m = 0; m < meshes.size(); m++) {
+            out.write(reinterpret_cast<const char*>(meshes[m].VertexData()), meshes[m].VertexCount() * sizeof(Vertex));
+        }
+        offset = header.verticesOffset + header.vertexCount * sizeof(Vertex);
+
+        WritePadding(out, offset, header.indicesOffset);
+        for (size_t m = 0; m < meshes.size(); m++) {
+            out.write(reinterpret_cast<const char*>(meshes[m].IndexData()), meshes[m].IndexCount() * sizeof(GLuint));
+        }
+
+        out.close();
+        if (!out) {
+            remove(tempFileName.c_str());
+            return false;
+        }
+
+        remove(cacheFileName.c_str());
+        if (rename(tempFileName.c_str(), cacheFileName.c_str()) != 0) {
+            remove(tempFileName.c_str());
+            return false;
+        }
+        return true;
+    }
+}
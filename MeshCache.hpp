@@ -0,0 +1,196 @@
+#ifndef MeshCache_hpp
+#define MeshCache_hpp
+
+#include "Mesh.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    bool Open(const std::string& fileName);
+    void Close();
+
+    const unsigned char* Data() const;
+    size_t Size() const;
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    const unsigned char* data;
+    size_t size;
+    // platform handles (file and mapping object on Windows, descriptor elsewhere)
+    void* fileHandle;
+    void* mappingHandle;
+};
+
+// MeshCacheHeader::flags - how the cached data was processed after parsing
+enum MeshCacheFlags
+{
+    MESH_CACHE_OPTIMIZED = 1,
+    MESH_CACHE_LODS = 2,
+    MESH_CACHE_CLUSTERS = 4
+};
+
+// On-disk layout: header, texture table, material table, mesh table, ranges,
+// cluster table, material file table, string blob, vertex blob, index blob. All
+// offsets are in bytes from the start of the file.
+struct MeshCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    // stamp of the .obj the cache was built from
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+
+    uint32_t textureCount;
+    uint32_t materialCount;
+    uint32_t meshCount;
+    uint32_t rangeCount;
+    uint32_t flags;
+    uint32_t clusterCount;
+    uint32_t materialFileCount;
+    uint32_t reserved;
+
+    uint64_t texturesOffset;
+    uint64_t materialsOffset;
+    uint64_t meshesOffset;
+    uint64_t rangesOffset;
+    uint64_t clustersOffset;
+    uint64_t materialFilesOffset;
+    uint64_t stringsOffset;
+    uint64_t verticesOffset;
+    uint64_t vertexCount;
+    uint64_t indicesOffset;
+    uint64_t indexCount;
+};
+
+// type and path of a texture, as offsets into the string blob
+struct MeshCacheTexture
+{
+    uint32_t typeOffset;
+    uint32_t typeLength;
+    uint32_t pathOffset;
+    uint32_t pathLength;
+};
+
+// a .mtl file the .obj names, as an offset into the string blob, stamped
+// like the .obj; sourceSize is ~0 when the file was missing
+struct MeshCacheMaterialFile
+{
+    uint32_t pathOffset;
+    uint32_t pathLength;
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+};
+
+// up to three textures (ambient, diffuse, specular) bound together
+struct MeshCacheMaterial
+{
+    uint32_t textureCount;
+    uint32_t textures[3];
+};
+
+// one mesh: its slice of the vertex and index blobs and of the range table
+struct MeshCacheMesh
+{
+    uint32_t firstVertex;
+    uint32_t vertexCount;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t firstRange;
+    uint32_t rangeCount;
+    // detail levels, including the full one, and their object-space errors
+    uint32_t lodCount;
+    float lodErrors[MAX_LOD_LEVELS];
+};
+
+// one submesh: an index range of its mesh drawn with one material,
+// with indices and vertices relative to the mesh, followed by the index
+// ranges of its simplified levels
+struct MeshCacheRange
+{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t baseVertex;
+    uint32_t vertexCount;
+    uint32_t material;
+    uint32_t lodCount;
+    uint32_t lodFirstIndex[MAX_LOD_LEVELS - 1];
+    uint32_t lodIndexCount[MAX_LOD_LEVELS - 1];
+    float lodErrors[MAX_LOD_LEVELS - 1];
+    uint32_t firstCluster;
+    uint32_t clusterCount;
+};
+
+// one cluster of a range, with firstIndex relative to the mesh, followed
+// by the index ranges of its own simplified levels
+struct MeshCacheCluster
+{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float center[3];
+    float radius;
+    float boundsMin[3];
+    float boundsMax[3];
+    float coneApex[3];
+    float coneAxis[3];
+    float coneCutoff;
+    uint32_t lodCount;
+    uint32_t lodFirstIndex[MAX_LOD_LEVELS - 1];
+    uint32_t lodIndexCount[MAX_LOD_LEVELS - 1];
+    float lodErrors[MAX_LOD_LEVELS - 1];
+    uint32_t reserved;
+};
+
+class MeshCache
+{
+public:
+    MeshCache();
+
+    // Maps the cache file and validates it against the current source and .mtl
+    // files and flags, and every table and reference in it against its size
+    bool Open(const std::string& cacheFileName, const std::string& sourceFileName, uint32_t flags = 0);
+
+    const MeshCacheHeader& Header() const;
+    const MeshCacheMaterial& Material(uint32_t i) const;
+    const MeshCacheMesh& Mesh(uint32_t i) const;
+    const MeshCacheRange& Range(uint32_t i) const;
+    const MeshCacheCluster& Cluster(uint32_t i) const;
+    std::string TextureType(uint32_t i) const;
+    std::string TexturePath(uint32_t i) const;
+
+    // Pointers straight into the mapped pages
+    const Vertex* Vertices() const;
+    const GLuint* Indices() const;
+
+    // Serializes the meshes of a freshly parsed model
+    static bool Write(const std::string& cacheFileName, const std::string& sourceFileName, const std::vector<std::string>& materialFiles,
+        const std::vector<MeshData>& meshes, uint32_t flags = 0);
+
+    // Cache file that belongs to a given .obj
+    static std::string CacheFileName(const std::string& sourceFileName);
+
+private:
+    MappedFile file;
+    const MeshCacheHeader* header;
+
+    static bool GetSourceStamp(const std::string& sourceFileName, uint64_t* size, int64_t* mtime);
+    // Like GetSourceStamp, but a missing file stamps as size ~0 instead of failing
+    static void GetMaterialFileStamp(const std::string& fileName, uint64_t* size, int64_t* mtime);
+
+    bool ValidateTables() const;
+};
+
+}
+
+#endif /* MeshCache_hpp */
@@ -0,0 +1,398 @@
+#include "MeshClusters.hpp"
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace gps {
+
+    // Below this size a cluster may continue with an unconnected triangle
+    static const size_t MIN_CLUSTER_TRIANGLES = 32;
+    // Normals spread wider than this (cosine to the average) make the cone useless
+    static const float MIN_CONE_COSINE = 0.0f;
+    // How much a fully turned normal weighs against one new vertex when growing a cluster
+    static const float CONE_WEIGHT = 1.0f;
+    // coneCutoff of clusters that are never backface culled
+    static const float NO_CONE_CUTOFF = 2.0f;
+
+    struct PositionHash
+    {
+        size_t operator()(const glm::vec3& p) const
+        {
+            GLuint bits[3];
+            memcpy(bits, &p, sizeof(bits));
+            return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+        }
+    };
+
+    static glm::vec3 TriangleCentroid(const GLuint* triangle, const Vertex* vertices)
+    {
+        return (vertices[triangle[0]].Position + vertices[triangle[1]].Position + vertices[triangle[2]].Position) / 3.0f;
+    }
+
+    // Bounding sphere, box and normal cone of a run of triangles
+    static Cluster ClusterBounds(const GLuint* indices, size_t indexCount, const Vertex* vertices)
+    {
+        Cluster cluster;
+        cluster.indexCount = static_cast<GLsizei>(indexCount);
+
+        cluster.boundsMin = cluster.boundsMax = vertices[indices[0]].Position;
+        for (size_t i = 1; i < indexCount; i++) {
+            cluster.boundsMin = glm::min(cluster.boundsMin, vertices[indices[i]].Position);
+            cluster.boundsMax = glm::max(cluster.boundsMax, vertices[indices[i]].Position);
+        }
+        cluster.center = (cluster.boundsMin + cluster.boundsMax) * 0.5f;
+        cluster.radius = 0.0f;
+        for (size_t i = 0; i < indexCount; i++) {
+            cluster.radius = std::max(cluster.radius, glm::length(vertices[indices[i]].Position - cluster.center));
+        }
+
+        // the cone axis is the average face normal
+        std::vector<glm::vec3> normals;
+        normals.reserve(indexCount / 3);
+        glm::vec3 axis(0.0f);
+        for (size_t i = 0; i + 2 < indexCount; i += 3) {
+            glm::vec3 p0 = vertices[indices[i + 0]].Position;
+            glm::vec3 n = glm::cross(vertices[indices[i + 1]].Position - p0, vertices[indices[i + 2]].Position - p0);
+            float area = glm::length(n);
+            if (area == 0.0f) {
+                continue;
+            }
+            normals.push_back(n / area);
+            axis += n / area;
+        }
+
+        cluster.coneApex = cluster.center;
+        cluster.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+        cluster.coneCutoff = NO_CONE_CUTOFF;
+        float axisLength = glm::length(axis);
+        if (normals.empty() || axisLength == 0.0f) {
+            return cluster;
+        }
+        axis /= axisLength;
+
+        float minCosine = 1.0f;
+        for (size_t t = 0; t < normals.size(); t++) {
+            minCosine = std::min(minCosine, glm::dot(normals[t], axis));
+        }
+        if (minCosine <= MIN_CONE_COSINE) {
+            return cluster;
+        }
+
+        // move the apex back along the axis until it is behind every triangle's plane
+        float apexOffset = 0.0f;
+        bool first = true;
+        size_t t = 0;
+        for (size_t i = 0; i + 2 < indexCount; i += 3) {
+            glm::vec3 p0 = vertices[indices[i + 0]].Position;
+            glm::vec3 n = glm::cross(vertices[indices[i + 1]].Position - p0, vertices[indices[i + 2]].Position - p0);
+            if (glm::length(n) == 0.0f) {
+                continue;
+            }
+            float offset = glm::dot(normals[t], p0 - cluster.center) / glm::dot(normals[t], axis);
+            apexOffset = first ? offset : std::min(apexOffset, offset);
+            first = false;
+            t++;
+        }
+
+        cluster.coneApex = cluster.center + axis * apexOffset;
+        cluster.coneAxis = axis;
+        // sine of the spread: views within 90 degrees minus the spread see only backs
+        cluster.coneCutoff = std::sqrt(1.0f - minCosine * minCosine);
+        return cluster;
+    }
+
+    std::vector<Cluster> BuildClusters(GLuint* indices, size_t indexCount, const Vertex* vertices, size_t vertexCount)
+    {
+        std::vector<Cluster> clusters;
+        size_t triangleCount = indexCount / 3;
+        if (triangleCount == 0) {
+            return clusters;
+        }
+
+        // triangles are connected through shared positions, so hard edges and
+        // UV seams don't split a surface into separate pieces
+        std::vector<GLuint> positionOf(vertexCount);
+        size_t positionCount = 0;
+        {
+            std::unordered_map<glm::vec3, GLuint, PositionHash> ids;
+            for (size_t v = 0; v < vertexCount; v++) {
+                std::pair<std::unordered_map<glm::vec3, GLuint, PositionHash>::iterator, bool> inserted =
+                    ids.insert(std::make_pair(vertices[v].Position, static_cast<GLuint>(positionCount)));
+                positionOf[v] = inserted.first->second;
+                positionCount += inserted.second;
+            }
+        }
+
+        // triangles around every position
+        std::vector<GLuint> offsets(positionCount + 1, 0);
+        for (size_t i = 0; i < triangleCount * 3; i++) {
+            offsets[positionOf[indices[i]] + 1]++;
+        }
+        for (size_t p = 0; p < positionCount; p++) {
+            offsets[p + 1] += offsets[p];
+        }
+        std::vector<GLuint> adjacency(triangleCount * 3);
+        {
+            std::vector<GLuint> fill(offsets.begin(), offsets.end() - 1);
+            for (size_t i = 0; i < triangleCount * 3; i++) {
+                adjacency[fill[positionOf[indices[i]]]++] = static_cast<GLuint>(i / 3);
+            }
+        }
+
+        std::vector<glm::vec3> triangleNormals(triangleCount, glm::vec3(0.0f));
+        for (size_t t = 0; t < triangleCount; t++) {
+            glm::vec3 p0 = vertices[indices[t * 3 + 0]].Position;
+            glm::vec3 n = glm::cross(vertices[indices[t * 3 + 1]].Position - p0, vertices[indices[t * 3 + 2]].Position - p0);
+            float area = glm::length(n);
+            if (area > 0.0f) {
+                triangleNormals[t] = n / area;
+            }
+        }
+
+        std::vector<GLuint> result;
+        result.reserve(triangleCount * 3);
+        std::vector<char> emitted(triangleCount, 0);
+        // cluster number + 1 of the cluster a vertex or position was last added to
+        std::vector<GLuint> vertexCluster(vertexCount, 0);
+        std::vector<GLuint> positionCluster(positionCount, 0);
+        std::vector<GLuint> candidates;
+        size_t cursor = 0;
+
+        while (result.size() < triangleCount * 3) {
+            GLuint clusterId = static_cast<GLuint>(clusters.size() + 1);
+            size_t firstIndex = result.size();
+            size_t clusterVertices = 0;
+            size_t clusterTriangles = 0;
+            glm::vec3 centroidSum(0.0f);
+            glm::vec3 normalSum(0.0f);
+            candidates.clear();
+
+            while (emitted[cursor]) {
+                cursor++;
+            }
+            GLuint next = static_cast<GLuint>(cursor);
+
+            while (next != ~0u) {
+                const GLuint* triangle = indices + next * 3;
+                emitted[next] = 1;
+                for (int k = 0; k < 3; k++) {
+                    GLuint v = triangle[k];
+                    result.push_back(v);
+                    if (vertexCluster[v] != clusterId) {
+                        vertexCluster[v] = clusterId;
+                        clusterVertices++;
+                    }
+                    GLuint p = positionOf[v];
+                    if (positionCluster[p] != clusterId) {
+                        positionCluster[p] = clusterId;
+                        candidates.insert(candidates.end(), adjacency.begin() + offsets[p], adjacency.begin() + offsets[p + 1]);
+                    }
+                }
+                centroidSum += TriangleCentroid(triangle, vertices);
+                normalSum += triangleNormals[next];
+                clusterTriangles++;
+                if (clusterTriangles == MAX_CLUSTER_TRIANGLES) {
+                    break;
+                }
+
+                // the connected triangle adding the fewest vertices and bending the
+                // normals least (so the cone stays narrow), then the closest one
+                glm::vec3 centroid = centroidSum / static_cast<float>(clusterTriangles);
+                float normalLength = glm::length(normalSum);
+                glm::vec3 clusterNormal = normalLength > 0.0f ? normalSum / normalLength : glm::vec3(0.0f);
+                next = ~0u;
+                float bestScore = 0.0f;
+                float bestDistance = 0.0f;
+                size_t live = 0;
+                for (size_t c = 0; c < candidates.size(); c++) {
+                    GLuint t = candidates[c];
+                    if (emitted[t]) {
+                        continue;
+                    }
+                    candidates[live++] = t;
+
+                    size_t newVertices = 0;
+                    for (int k = 0; k < 3; k++) {
+                        newVertices += vertexCluster[indices[t * 3 + k]] != clusterId;
+                    }
+                    if (clusterVertices + newVertices > MAX_CLUSTER_VERTICES) {
+                        continue;
+                    }
+                    float score = newVertices + CONE_WEIGHT * (1.0f - glm::dot(triangleNormals[t], clusterNormal));
+                    glm::vec3 offset = TriangleCentroid(indices + t * 3, vertices) - centroid;
+                    float distance = glm::dot(offset, offset);
+                    if (next == ~0u || score < bestScore || (score == bestScore && distance < bestDistance)) {
+                        next = t;
+                        bestScore = score;
+                        bestDistance = distance;
+                    }
+                }
+                candidates.resize(live);
+
+                // small disconnected pieces (leaves, blades of grass) share clusters in index order
+                if (next == ~0u && clusterTriangles < MIN_CLUSTER_TRIANGLES && clusterVertices + 3 <= MAX_CLUSTER_VERTICES) {
+                    while (cursor < triangleCount && emitted[cursor]) {
+                        cursor++;
+                    }
+                    if (cursor < triangleCount) {
+                        next = static_cast<GLuint>(cursor);
+                    }
+                }
+            }
+
+            Cluster cluster = ClusterBounds(result.data() + firstIndex, result.size() - firstIndex, vertices);
+            cluster.firstIndex = static_cast<GLuint>(firstIndex);
+            clusters.push_back(cluster);
+        }
+
+        std::copy(result.begin(), result.end(), indices);
+        return clusters;
+    }
+
+    // Vertex cache then overdraw order for the triangles of one cluster, on its
+    // vertices numbered locally so the cost does not grow with the whole range
+    static void OptimizeClusterRun(GLuint* indices, size_t indexCount, const Vertex* vertices)
+    {
+        std::unordered_map<GLuint, GLuint> localOf;
+        std::vector<Vertex> localVertices;
+        std::vector<GLuint> globalOf;
+        std::vector<GLuint> local(indexCount);
+        for (size_t i = 0; i < indexCount; i++) {
+            std::pair<std::unordered_map<GLuint, GLuint>::iterator, bool> inserted =
+                localOf.insert(std::make_pair(indices[i], static_cast<GLuint>(globalOf.size())));
+            if (inserted.second) {
+                globalOf.push_back(indices[i]);
+                localVertices.push_back(vertices[indices[i]]);
+            }
+            local[i] = inserted.first->second;
+        }
+
+        std::vector<GLuint> reordered(indexCount);
+        OptimizeVertexCache(reordered.data(), local.data(), indexCount, globalOf.size());
+        OptimizeOverdraw(local.data(), reordered.data(), indexCount, localVertices.data(), globalOf.size());
+        for (size_t i = 0; i < indexCount; i++) {
+            indices[i] = globalOf[local[i]];
+        }
+    }
+
+    void BuildMeshClusters(MeshData* mesh, bool optimizeRuns)
+    {
+        for (size_t s = 0; s < mesh->submeshes.size(); s++) {
+            SubMesh& submesh = mesh->submeshes[s];
+            const Vertex* vertices = mesh->vertices.data() + submesh.baseVertex;
+            submesh.clusters = BuildClusters(mesh->indices.data() + submesh.firstIndex, submesh.indexCount,
+                vertices, submesh.vertexCount);
+            for (size_t c = 0; c < submesh.clusters.size(); c++) {
+                Cluster& cluster = submesh.clusters[c];
+                cluster.firstIndex += submesh.firstIndex;
+                // same triangles, so the bounds and cone still hold
+                if (optimizeRuns) {
+                    OptimizeClusterRun(mesh->indices.data() + cluster.firstIndex, cluster.indexCount, vertices);
+                }
+            }
+        }
+    }
+
+    ClusterCulling MakeClusterCulling(const glm::mat4& viewProjection, const glm::vec3& eye,
+        const glm::mat4& modelMatrix, bool cullBackfaces)
+    {
+        ClusterCulling culling;
+
+        // planes of the clip volume pulled back into object space (Gribb/Hartmann)
+        glm::mat4 m = viewProjection * modelMatrix;
+        glm::vec4 rows[4];
+        for (int r = 0; r < 4; r++) {
+            rows[r] = glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+        }
+        for (int axis = 0; axis < 3; axis++) {
+            culling.planes[axis * 2 + 0] = rows[3] + rows[axis];
+            culling.planes[axis * 2 + 1] = rows[3] - rows[axis];
+        }
+        for (int p = 0; p < 6; p++) {
+            float length = glm::length(glm::vec3(culling.planes[p]));
+            if (length > 0.0f) {
+                culling.planes[p] = culling.planes[p] * (1.0f / length);
+            }
+        }
+
+        culling.eye = glm::vec3(glm::inverse(modelMatrix) * glm::vec4(eye, 1.0f));
+        culling.cullBackfaces = cullBackfaces;
+        return culling;
+    }
+
+    bool IsSphereVisible(const glm::vec3& center, float radius, const ClusterCulling& culling)
+    {
+        for (int p = 0; p < 6; p++) {
+            const glm::vec4& plane = culling.planes[p];
+            if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    ClusterLod MakeClusterLod(const glm::vec3& eye, const glm::mat4& modelMatrix, float projectionScale, float pixelError)
+    {
+        ClusterLod lod;
+        lod.eye = glm::vec3(glm::inverse(modelMatrix) * glm::vec4(eye, 1.0f));
+
+        // errors grow with the largest axis scale and distances at least with the smallest
+        float scales[3];
+        for (int axis = 0; axis < 3; axis++) {
+            scales[axis] = glm::length(glm::vec3(modelMatrix[axis]));
+        }
+        float maxScale = std::max(scales[0], std::max(scales[1], scales[2]));
+        float minScale = std::min(scales[0], std::min(scales[1], scales[2]));
+        lod.errorScale = minScale > 0.0f ? projectionScale / pixelError * maxScale / minScale : 0.0f;
+        return lod;
+    }
+
+    int SelectClusterLod(const Cluster& cluster, const ClusterLod& lod)
+    {
+        // inside the sphere, keep full detail
+        float distance = glm::length(cluster.center - lod.eye) - cluster.radius;
+        if (distance <= 0.0f) {
+            return 0;
+        }
+
+        int level = 0;
+        for (size_t l = 0; l < cluster.lods.size(); l++) {
+            if (cluster.lods[l].error * lod.errorScale > distance) {
+                break;
+            }
+            level = static_cast<int>(l + 1);
+        }
+        return level;
+    }
+
+    bool IsClusterVisible(const Cluster& cluster, const ClusterCulling& culling)
+    {
+        if (!IsSphereVisible(cluster.center, cluster.radius, culling)) {
+            return false;
+        }
+
+        // the box corner furthest along each plane's normal
+        for (int p = 0; p < 6; p++) {
+            const glm::vec4& plane = culling.planes[p];
+            glm::vec3 corner(plane.x >= 0.0f ? cluster.boundsMax.x : cluster.boundsMin.x,
+                plane.y >= 0.0f ? cluster.boundsMax.y : cluster.boundsMin.y,
+                plane.z >= 0.0f ? cluster.boundsMax.z : cluster.boundsMin.z);
+            if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) {
+                return false;
+            }
+        }
+
+        if (culling.cullBackfaces && cluster.coneCutoff <= 1.0f) {
+            glm::vec3 view = cluster.coneApex - culling.eye;
+            float distance = glm::length(view);
+            if (distance > 0.0f && glm::dot(view, cluster.coneAxis) >= cluster.coneCutoff * distance) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+}
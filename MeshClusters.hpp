@@ -0,0 +1,46 @@
+#ifndef MeshClusters_hpp
+#define MeshClusters_hpp
+
+#include "Mesh.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+    // Largest cluster. The vertex limit only keeps clusters compact on meshes
+    // with many split vertices (hard edges, UV seams).
+    const size_t MAX_CLUSTER_VERTICES = 128;
+    const size_t MAX_CLUSTER_TRIANGLES = 128;
+
+    // Reorders the triangles of an index list into clusters grown over shared
+    // vertices and returns them with their bounds; `firstIndex` of each cluster
+    // is relative to the start of `indices`, which is rewritten in place.
+    std::vector<Cluster> BuildClusters(GLuint* indices, size_t indexCount, const Vertex* vertices, size_t vertexCount);
+
+    // Clusters the full-detail triangles of every range of a freshly parsed mesh.
+    // Growing clusters undoes the vertex cache and overdraw order of the ranges,
+    // so with `optimizeRuns` that order is rebuilt inside each cluster.
+    void BuildMeshClusters(MeshData* mesh, bool optimizeRuns);
+
+    // Culling view for a mesh drawn with `modelMatrix`, from the view-projection
+    // and eye of the camera in world space
+    ClusterCulling MakeClusterCulling(const glm::mat4& viewProjection, const glm::vec3& eye,
+        const glm::mat4& modelMatrix, bool cullBackfaces);
+
+    // Frustum test of the bounding sphere and box, then the backface cone test
+    bool IsClusterVisible(const Cluster& cluster, const ClusterCulling& culling);
+
+    // Frustum test of a bounding sphere alone
+    bool IsSphereVisible(const glm::vec3& center, float radius, const ClusterCulling& culling);
+
+    // Level selection for a mesh drawn with `modelMatrix`, allowing `pixelError`
+    // pixels of error where one unit at distance 1 covers `projectionScale` pixels
+    ClusterLod MakeClusterLod(const glm::vec3& eye, const glm::mat4& modelMatrix, float projectionScale, float pixelError);
+
+    // Coarsest level of the cluster within the allowed error; 0 for full detail
+    int SelectClusterLod(const Cluster& cluster, const ClusterLod& lod);
+
+}
+
+#endif /* MeshClusters_hpp */
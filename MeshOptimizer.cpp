@@ -0,0 +1,421 @@
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    // Cache simulated by the Forsyth optimizer, and its scoring constants
+    static const int FORSYTH_CACHE_SIZE = 32;
+    static const float FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+    static const float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+    static const float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+    static const float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+    // FIFO post-transform cache: a vertex is cached if it was transformed
+    // fewer than `size` misses ago
+    struct FifoCache
+    {
+        std::vector<unsigned int> timestamps;
+        unsigned int time;
+        unsigned int size;
+
+        FifoCache(size_t vertexCount, unsigned int cacheSize)
+            : timestamps(vertexCount, 0), time(cacheSize + 1), size(cacheSize) {}
+
+        // returns 1 on a miss
+        unsigned int Access(GLuint v)
+        {
+            if (time - timestamps[v] > size) {
+                timestamps[v] = time++;
+                return 1;
+            }
+            return 0;
+        }
+
+        void Flush()
+        {
+            time += size + 1;
+        }
+    };
+
+    VertexCacheStats AnalyzeVertexCache(const GLuint* indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize)
+    {
+        VertexCacheStats stats;
+        stats.acmr = 0.0f;
+        stats.atvr = 0.0f;
+        if (indexCount < 3 || vertexCount == 0) {
+            return stats;
+        }
+
+        FifoCache cache(vertexCount, cacheSize);
+        size_t misses = 0;
+        for (size_t i = 0; i < indexCount; i++) {
+            misses += cache.Access(indices[i]);
+        }
+
+        stats.acmr = static_cast<float>(misses) / static_cast<float>(indexCount / 3);
+        stats.atvr = static_cast<float>(misses) / static_cast<float>(vertexCount);
+        return stats;
+    }
+
+    static float ForsythVertexScore(int cachePosition, unsigned int liveTriangles)
+    {
+        // no triangles left, never pick this vertex again
+        if (liveTriangles == 0) {
+            return -1.0f;
+        }
+
+        float score = 0.0f;
+        if (cachePosition >= 0) {
+            if (cachePosition < 3) {
+                // the last triangle's vertices get a fixed score so it isn't simply repeated
+                score = FORSYTH_LAST_TRIANGLE_SCORE;
+            } else {
+                float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+                score = powf(1.0f - (cachePosition - 3) * scaler, FORSYTH_CACHE_DECAY_POWER);
+            }
+        }
+
+        // boost vertices with few triangles left, so lone triangles get finished
+        score += FORSYTH_VALENCE_BOOST_SCALE * powf(static_cast<float>(liveTriangles), -FORSYTH_VALENCE_BOOST_POWER);
+        return score;
+    }
+
+    void OptimizeVertexCache(GLuint* destination, const GLuint* indices, size_t indexCount, size_t vertexCount)
+    {
+        size_t triangleCount = indexCount / 3;
+        if (triangleCount == 0) {
+            return;
+        }
+
+        // triangles of every vertex, as one flat array
+        std::vector<unsigned int> liveTriangles(vertexCount, 0);
+        for (size_t i = 0; i < triangleCount * 3; i++) {
+            liveTriangles[indices[i]]++;
+        }
+        std::vector<size_t> adjacencyOffsets(vertexCount + 1, 0);
+        for (size_t v = 0; v < vertexCount; v++) {
+            adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+        }
+        std::vector<unsigned int> adjacency(triangleCount * 3);
+        std::vector<size_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (size_t t = 0; t < triangleCount; t++) {
+            for (int k = 0; k < 3; k++) {
+                adjacency[fill[indices[t * 3 + k]]++] = static_cast<unsigned int>(t);
+            }
+        }
+
+        std::vector<float> vertexScores(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++) {
+            vertexScores[v] = ForsythVertexScore(-1, liveTriangles[v]);
+        }
+
+        std::vector<float> triangleScores(triangleCount);
+        std::vector<char> emitted(triangleCount, 0);
+        for (size_t t = 0; t < triangleCount; t++) {
+            triangleScores[t] = vertexScores[indices[t * 3 + 0]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+        }
+
+        GLuint cache[FORSYTH_CACHE_SIZE + 3];
+        GLuint newCache[FORSYTH_CACHE_SIZE + 3];
+        int cacheCount = 0;
+
+        size_t best = 0;
+        for (size_t t = 1; t < triangleCount; t++) {
+            if (triangleScores[t] > triangleScores[best]) {
+                best = t;
+            }
+        }
+
+        // next triangle in input order, used when the cache holds no candidates
+        size_t inputCursor = 0;
+
+        for (size_t output = 0; output < triangleCount; output++) {
+            if (best == triangleCount) {
+                while (emitted[inputCursor]) {
+                    inputCursor++;
+                }
+                best = inputCursor;
+            }
+
+            const GLuint* triangle = indices + best * 3;
+            destination[output * 3 + 0] = triangle[0];
+            destination[output * 3 + 1] = triangle[1];
+            destination[output * 3 + 2] = triangle[2];
+            emitted[best] = 1;
+
+            // the emitted triangle goes to the front of the cache, the rest shifts back
+            int newCount = 0;
+            for (int k = 0; k < 3; k++) {
+                GLuint v = triangle[k];
+
+                // unlink the triangle from its vertices
+                unsigned int* list = &adjacency[adjacencyOffsets[v]];
+                for (unsigned int i = 0; i < liveTriangles[v]; i++) {
+                    if (list[i] == best) {
+                        list[i] = list[liveTriangles[v] - 1];
+                        break;
+                    }
+                }
+                liveTriangles[v]--;
+
+                if (std::find(newCache, newCache + newCount, v) == newCache + newCount) {
+                    newCache[newCount++] = v;
+                }
+            }
+            for (int i = 0; i < cacheCount; i++) {
+                GLuint v = cache[i];
+                if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+                    newCache[newCount++] = v;
+                }
+            }
+
+            // rescore every vertex that moved or fell out, and their triangles
+            for (int i = 0; i < newCount; i++) {
+                GLuint v = newCache[i];
+                int position = i < FORSYTH_CACHE_SIZE ? i : -1;
+
+                float score = ForsythVertexScore(position, liveTriangles[v]);
+                float delta = score - vertexScores[v];
+                vertexScores[v] = score;
+
+                const unsigned int* list = &adjacency[adjacencyOffsets[v]];
+                for (unsigned int j = 0; j < liveTriangles[v]; j++) {
+                    triangleScores[list[j]] += delta;
+                }
+            }
+
+            cacheCount = std::min(newCount, FORSYTH_CACHE_SIZE);
+            std::copy(newCache, newCache + cacheCount, cache);
+
+            // the next triangle is the best one touching the cache
+            float bestScore = -1e30f;
+            best = triangleCount;
+            for (int i = 0; i < cacheCount; i++) {
+                GLuint v = cache[i];
+                const unsigned int* list = &adjacency[adjacencyOffsets[v]];
+                for (unsigned int j = 0; j < liveTriangles[v]; j++) {
+                    if (triangleScores[list[j]] > bestScore) {
+                        bestScore = triangleScores[list[j]];
+                        best = list[j];
+                    }
+                }
+            }
+        }
+    }
+
+    void OptimizeOverdraw(GLuint* destination, const GLuint* indices, size_t indexCount,
+        const Vertex* vertices, size_t vertexCount, float threshold)
+    {
+        const unsigned int cacheSize = 16;
+        size_t triangleCount = indexCount / 3;
+        if (triangleCount == 0) {
+            return;
+        }
+
+        // hard boundaries: the cache restarts wherever a triangle misses all three vertices
+        std::vector<size_t> hardClusters;
+        {
+            FifoCache cache(vertexCount, cacheSize);
+            for (size_t t = 0; t < triangleCount; t++) {
+                unsigned int misses = cache.Access(indices[t * 3 + 0]) + cache.Access(indices[t * 3 + 1]) + cache.Access(indices[t * 3 + 2]);
+                if (t == 0 || misses == 3) {
+                    hardClusters.push_back(t);
+                }
+            }
+        }
+        hardClusters.push_back(triangleCount);
+
+        // soft boundaries: cut a hard cluster wherever the running ACMR is
+        // already close to what the whole cluster achieves
+        std::vector<size_t> clusters;
+        for (size_t h = 0; h + 1 < hardClusters.size(); h++) {
+            size_t start = hardClusters[h];
+            size_t end = hardClusters[h + 1];
+
+            FifoCache cache(vertexCount, cacheSize);
+            size_t clusterMisses = 0;
+            for (size_t i = start * 3; i < end * 3; i++) {
+                clusterMisses += cache.Access(indices[i]);
+            }
+            float clusterAcmr = static_cast<float>(clusterMisses) / static_cast<float>(end - start);
+
+            cache.Flush();
+            clusters.push_back(start);
+            size_t softStart = start;
+            size_t misses = 0;
+            for (size_t t = start; t < end; t++) {
+                misses += cache.Access(indices[t * 3 + 0]) + cache.Access(indices[t * 3 + 1]) + cache.Access(indices[t * 3 + 2]);
+                float acmr = static_cast<float>(misses) / static_cast<float>(t + 1 - softStart);
+                if (t + 1 < end && acmr <= clusterAcmr * threshold) {
+                    clusters.push_back(t + 1);
+                    softStart = t + 1;
+                    misses = 0;
+                    cache.Flush();
+                }
+            }
+        }
+        clusters.push_back(triangleCount);
+
+        glm::vec3 meshCentroid(0.0f);
+        for (size_t v = 0; v < vertexCount; v++) {
+            meshCentroid += vertices[v].Position;
+        }
+        meshCentroid /= static_cast<float>(vertexCount);
+
+        // sort key: how much the cluster faces away from the mesh center
+        size_t clusterCount = clusters.size() - 1;
+        std::vector<float> sortKeys(clusterCount);
+        for (size_t c = 0; c < clusterCount; c++) {
+            glm::vec3 centroid(0.0f);
+            glm::vec3 normal(0.0f);
+            float area = 0.0f;
+            for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+                const glm::vec3& p0 = vertices[indices[t * 3 + 0]].Position;
+                const glm::vec3& p1 = vertices[indices[t * 3 + 1]].Position;
+                const glm::vec3& p2 = vertices[indices[t * 3 + 2]].Position;
+                glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+                float a = glm::length(n);
+                centroid += (p0 + p1 + p2) * (a / 3.0f);
+                normal += n;
+                area += a;
+            }
+            if (area > 0.0f) {
+                centroid /= area;
+            }
+            float normalLength = glm::length(normal);
+            if (normalLength > 0.0f) {
+                normal /= normalLength;
+            }
+            sortKeys[c] = glm::dot(centroid - meshCentroid, normal);
+        }
+
+        std::vector<size_t> order(clusterCount);
+        for (size_t c = 0; c < clusterCount; c++) {
+            order[c] = c;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });
+
+        size_t offset = 0;
+        for (size_t i = 0; i < clusterCount; i++) {
+            size_t c = order[i];
+            size_t count = (clusters[c + 1] - clusters[c]) * 3;
+            std::copy(indices + clusters[c] * 3, indices + clusters[c] * 3 + count, destination + offset);
+            offset += count;
+        }
+    }
+
+    size_t OptimizeVertexFetch(Vertex* vertices, size_t vertexCount, GLuint* indices, size_t indexCount)
+    {
+        const GLuint unused = ~0u;
+        std::vector<GLuint> remap(vertexCount, unused);
+        GLuint next = 0;
+        for (size_t i = 0; i < indexCount; i++) {
+            GLuint& slot = remap[indices[i]];
+            if (slot == unused) {
+                slot = next++;
+            }
+            indices[i] = slot;
+        }
+
+        std::vector<Vertex> original(vertices, vertices + vertexCount);
+        for (size_t v = 0; v < vertexCount; v++) {
+            if (remap[v] != unused) {
+                vertices[remap[v]] = original[v];
+            }
+        }
+        return next;
+    }
+
+    size_t RemoveDegenerateTriangles(GLuint* indices, size_t indexCount, const Vertex* vertices)
+    {
+        size_t write = 0;
+        for (size_t i = 0; i + 2 < indexCount; i += 3) {
+            GLuint a = indices[i + 0];
+            GLuint b = indices[i + 1];
+            GLuint c = indices[i + 2];
+            if (a == b || b == c || a == c) {
+                continue;
+            }
+
+            glm::vec3 n = glm::cross(vertices[b].Position - vertices[a].Position, vertices[c].Position - vertices[a].Position);
+            if (n.x == 0.0f && n.y == 0.0f && n.z == 0.0f) {
+                continue;
+            }
+
+            indices[write++] = a;
+            indices[write++] = b;
+            indices[write++] = c;
+        }
+        return write;
+    }
+
+    // The whole index buffer with every range rebased onto the shared vertex buffer
+    static std::vector<GLuint> AbsoluteIndices(const MeshData& mesh)
+    {
+        std::vector<GLuint> indices;
+        indices.reserve(mesh.indices.size());
+        for (size_t s = 0; s < mesh.submeshes.size(); s++) {
+            const SubMesh& submesh = mesh.submeshes[s];
+            for (GLsizei i = 0; i < submesh.indexCount; i++) {
+                indices.push_back(mesh.indices[submesh.firstIndex + i] + submesh.baseVertex);
+            }
+        }
+        return indices;
+    }
+
+    VertexCacheStats AnalyzeMeshVertexCache(const MeshData& mesh)
+    {
+        std::vector<GLuint> absolute = AbsoluteIndices(mesh);
+        return AnalyzeVertexCache(absolute.data(), absolute.size(), mesh.vertices.size());
+    }
+
+    MeshOptimizationStats OptimizeMesh(MeshData* mesh)
+    {
+        MeshOptimizationStats stats;
+        stats.before = AnalyzeMeshVertexCache(*mesh);
+        stats.degenerateTriangles = 0;
+        stats.unusedVertices = 0;
+
+        std::vector<Vertex> vertices;
+        std::vector<GLuint> indices;
+        vertices.reserve(mesh->vertices.size());
+        indices.reserve(mesh->indices.size());
+
+        for (size_t s = 0; s < mesh->submeshes.size(); s++) {
+            SubMesh& submesh = mesh->submeshes[s];
+            const Vertex* rangeVertices = mesh->vertices.data() + submesh.baseVertex;
+            size_t rangeVertexCount = submesh.vertexCount;
+
+            std::vector<GLuint> rangeIndices(mesh->indices.begin() + submesh.firstIndex,
+                mesh->indices.begin() + submesh.firstIndex + submesh.indexCount);
+            size_t indexCount = RemoveDegenerateTriangles(rangeIndices.data(), rangeIndices.size(), rangeVertices);
+            stats.degenerateTriangles += (rangeIndices.size() - indexCount) / 3;
+            rangeIndices.resize(indexCount);
+
+            std::vector<GLuint> reordered(indexCount);
+            OptimizeVertexCache(reordered.data(), rangeIndices.data(), indexCount, rangeVertexCount);
+            OptimizeOverdraw(rangeIndices.data(), reordered.data(), indexCount, rangeVertices, rangeVertexCount);
+
+            std::vector<Vertex> rangeCopy(rangeVertices, rangeVertices + rangeVertexCount);
+            size_t usedVertexCount = OptimizeVertexFetch(rangeCopy.data(), rangeVertexCount, rangeIndices.data(), indexCount);
+            stats.unusedVertices += rangeVertexCount - usedVertexCount;
+
+            submesh.firstIndex = static_cast<GLuint>(indices.size());
+            submesh.indexCount = static_cast<GLsizei>(indexCount);
+            submesh.baseVertex = static_cast<GLint>(vertices.size());
+            submesh.vertexCount = static_cast<GLsizei>(usedVertexCount);
+
+            vertices.insert(vertices.end(), rangeCopy.begin(), rangeCopy.begin() + usedVertexCount);
+            indices.insert(indices.end(), rangeIndices.begin(), rangeIndices.end());
+        }
+
+        mesh->vertices.swap(vertices);
+        mesh->indices.swap(indices);
+
+        stats.after = AnalyzeMeshVertexCache(*mesh);
+        return stats;
+    }
+
+}
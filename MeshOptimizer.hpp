@@ -0,0 +1,58 @@
+#ifndef MeshOptimizer_hpp
+#define MeshOptimizer_hpp
+
+#include "Mesh.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+    // Post-transform cache efficiency of an index buffer, simulated with a FIFO cache
+    struct VertexCacheStats
+    {
+        // average cache miss ratio: transformed vertices per triangle (0.5 - 3)
+        float acmr;
+        // average transform to vertex ratio: transformed vertices per vertex (1 is ideal)
+        float atvr;
+    };
+
+    struct MeshOptimizationStats
+    {
+        VertexCacheStats before;
+        VertexCacheStats after;
+        size_t degenerateTriangles;
+        size_t unusedVertices;
+    };
+
+    // Simulates a FIFO post-transform cache of `cacheSize` entries over a triangle list
+    VertexCacheStats AnalyzeVertexCache(const GLuint* indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize = 16);
+
+    // The same over the full-detail ranges of a mesh, in drawing order
+    VertexCacheStats AnalyzeMeshVertexCache(const MeshData& mesh);
+
+    // Reorders the triangles of a list for vertex cache locality (Forsyth's
+    // linear-speed algorithm). `destination` may not alias `indices`.
+    void OptimizeVertexCache(GLuint* destination, const GLuint* indices, size_t indexCount, size_t vertexCount);
+
+    // Reorders clusters of an already cache-optimized list so that outward
+    // facing clusters are drawn first, which cuts overdraw on convex parts of
+    // the mesh. Clusters are split where the cache restarts, or where cutting
+    // costs less than `threshold` times the cluster's ACMR (Tipsify-style).
+    void OptimizeOverdraw(GLuint* destination, const GLuint* indices, size_t indexCount,
+        const Vertex* vertices, size_t vertexCount, float threshold = 1.05f);
+
+    // Renumbers vertices in order of first use and drops unreferenced ones;
+    // returns the new vertex count
+    size_t OptimizeVertexFetch(Vertex* vertices, size_t vertexCount, GLuint* indices, size_t indexCount);
+
+    // Removes triangles that repeat an index or have zero area; returns the new index count
+    size_t RemoveDegenerateTriangles(GLuint* indices, size_t indexCount, const Vertex* vertices);
+
+    // Runs all of the above on every range of a freshly parsed mesh, keeping
+    // the ranges contiguous in the shared vertex and index buffers
+    MeshOptimizationStats OptimizeMesh(MeshData* mesh);
+
+}
+
+#endif /* MeshOptimizer_hpp */
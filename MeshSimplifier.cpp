@@ -0,0 +1,553 @@
+#include "MeshSimplifier.hpp"
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace gps {
+
+    // Border edges are kept in place by planes perpendicular to them, this much stronger than faces
+    static const double BORDER_WEIGHT = 10.0;
+    // Cost of turning a wedge's normal fully around, relative to the squared edge length
+    static const double NORMAL_WEIGHT = 1.0;
+    // Smallest cosine between a triangle's normal before and after a collapse
+    static const float MIN_NORMAL_COSINE = 0.25f;
+    // Each level aims for this fraction of the previous level's triangles
+    static const float LOD_REDUCTION = 0.5f;
+    // Levels that keep more than this fraction of the previous level's triangles are dropped
+    static const float LOD_MIN_REDUCTION = 0.85f;
+
+    // Sum of squared distances to a set of weighted planes
+    struct Quadric
+    {
+        double a00, a01, a02, a11, a12, a22;
+        double b0, b1, b2;
+        double c;
+        double weight;
+
+        Quadric() : a00(0), a01(0), a02(0), a11(0), a12(0), a22(0), b0(0), b1(0), b2(0), c(0), weight(0) {}
+
+        // plane dot(n, p) + d = 0
+        void AddPlane(const glm::dvec3& n, double d, double w)
+        {
+            a00 += w * n.x * n.x; a01 += w * n.x * n.y; a02 += w * n.x * n.z;
+            a11 += w * n.y * n.y; a12 += w * n.y * n.z; a22 += w * n.z * n.z;
+            b0 += w * n.x * d; b1 += w * n.y * d; b2 += w * n.z * d;
+            c += w * d * d;
+            weight += w;
+        }
+
+        void Add(const Quadric& q)
+        {
+            a00 += q.a00; a01 += q.a01; a02 += q.a02;
+            a11 += q.a11; a12 += q.a12; a22 += q.a22;
+            b0 += q.b0; b1 += q.b1; b2 += q.b2;
+            c += q.c;
+            weight += q.weight;
+        }
+
+        double Evaluate(const glm::vec3& p) const
+        {
+            double x = p.x, y = p.y, z = p.z;
+            double r = a00 * x * x + a11 * y * y + a22 * z * z
+                + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z)
+                + 2.0 * (b0 * x + b1 * y + b2 * z) + c;
+            return r > 0.0 ? r : 0.0;
+        }
+    };
+
+    // Classification of a position for collapsing
+    enum PositionKind
+    {
+        POSITION_INTERIOR,
+        // on exactly one open boundary loop; slides along it only
+        POSITION_BORDER,
+        // anything else (corners, non-manifold); never collapsed
+        POSITION_LOCKED
+    };
+
+    struct Collapse
+    {
+        GLuint from;
+        GLuint to;
+        double cost;
+    };
+
+    static uint64_t EdgeKey(GLuint a, GLuint b)
+    {
+        return (static_cast<uint64_t>(a) << 32) | b;
+    }
+
+    // Triangles of every vertex, as one flat array
+    struct TriangleAdjacency
+    {
+        std::vector<GLuint> offsets;
+        std::vector<GLuint> triangles;
+
+        void Build(const std::vector<GLuint>& indices, size_t vertexCount)
+        {
+            offsets.assign(vertexCount + 1, 0);
+            for (size_t i = 0; i < indices.size(); i++) {
+                offsets[indices[i] + 1]++;
+            }
+            for (size_t v = 0; v < vertexCount; v++) {
+                offsets[v + 1] += offsets[v];
+            }
+            triangles.resize(indices.size());
+            std::vector<GLuint> fill(offsets.begin(), offsets.end() - 1);
+            for (size_t i = 0; i < indices.size(); i++) {
+                triangles[fill[indices[i]]++] = static_cast<GLuint>(i / 3);
+            }
+        }
+    };
+
+    size_t SimplifyMesh(GLuint* destination, const GLuint* indices, size_t indexCount,
+        const Vertex* vertices, size_t vertexCount, size_t targetIndexCount, float targetError, float* resultError,
+        bool lockBorder)
+    {
+        *resultError = 0.0f;
+        std::vector<GLuint> current(indices, indices + indexCount);
+
+        // vertices that share a position are the wedges of one position
+        std::vector<GLuint> positionOf(vertexCount);
+        std::vector<glm::vec3> positions;
+        // circular list of the wedges of each position, and one entry point into it
+        std::vector<GLuint> wedgeNext(vertexCount);
+        std::vector<GLuint> firstWedge;
+        {
+            struct PositionHash
+            {
+                size_t operator()(const glm::vec3& p) const
+                {
+                    GLuint bits[3];
+                    memcpy(bits, &p, sizeof(bits));
+                    return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+                }
+            };
+            std::unordered_map<glm::vec3, GLuint, PositionHash> ids;
+            std::vector<GLuint> lastWedge;
+            for (size_t v = 0; v < vertexCount; v++) {
+                std::pair<std::unordered_map<glm::vec3, GLuint, PositionHash>::iterator, bool> inserted =
+                    ids.insert(std::make_pair(vertices[v].Position, static_cast<GLuint>(positions.size())));
+                GLuint id = inserted.first->second;
+                positionOf[v] = id;
+                if (inserted.second) {
+                    positions.push_back(vertices[v].Position);
+                    firstWedge.push_back(static_cast<GLuint>(v));
+                    lastWedge.push_back(static_cast<GLuint>(v));
+                    wedgeNext[v] = static_cast<GLuint>(v);
+                } else {
+                    // splice into the circular wedge list
+                    GLuint last = lastWedge[id];
+                    wedgeNext[v] = wedgeNext[last];
+                    wedgeNext[last] = static_cast<GLuint>(v);
+                    lastWedge[id] = static_cast<GLuint>(v);
+                }
+            }
+        }
+        size_t positionCount = positions.size();
+
+        // face quadrics, area weighted
+        std::vector<Quadric> quadrics(positionCount);
+        for (size_t i = 0; i + 2 < current.size(); i += 3) {
+            glm::dvec3 p0(positions[positionOf[current[i + 0]]]);
+            glm::dvec3 p1(positions[positionOf[current[i + 1]]]);
+            glm::dvec3 p2(positions[positionOf[current[i + 2]]]);
+            glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+            double area = glm::length(n);
+            if (area == 0.0) {
+                continue;
+            }
+            n /= area;
+            double d = -glm::dot(n, p0);
+            for (int k = 0; k < 3; k++) {
+                quadrics[positionOf[current[i + k]]].AddPlane(n, d, area);
+            }
+        }
+
+        std::vector<GLuint> vertexRemap(vertexCount);
+        std::vector<char> touched(positionCount);
+        std::vector<PositionKind> kinds(positionCount);
+        std::vector<int> borderEdges(positionCount);
+        std::unordered_map<uint64_t, int> directedEdges;
+        TriangleAdjacency adjacency;
+        std::vector<Collapse> collapses;
+        double maxCost = static_cast<double>(targetError) * targetError;
+        double appliedCost = 0.0;
+        bool bordersWeighted = false;
+
+        while (current.size() > targetIndexCount) {
+            size_t triangleCount = current.size() / 3;
+
+            // open edges at the position level; seams are closed there
+            directedEdges.clear();
+            for (size_t t = 0; t < triangleCount; t++) {
+                for (int k = 0; k < 3; k++) {
+                    GLuint a = positionOf[current[t * 3 + k]];
+                    GLuint b = positionOf[current[t * 3 + (k + 1) % 3]];
+                    directedEdges[EdgeKey(a, b)]++;
+                }
+            }
+            std::fill(borderEdges.begin(), borderEdges.end(), 0);
+            for (size_t t = 0; t < triangleCount; t++) {
+                for (int k = 0; k < 3; k++) {
+                    GLuint a = positionOf[current[t * 3 + k]];
+                    GLuint b = positionOf[current[t * 3 + (k + 1) % 3]];
+                    if (directedEdges.count(EdgeKey(b, a))) {
+                        continue;
+                    }
+                    borderEdges[a]++;
+                    borderEdges[b]++;
+
+                    if (!bordersWeighted) {
+                        // plane through the edge, perpendicular to its triangle
+                        glm::dvec3 pa(positions[a]);
+                        glm::dvec3 edge = glm::dvec3(positions[b]) - pa;
+                        glm::dvec3 other(positions[positionOf[current[t * 3 + (k + 2) % 3]]]);
+                        glm::dvec3 n = glm::cross(edge, glm::cross(edge, other - pa));
+                        double length = glm::length(n);
+                        if (length > 0.0) {
+                            n /= length;
+                            double d = -glm::dot(n, pa);
+                            double w = BORDER_WEIGHT * glm::dot(edge, edge);
+                            quadrics[a].AddPlane(n, d, w);
+                            quadrics[b].AddPlane(n, d, w);
+                        }
+                    }
+                }
+            }
+            bordersWeighted = true;
+            for (size_t p = 0; p < positionCount; p++) {
+                kinds[p] = borderEdges[p] == 0 ? POSITION_INTERIOR :
+                    (borderEdges[p] == 2 && !lockBorder ? POSITION_BORDER : POSITION_LOCKED);
+            }
+
+            adjacency.Build(current, vertexCount);
+
+            // cheapest valid collapse of every position
+            collapses.clear();
+            for (size_t p = 0; p < positionCount; p++) {
+                if (kinds[p] == POSITION_LOCKED) {
+                    continue;
+                }
+
+                Collapse best;
+                best.from = static_cast<GLuint>(p);
+                best.to = static_cast<GLuint>(p);
+                best.cost = 1e300;
+
+                // candidate targets: positions sharing a triangle with p
+                GLuint w = firstWedge[p];
+                do {
+                    for (GLuint j = adjacency.offsets[w]; j < adjacency.offsets[w + 1]; j++) {
+                        GLuint t = adjacency.triangles[j];
+                        for (int k = 0; k < 3; k++) {
+                            GLuint q = positionOf[current[t * 3 + k]];
+                            if (q == p) {
+                                continue;
+                            }
+                            // a border position only slides along its border
+                            if (kinds[p] == POSITION_BORDER &&
+                                directedEdges.count(EdgeKey(static_cast<GLuint>(p), q)) + directedEdges.count(EdgeKey(q, static_cast<GLuint>(p))) != 1) {
+                                continue;
+                            }
+
+                            Quadric sum = quadrics[p];
+                            sum.Add(quadrics[q]);
+                            double cost = sum.weight > 0.0 ? sum.Evaluate(positions[q]) / sum.weight : 0.0;
+                            if (cost < best.cost) {
+                                best.to = q;
+                                best.cost = cost;
+                            }
+                        }
+                    }
+                    w = wedgeNext[w];
+                } while (w != firstWedge[p]);
+
+                if (best.to != best.from) {
+                    collapses.push_back(best);
+                }
+            }
+
+            std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+            for (size_t v = 0; v < vertexCount; v++) {
+                vertexRemap[v] = static_cast<GLuint>(v);
+            }
+            std::fill(touched.begin(), touched.end(), 0);
+
+            size_t liveIndices = current.size();
+            size_t applied = 0;
+            for (size_t c = 0; c < collapses.size() && liveIndices > targetIndexCount; c++) {
+                const Collapse& collapse = collapses[c];
+                GLuint p = collapse.from;
+                GLuint q = collapse.to;
+                if (touched[p] || touched[q]) {
+                    continue;
+                }
+
+                // every wedge of p must land on a wedge of q it shares an edge with,
+                // which keeps UV seams closed and never invents attributes
+                const GLuint first = firstWedge[p];
+                double cost = collapse.cost;
+                bool valid = true;
+                GLuint w = first;
+                do {
+                    GLuint target = ~0u;
+                    for (GLuint j = adjacency.offsets[w]; j < adjacency.offsets[w + 1] && target == ~0u; j++) {
+                        GLuint t = adjacency.triangles[j];
+                        for (int k = 0; k < 3; k++) {
+                            if (positionOf[current[t * 3 + k]] == q) {
+                                target = current[t * 3 + k];
+                            }
+                        }
+                    }
+                    if (adjacency.offsets[w + 1] > adjacency.offsets[w] && target == ~0u) {
+                        // only a hard normal edge in between (flat shading): any wedge of q
+                        // with the same texture coordinates will do, the closest normal wins
+                        float bestCosine = -2.0f;
+                        GLuint v = firstWedge[q];
+                        do {
+                            float cosine = glm::dot(vertices[w].Normal, vertices[v].Normal);
+                            if (vertices[v].TexCoords == vertices[w].TexCoords && cosine > bestCosine) {
+                                target = v;
+                                bestCosine = cosine;
+                            }
+                            v = wedgeNext[v];
+                        } while (v != firstWedge[q]);
+                    }
+                    if (adjacency.offsets[w + 1] > adjacency.offsets[w]) {
+                        if (target == ~0u) {
+                            valid = false;
+                            break;
+                        }
+                        // keep the shading: penalize the change of normal
+                        glm::vec3 edge = positions[q] - positions[p];
+                        double turn = 1.0 - glm::dot(glm::normalize(vertices[w].Normal), glm::normalize(vertices[target].Normal));
+                        if (glm::length(vertices[w].Normal) > 0.0f && glm::length(vertices[target].Normal) > 0.0f) {
+                            cost = std::max(cost, collapse.cost + NORMAL_WEIGHT * turn * glm::dot(edge, edge));
+                        }
+                        vertexRemap[w] = target;
+                    }
+                    w = wedgeNext[w];
+                } while (w != first);
+
+                if (valid && cost > maxCost) {
+                    valid = false;
+                }
+
+                // reject collapses that fold or flip a remaining triangle
+                if (valid) {
+                    w = first;
+                    do {
+                        for (GLuint j = adjacency.offsets[w]; j < adjacency.offsets[w + 1] && valid; j++) {
+                            GLuint t = adjacency.triangles[j];
+                            glm::vec3 corners[3];
+                            bool hasQ = false;
+                            for (int k = 0; k < 3; k++) {
+                                GLuint pos = positionOf[current[t * 3 + k]];
+                                hasQ = hasQ || pos == q;
+                                corners[k] = positions[pos];
+                            }
+                            if (hasQ) {
+                                continue;
+                            }
+                            glm::vec3 before = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+                            for (int k = 0; k < 3; k++) {
+                                if (positionOf[current[t * 3 + k]] == p) {
+                                    corners[k] = positions[q];
+                                }
+                            }
+                            glm::vec3 after = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+                            float lengths = glm::length(before) * glm::length(after);
+                            if (lengths == 0.0f || glm::dot(before, after) < MIN_NORMAL_COSINE * lengths) {
+                                valid = false;
+                            }
+                        }
+                        w = wedgeNext[w];
+                    } while (w != first && valid);
+                }
+
+                if (!valid) {
+                    w = first;
+                    do {
+                        vertexRemap[w] = w;
+                        w = wedgeNext[w];
+                    } while (w != first);
+                    continue;
+                }
+
+                // lock the neighborhood for the rest of this pass
+                w = first;
+                do {
+                    for (GLuint j = adjacency.offsets[w]; j < adjacency.offsets[w + 1]; j++) {
+                        GLuint t = adjacency.triangles[j];
+                        bool hasQ = false;
+                        for (int k = 0; k < 3; k++) {
+                            touched[positionOf[current[t * 3 + k]]] = 1;
+                            hasQ = hasQ || positionOf[current[t * 3 + k]] == q;
+                        }
+                        if (hasQ) {
+                            liveIndices -= 3;
+                        }
+                    }
+                    w = wedgeNext[w];
+                } while (w != first);
+
+                quadrics[q].Add(quadrics[p]);
+                appliedCost = std::max(appliedCost, cost);
+                applied++;
+            }
+
+            if (applied == 0) {
+                break;
+            }
+
+            // rewrite the triangles and drop the ones that collapsed
+            size_t write = 0;
+            for (size_t i = 0; i + 2 < current.size(); i += 3) {
+                GLuint a = vertexRemap[current[i + 0]];
+                GLuint b = vertexRemap[current[i + 1]];
+                GLuint c = vertexRemap[current[i + 2]];
+                if (positionOf[a] == positionOf[b] || positionOf[b] == positionOf[c] || positionOf[a] == positionOf[c]) {
+                    continue;
+                }
+                current[write++] = a;
+                current[write++] = b;
+                current[write++] = c;
+            }
+            current.resize(write);
+        }
+
+        std::copy(current.begin(), current.end(), destination);
+        *resultError = static_cast<float>(std::sqrt(appliedCost));
+        return current.size();
+    }
+
+    // Simplifies one cluster on its own vertices, numbered locally, with its
+    // border locked, and puts the result in vertex cache order
+    static float SimplifyCluster(std::vector<GLuint>& result, const std::vector<GLuint>& source, const Vertex* vertices,
+        size_t targetIndexCount, float targetError)
+    {
+        std::unordered_map<GLuint, GLuint> localOf;
+        std::vector<Vertex> localVertices;
+        std::vector<GLuint> globalOf;
+        std::vector<GLuint> local(source.size());
+        for (size_t i = 0; i < source.size(); i++) {
+            std::pair<std::unordered_map<GLuint, GLuint>::iterator, bool> inserted =
+                localOf.insert(std::make_pair(source[i], static_cast<GLuint>(globalOf.size())));
+            if (inserted.second) {
+                globalOf.push_back(source[i]);
+                localVertices.push_back(vertices[source[i]]);
+            }
+            local[i] = inserted.first->second;
+        }
+
+        std::vector<GLuint> simplified(local.size());
+        float error = 0.0f;
+        size_t count = SimplifyMesh(simplified.data(), local.data(), local.size(), localVertices.data(), globalOf.size(),
+            targetIndexCount, targetError, &error, true);
+        OptimizeVertexCache(local.data(), simplified.data(), count, globalOf.size());
+
+        result.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            result[i] = globalOf[local[i]];
+        }
+        return error;
+    }
+
+    void GenerateLods(MeshData* mesh)
+    {
+        // no cap on the error: far-away objects need the coarse levels, and the
+        // projected pixel error decides at draw time which level is good enough
+        float maxError = FLT_MAX;
+
+        mesh->lodErrors.assign(1, 0.0f);
+
+        // what gets simplified: each cluster of a clustered range, or the whole range
+        struct Part
+        {
+            size_t submesh;
+            Cluster* cluster;
+            std::vector<GLuint> previous;
+            std::vector<GLuint> simplified;
+            float error;
+        };
+        std::vector<Part> parts;
+        for (size_t s = 0; s < mesh->submeshes.size(); s++) {
+            SubMesh& submesh = mesh->submeshes[s];
+            size_t clusterCount = std::max<size_t>(submesh.clusters.size(), 1);
+            for (size_t c = 0; c < clusterCount; c++) {
+                Part part;
+                part.submesh = s;
+                part.cluster = submesh.clusters.empty() ? NULL : &submesh.clusters[c];
+                GLuint firstIndex = part.cluster ? part.cluster->firstIndex : submesh.firstIndex;
+                GLsizei indexCount = part.cluster ? part.cluster->indexCount : submesh.indexCount;
+                // the coarser levels go after the full-detail index buffer
+                part.previous.assign(mesh->indices.begin() + firstIndex, mesh->indices.begin() + firstIndex + indexCount);
+                part.error = 0.0f;
+                parts.push_back(part);
+            }
+        }
+
+        for (int level = 1; level < MAX_LOD_LEVELS; level++) {
+            size_t before = 0;
+            size_t after = 0;
+
+            for (size_t p = 0; p < parts.size(); p++) {
+                Part& part = parts[p];
+                const SubMesh& submesh = mesh->submeshes[part.submesh];
+                const Vertex* vertices = mesh->vertices.data() + submesh.baseVertex;
+                size_t target = static_cast<size_t>(part.previous.size() / 3 * LOD_REDUCTION) * 3;
+
+                float error = 0.0f;
+                if (part.cluster != NULL) {
+                    error = SimplifyCluster(part.simplified, part.previous, vertices, target, maxError);
+                } else {
+                    std::vector<GLuint> result(part.previous.size());
+                    size_t count = SimplifyMesh(result.data(), part.previous.data(), part.previous.size(),
+                        vertices, submesh.vertexCount, target, maxError, &error);
+                    part.simplified.resize(count);
+                    OptimizeVertexCache(part.simplified.data(), result.data(), count, submesh.vertexCount);
+                }
+
+                before += part.previous.size();
+                after += part.simplified.size();
+                part.error = std::max(part.error, error);
+            }
+
+            // not worth a level of its own; coarser ones would be the same
+            if (after == 0 || after > before * LOD_MIN_REDUCTION) {
+                break;
+            }
+
+            // the parts of a range are consecutive, so each range's level is one run
+            float levelError = mesh->lodErrors.back();
+            for (size_t p = 0; p < parts.size(); p++) {
+                Part& part = parts[p];
+                SubMesh& submesh = mesh->submeshes[part.submesh];
+                LodRange range;
+                range.firstIndex = static_cast<GLuint>(mesh->indices.size());
+                range.indexCount = static_cast<GLsizei>(part.simplified.size());
+                range.error = part.error;
+                if (part.cluster != NULL) {
+                    part.cluster->lods.push_back(range);
+                }
+                if (submesh.lods.size() < static_cast<size_t>(level)) {
+                    submesh.lods.push_back(range);
+                } else {
+                    submesh.lods.back().indexCount += range.indexCount;
+                    submesh.lods.back().error = std::max(submesh.lods.back().error, range.error);
+                }
+                mesh->indices.insert(mesh->indices.end(), part.simplified.begin(), part.simplified.end());
+                part.previous.swap(part.simplified);
+                levelError = std::max(levelError, part.error);
+            }
+            mesh->lodErrors.push_back(levelError);
+        }
+    }
+
+}
@@ -0,0 +1,33 @@
+#ifndef MeshSimplifier_hpp
+#define MeshSimplifier_hpp
+
+#include "Mesh.hpp"
+
+#include <cstddef>
+
+namespace gps {
+
+    // Simplifies an indexed triangle list by quadric edge collapse. Vertices
+    // are only ever collapsed onto existing ones, so the result indexes the
+    // same vertex buffer. Vertices that share a position but differ in normal
+    // or texture coordinates (seams) only collapse along the seam, open
+    // borders only along the border, and collapses that flip a triangle or
+    // bend the normals too far are rejected.
+    // Stops at `targetIndexCount` indices or when the next collapse would move
+    // the surface by more than `targetError`; returns the new index count and
+    // the error of the simplified surface in `resultError`. With `lockBorder`,
+    // open borders do not move at all.
+    size_t SimplifyMesh(GLuint* destination, const GLuint* indices, size_t indexCount,
+        const Vertex* vertices, size_t vertexCount, size_t targetIndexCount, float targetError, float* resultError,
+        bool lockBorder = false);
+
+    // Appends up to MAX_LOD_LEVELS - 1 coarser index ranges to every range of
+    // the mesh, each about half the triangles of the previous one, and fills
+    // in the per-level errors. Levels that barely reduce anything are dropped.
+    // Clustered ranges are simplified cluster by cluster with the cluster
+    // borders locked, and each level of the range is its clusters' levels.
+    void GenerateLods(MeshData* mesh);
+
+}
+
+#endif /* MeshSimplifier_hpp */
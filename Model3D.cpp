@@ -1,66 +1,649 @@
 #include "Model3D.hpp"
+#include "GLState.hpp"
+#include "InstanceBuffer.hpp"
+#include "MeshClusters.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshSimplifier.hpp"
+#include "PixelUnpackRing.hpp"
+#include "RenderQueue.hpp"
+#include "TextureCache.hpp"
+#include "TextureEncoder.hpp"
+#include "TextureRegistry.hpp"
+#include "TextureStreamer.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace gps {
 
+	// Hashes the (vertex, normal, texcoord) index triple of a face corner
+	struct IndexTripleHash {
+		size_t operator()(const tinyobj::index_t& idx) const {
+			size_t h = std::hash<int>()(idx.vertex_index);
+			h ^= std::hash<int>()(idx.normal_index) + 0x9e3779b9 + (h << 6) + (h >> 2);
+			h ^= std::hash<int>()(idx.texcoord_index) + 0x9e3779b9 + (h << 6) + (h >> 2);
+			return h;
+		}
+	};
+
+	struct IndexTripleEqual {
+		bool operator()(const tinyobj::index_t& a, const tinyobj::index_t& b) const {
+			return a.vertex_index == b.vertex_index &&
+				a.normal_index == b.normal_index &&
+				a.texcoord_index == b.texcoord_index;
+		}
+	};
+
+	// Screen-space error, in pixels, allowed at a LOD bias of 0
+	static const float LOD_PIXEL_ERROR = 1.0f;
+
+	// Worker threads shared by all background model loads
+	static ThreadPool& LoaderPool() {
+		static ThreadPool pool;
+		return pool;
+	}
+
+	// Worker threads decoding images; separate from the loader pool because
+	// loader jobs wait for their decodes
+	static ThreadPool& DecoderPool() {
+		static ThreadPool pool;
+		return pool;
+	}
+
+	// Worker threads encoding blocks; decoder jobs wait for them
+	static ThreadPool& EncoderPool() {
+		static ThreadPool pool;
+		return pool;
+	}
+
+	// Layers per packed texture array; GL 3.0 guarantees at least 256
+	static const size_t MAX_ARRAY_LAYERS = 256;
+
+	// Staging memory decoders write texture rows into; about three 2048x2048 RGBA8 mip chains
+	static const size_t STAGING_RING_SIZE = 64 * 1024 * 1024;
+
+	static PixelUnpackRing& StagingRing() {
+		static PixelUnpackRing ring;
+		return ring;
+	}
+
+	// Immutable storage is core in GL 4.2; 4.1 drivers mostly expose the extension
+	static bool HasTextureStorage() {
+		return GLEW_VERSION_4_2 || GLEW_ARB_texture_storage;
+	}
+
+	std::vector<Model3D*> Model3D::pendingModels;
+	std::atomic<bool> Model3D::optimizeMeshes(true);
+	std::atomic<bool> Model3D::generateLods(true);
+	std::atomic<bool> Model3D::generateClusters(true);
+	std::atomic<bool> Model3D::packTextures(true);
+	std::atomic<bool> Model3D::transcodeTextures(true);
+	std::atomic<bool> Model3D::streamTextures(true);
+	bool Model3D::compactVertices = true;
+	glm::vec3 Model3D::lodEye(0.0f);
+	// no camera yet - always full detail
+	float Model3D::lodProjectionScale = 0.0f;
+	float Model3D::lodBias = 0.0f;
+	bool Model3D::cullingEnabled = false;
+	glm::mat4 Model3D::cullingViewProjection(1.0f);
+	glm::vec3 Model3D::cullingEye(0.0f);
+	bool Model3D::cullingBackfaces = false;
+	RenderQueue* Model3D::renderQueue = NULL;
+
+	ModelData::~ModelData() {
+		for (size_t i = 0; i < textures.size(); i++) {
+			if (textures[i].staged) {
+				StagingRing().Discard(textures[i].stagingOffset);
+			}
+		}
+	}
+
+	Model3D::Model3D()
+		: placeholder(NULL), resident(false)
+	{
+	}
+
 	void Model3D::LoadModel(std::string fileName)
 	{
         std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
-		ReadOBJ(fileName, basePath);
+		LoadModel(fileName, basePath);
 	}
 
     void Model3D::LoadModel(std::string fileName, std::string basePath)
 	{
-		ReadOBJ(fileName, basePath);
+		InitTextureUploads();
+		std::unique_ptr<ModelData> data = ReadModelData(fileName, basePath);
+		// models loaded up front are required
+		if (!data) {
+			exit(1);
+		}
+
+		size_t nextTexture = 0;
+		size_t nextMesh = 0;
+		while (UploadStep(data.get(), &nextTexture, &nextMesh)) {
+		}
+		resident = true;
+		StagingRing().Retire();
+	}
+
+	void Model3D::LoadModelAsync(std::string fileName)
+	{
+		std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
+		LoadModelAsync(fileName, basePath);
+	}
+
+	void Model3D::LoadModelAsync(std::string fileName, std::string basePath)
+	{
+		InitTextureUploads();
+		std::shared_ptr<AsyncLoad> load = std::make_shared<AsyncLoad>();
+		load->ready = false;
+		load->failed = false;
+		load->nextTexture = 0;
+		load->nextMesh = 0;
+
+		asyncLoad = load;
+		resident = false;
+		pendingModels.push_back(this);
+
+		LoaderPool().Enqueue([load, fileName, basePath]() {
+			load->data = ReadModelData(fileName, basePath);
+			// never exit from here: the pool's workers are joined during static destruction
+			load->failed = !load->data;
+			load->ready = true;
+		});
+	}
+
+	void Model3D::SetPlaceholder(Model3D* placeholder)
+	{
+		this->placeholder = placeholder;
+	}
+
+	bool Model3D::IsResident() const
+	{
+		return resident;
+	}
+
+	void Model3D::ProcessPendingUploads(double budgetSeconds)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		StagingRing().Retire();
+
+		size_t i = 0;
+		while (i < pendingModels.size()) {
+			Model3D* model = pendingModels[i];
+			AsyncLoad* load = model->asyncLoad.get();
+			if (!load->ready) {
+				i++;
+				continue;
+			}
+			// the model stays non-resident, so its placeholder keeps being drawn
+			if (load->failed) {
+				model->asyncLoad.reset();
+				pendingModels.erase(pendingModels.begin() + i);
+				continue;
+			}
+
+			// one texture batch or mesh at a time, so a big model can span several frames
+			bool more = model->UploadStep(load->data.get(), &load->nextTexture, &load->nextMesh);
+			if (!more) {
+				model->resident = true;
+				model->asyncLoad.reset();
+				pendingModels.erase(pendingModels.begin() + i);
+			}
+
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			if (elapsed.count() >= budgetSeconds) {
+				return;
+			}
+		}
+	}
+
+	void Model3D::Shutdown()
+	{
+		// decoders may still be writing into the mapped ring
+		for (size_t i = 0; i < pendingModels.size(); i++) {
+			AsyncLoad* load = pendingModels[i]->asyncLoad.get();
+			while (!load->ready) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			pendingModels[i]->asyncLoad.reset();
+		}
+		pendingModels.clear();
+		// later decodes find the ring gone and fall back to the heap
+		StagingRing().Destroy();
+	}
+
+	void Model3D::SetMeshOptimization(bool enabled)
+	{
+		optimizeMeshes = enabled;
+	}
+
+	void Model3D::SetCompactVertices(bool enabled)
+	{
+		compactVertices = enabled;
+	}
+
+	void Model3D::SetLodGeneration(bool enabled)
+	{
+		generateLods = enabled;
+	}
+
+	void Model3D::SetClusterGeneration(bool enabled)
+	{
+		generateClusters = enabled;
+	}
+
+	void Model3D::SetTexturePacking(bool enabled)
+	{
+		packTextures = enabled;
+	}
+
+	void Model3D::SetTextureTranscoding(bool enabled)
+	{
+		transcodeTextures = enabled;
+	}
+
+	void Model3D::SetTextureStreaming(bool enabled)
+	{
+		streamTextures = enabled;
+	}
+
+	void Model3D::SetTextureBudget(size_t bytes)
+	{
+		TextureStreamer::Instance().SetBudget(bytes);
+	}
+
+	void Model3D::StreamTextures(double budgetSeconds)
+	{
+		TextureStreamer::Instance().Update(budgetSeconds);
+	}
+
+	void Model3D::SetCullingView(const glm::mat4& view, const glm::mat4& projection, bool cullBackfaces)
+	{
+		cullingEnabled = true;
+		cullingViewProjection = projection * view;
+		cullingEye = glm::vec3(glm::inverse(view)[3]);
+		cullingBackfaces = cullBackfaces;
+	}
+
+	void Model3D::SetRenderQueue(RenderQueue* queue)
+	{
+		renderQueue = queue;
+	}
+
+	void Model3D::SetLodCamera(const glm::mat4& view, const glm::mat4& projection, int viewportHeight)
+	{
+		lodEye = glm::vec3(glm::inverse(view)[3]);
+		lodProjectionScale = projection[1][1] * viewportHeight * 0.5f;
+	}
+
+	void Model3D::SetLodBias(float bias)
+	{
+		lodBias = bias;
 	}
 
 	// Draw each mesh from the model
 	void Model3D::Draw(gps::Shader shaderProgram)
 	{
-		for (int i = 0; i < meshes.size(); i++)
+		if (!resident) {
+			// never wait for a background load - show the stand-in (if any) instead
+			if (placeholder != NULL && placeholder->resident) {
+				placeholder->Draw(shaderProgram);
+			}
+			return;
+		}
+
+		for (int i = 0; i < meshes.size(); i++) {
 			meshes[i].Draw(shaderProgram);
+		}
+	}
+
+	void Model3D::Draw(gps::Shader shaderProgram, const glm::mat4& modelMatrix)
+	{
+		if (!resident) {
+			if (placeholder != NULL && placeholder->resident) {
+				placeholder->Draw(shaderProgram, modelMatrix);
+			}
+			return;
+		}
+
+		// errors grow with the largest axis scale of the model matrix
+		float scale = std::max(glm::length(glm::vec3(modelMatrix[0])),
+			std::max(glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2]))));
+
+		gps::ClusterCulling culling;
+		if (cullingEnabled) {
+			culling = gps::MakeClusterCulling(cullingViewProjection, cullingEye, modelMatrix, cullingBackfaces);
+		}
+		// clustered ranges pick a level per cluster, from its own sphere
+		gps::ClusterLod clusterLod;
+		bool perClusterLod = lodProjectionScale > 0.0f;
+		if (perClusterLod) {
+			clusterLod = gps::MakeClusterLod(lodEye, modelMatrix, lodProjectionScale, LOD_PIXEL_ERROR * std::pow(2.0f, lodBias));
+		}
+		// added with the first visible mesh
+		uint32_t transform = ~0u;
+
+		for (size_t i = 0; i < meshes.size(); i++) {
+			gps::Mesh& mesh = meshes[i];
+			if (cullingEnabled && !gps::IsSphereVisible(mesh.boundsCenter, mesh.boundsRadius, culling)) {
+				continue;
+			}
+
+			// project from the nearest point of the bounding sphere; inside it, keep full detail
+			glm::vec3 center = glm::vec3(modelMatrix * glm::vec4(mesh.boundsCenter, 1.0f));
+			float distance = glm::length(center - lodEye) - mesh.boundsRadius * scale;
+			int lod = SelectLod(mesh, scale, distance);
+			// texture coordinates per pixel at that distance, per unit of UV density
+			float uvScale = distance > 0.0f && lodProjectionScale > 0.0f ? distance / (scale * lodProjectionScale) : 0.0f;
+			RequestTextures(mesh, uvScale);
+			if (renderQueue == NULL) {
+				mesh.Draw(shaderProgram, lod, cullingEnabled ? &culling : NULL, perClusterLod ? &clusterLod : NULL);
+				continue;
+			}
+			if (transform == ~0u) {
+				transform = renderQueue->AddTransform(modelMatrix);
+			}
+			float depth = renderQueue->ViewDepth(center) - mesh.boundsRadius * scale;
+			mesh.Enqueue(*renderQueue, shaderProgram, transform, depth, lod, cullingEnabled ? &culling : NULL,
+				perClusterLod ? &clusterLod : NULL);
+		}
+	}
+
+	void Model3D::DrawInstanced(gps::Shader shaderProgram, const InstanceBuffer& instances)
+	{
+		if (!resident) {
+			if (placeholder != NULL && placeholder->resident) {
+				placeholder->DrawInstanced(shaderProgram, instances);
+			}
+			return;
+		}
+		if (instances.Count() == 0) {
+			return;
+		}
+
+		float scale = instances.MaxScale();
+		gps::ClusterCulling culling;
+		if (cullingEnabled) {
+			// the sphere below is in world space already
+			culling = gps::MakeClusterCulling(cullingViewProjection, cullingEye, glm::mat4(1.0f), false);
+		}
+
+		for (size_t i = 0; i < meshes.size(); i++) {
+			gps::Mesh& mesh = meshes[i];
+			// around every copy of the mesh, whatever the rotation of each
+			glm::vec3 center = instances.BoundsCenter();
+			float radius = instances.BoundsRadius() + (glm::length(mesh.boundsCenter) + mesh.boundsRadius) * scale;
+			if (cullingEnabled && !gps::IsSphereVisible(center, radius, culling)) {
+				continue;
+			}
+
+			// the nearest instance may be anywhere in the sphere
+			float distance = glm::length(center - lodEye) - radius;
+			int lod = SelectLod(mesh, scale, distance);
+			float uvScale = distance > 0.0f && lodProjectionScale > 0.0f ? distance / (scale * lodProjectionScale) : 0.0f;
+			RequestTextures(mesh, uvScale);
+			if (renderQueue == NULL) {
+				mesh.DrawInstanced(shaderProgram, instances, lod);
+				continue;
+			}
+			float depth = renderQueue->ViewDepth(center) - radius;
+			mesh.EnqueueInstanced(*renderQueue, shaderProgram, instances, depth, lod);
+		}
+	}
+
+	int Model3D::SelectLod(const gps::Mesh& mesh, float scale, float distance)
+	{
+		// inside the bounds (or without a camera), keep full detail
+		if (distance <= 0.0f || lodProjectionScale <= 0.0f)
+			return 0;
+
+		float threshold = LOD_PIXEL_ERROR * std::pow(2.0f, lodBias);
+		int lod = 0;
+		for (size_t l = 1; l < mesh.lodErrors.size(); l++) {
+			if (mesh.lodErrors[l] * scale / distance * lodProjectionScale > threshold)
+				break;
+			lod = static_cast<int>(l);
+		}
+		return lod;
+	}
+
+	// Tells the streamer how finely the textures of each range are sampled this frame
+	void Model3D::RequestTextures(const gps::Mesh& mesh, float uvScale)
+	{
+		TextureStreamer& streamer = TextureStreamer::Instance();
+		for (size_t s = 0; s < mesh.submeshes.size(); s++) {
+			const gps::SubMesh& submesh = mesh.submeshes[s];
+			// without a density estimate the texture is kept at full resolution
+			float uvPerPixel = submesh.uvDensity > 0.0f ? submesh.uvDensity * uvScale : 0.0f;
+			for (size_t t = 0; t < submesh.textures.size(); t++) {
+				streamer.Request(submesh.textures[t].id, uvPerPixel);
+			}
+		}
+	}
+
+	std::unique_ptr<ModelData> Model3D::ReadModelData(std::string fileName, std::string basePath)
+	{
+		std::unique_ptr<ModelData> data(new ModelData());
+
+		uint32_t cacheFlags = (optimizeMeshes ? MESH_CACHE_OPTIMIZED : 0) | (generateLods ? MESH_CACHE_LODS : 0) |
+			(generateClusters ? MESH_CACHE_CLUSTERS : 0);
+
+		if (!ReadCache(fileName, cacheFlags, data.get())) {
+			if (!ReadOBJ(fileName, basePath, data.get())) {
+				return std::unique_ptr<ModelData>();
+			}
+
+			if (cacheFlags & MESH_CACHE_OPTIMIZED) {
+				OptimizeMeshes(fileName, data.get());
+			}
+
+			if (cacheFlags & MESH_CACHE_CLUSTERS) {
+				BuildClusters(fileName, data.get());
+			}
+
+			if (cacheFlags & MESH_CACHE_LODS) {
+				GenerateMeshLods(fileName, data.get());
+			}
+
+			if (!MeshCache::Write(MeshCache::CacheFileName(fileName), fileName, data->materialFiles, data->meshes, cacheFlags)) {
+				std::cerr << "WARNING: could not write mesh cache for " << fileName << std::endl;
+			}
+		}
+
+		MeasureUvDensity(data.get());
+		DecodeTextures(data.get());
+		return data;
+	}
+
+	bool Model3D::UploadStep(ModelData* data, size_t* nextTexture, size_t* nextMesh)
+	{
+		if (*nextTexture < data->textureBatches.size()) {
+			const std::vector<size_t>& batch = data->textureBatches[*nextTexture];
+			(*nextTexture)++;
+
+			// another model may have uploaded some of an array's textures since they were decoded;
+			// those are picked up from the registry instead
+			std::vector<TextureData*> layers;
+			for (size_t b = 0; b < batch.size(); b++) {
+				TextureData* texture = &data->textures[batch[b]];
+				if (batch.size() == 1 || !TextureRegistry::Instance().Contains(TextureRegistry::NormalizePath(texture->path))) {
+					layers.push_back(texture);
+				}
+			}
+
+			GLuint id = 0;
+			if (layers.size() == 1) {
+				id = UploadTexture(*layers[0]);
+			}
+			else if (layers.size() > 1) {
+				id = UploadTextureArray(layers);
+			}
+			for (size_t l = 0; l < layers.size() && id != 0; l++) {
+				std::string key = TextureRegistry::NormalizePath(layers[l]->path);
+				if (loadedTextures.find(key) == loadedTextures.end()) {
+					loadedTextures[key] = AddTexture(key, id, layers.size() > 1 ? static_cast<GLint>(l) : -1);
+				}
+			}
+
+			for (size_t b = 0; b < batch.size(); b++) {
+				TextureData& texture = data->textures[batch[b]];
+				std::vector<unsigned char>().swap(texture.levels);
+				// fenced by the upload, or never read; the ring recycles it on its own
+				if (texture.staged) {
+					StagingRing().Discard(texture.stagingOffset);
+				}
+				texture.staged = false;
+			}
+			return true;
+		}
+
+		if (*nextMesh < data->meshes.size()) {
+			const MeshData& mesh = data->meshes[*nextMesh];
+			(*nextMesh)++;
+
+			std::vector<gps::SubMesh> submeshes = mesh.submeshes;
+			for (size_t s = 0; s < submeshes.size(); s++) {
+				for (size_t t = 0; t < submeshes[s].textures.size(); t++) {
+					gps::Texture& texture = submeshes[s].textures[t];
+					gps::Texture loaded = LoadTexture(texture.path, texture.type);
+					texture.id = loaded.id;
+					texture.layer = loaded.layer;
+				}
+			}
+
+			meshes.push_back(gps::Mesh(mesh.VertexData(), mesh.VertexCount(), mesh.IndexData(), mesh.IndexCount(), submeshes, mesh.lodErrors,
+				compactVertices ? gps::VERTEX_FORMAT_COMPACT : gps::VERTEX_FORMAT_FULL));
+			return true;
+		}
+
+		return false;
+	}
+
+	// Collects the textures of a material, in ambient/diffuse/specular order
+	static std::vector<gps::Texture> MaterialTextures(const tinyobj::material_t& material, const std::string& basePath) {
+		std::vector<gps::Texture> textures;
+
+		//ambient texture
+		std::string ambientTexturePath = material.ambient_texname;
+		if (!ambientTexturePath.empty())
+		{
+			gps::Texture currentTexture;
+			currentTexture.id = 0;
+			currentTexture.layer = -1;
+			currentTexture.type = "ambientTexture";
+			currentTexture.path = basePath + ambientTexturePath;
+			textures.push_back(currentTexture);
+		}
+
+		//diffuse texture
+		std::string diffuseTexturePath = material.diffuse_texname;
+		if (!diffuseTexturePath.empty())
+		{
+			gps::Texture currentTexture;
+			currentTexture.id = 0;
+			currentTexture.layer = -1;
+			currentTexture.type = "diffuseTexture";
+			currentTexture.path = basePath + diffuseTexturePath;
+			textures.push_back(currentTexture);
+		}
+
+		//specular texture
+		std::string specularTexturePath = material.specular_texname;
+		if (!specularTexturePath.empty())
+		{
+			gps::Texture currentTexture;
+			currentTexture.id = 0;
+			currentTexture.layer = -1;
+			currentTexture.type = "specularTexture";
+			currentTexture.path = basePath + specularTexturePath;
+			textures.push_back(currentTexture);
+		}
+
+		return textures;
 	}
 
+	// Faces of the whole model that share one material
+	struct MaterialGroup {
+		int materialId;
+		std::vector<gps::Vertex> vertices;
+		std::vector<GLuint> indices;
+		// Maps each distinct index triple to its slot in `vertices`
+		std::unordered_map<tinyobj::index_t, GLuint, IndexTripleHash, IndexTripleEqual> uniqueVertices;
+	};
+
 	// Does the parsing of the .obj file and fills in the data structure
-	void Model3D::ReadOBJ(std::string fileName, std::string basePath){
+	bool Model3D::ReadOBJ(std::string fileName, std::string basePath, ModelData* data){
 
         std::cout << "Loading : " << fileName << std::endl;
 		tinyobj::attrib_t attrib;
 		std::vector<tinyobj::shape_t> shapes;
 		std::vector<tinyobj::material_t> materials;
-		int materialId;
 
 		std::string err;
-		bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), GL_TRUE);
+		bool ret = tinyobj::LoadObjParallel(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), GL_TRUE, 0,
+			&data->materialFiles);
 
 		if (!err.empty()) { // `err` may contain warning message.
 			std::cerr << err << std::endl;
 		}
 
 		if (!ret) {
-			exit(1);
+			std::cerr << "ERROR: could not load " << fileName << std::endl;
+			return false;
 		}
 
 		std::cout << "# of shapes    : " << shapes.size() << std::endl;
 		std::cout << "# of materials : " << materials.size() << std::endl;
 
+		// Faces are grouped by material across all shapes, in order of first use
+		std::vector<MaterialGroup> groups;
+		std::unordered_map<int, size_t> groupOfMaterial;
+		size_t cornerCount = 0;
+
 		// Loop over shapes
 		for (size_t s = 0; s < shapes.size(); s++) {
-			std::vector<gps::Vertex> vertices;
-			std::vector<GLuint> indices;
-			std::vector<gps::Texture> textures;
+			const tinyobj::mesh_t& mesh = shapes[s].mesh;
 
 			// Loop over faces(polygon)
 			size_t index_offset = 0;
-			for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
-				int fv = shapes[s].mesh.num_face_vertices[f];
+			for (size_t f = 0; f < mesh.num_face_vertices.size(); f++) {
+				int fv = mesh.num_face_vertices[f];
+
+				// get material id
+				// Only try to read materials if the .mtl file is present
+				int materialId = -1;
+				if (f < mesh.material_ids.size() && materials.size() > 0) {
+					materialId = mesh.material_ids[f];
+				}
 
-				//gps::Texture currentTexture = LoadTexture("index1.png", "ambientTexture");
-				//textures.push_back(currentTexture);
+				auto groupIt = groupOfMaterial.find(materialId);
+				if (groupIt == groupOfMaterial.end()) {
+					groupIt = groupOfMaterial.insert(std::make_pair(materialId, groups.size())).first;
+					groups.push_back(MaterialGroup());
+					groups.back().materialId = materialId;
+				}
+				MaterialGroup& group = groups[groupIt->second];
 
 				// Loop over vertices in the face.
 				for (size_t v = 0; v < fv; v++) {
 					// access to vertex
-					tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
+					tinyobj::index_t idx = mesh.indices[index_offset + v];
+
+					// reuse the vertex if this corner was already emitted
+					auto found = group.uniqueVertices.find(idx);
+					if (found != group.uniqueVertices.end()) {
+						group.indices.push_back(found->second);
+						continue;
+					}
 
 					float vx = attrib.vertices[3 * idx.vertex_index + 0];
 					float vy = attrib.vertices[3 * idx.vertex_index + 1];
@@ -84,150 +667,633 @@ namespace gps {
 					currentVertex.Normal = vertexNormal;
 					currentVertex.TexCoords = vertexTexCoords;
 
-					vertices.push_back(currentVertex);
+					GLuint newIndex = static_cast<GLuint>(group.vertices.size());
+					group.uniqueVertices[idx] = newIndex;
+					group.vertices.push_back(currentVertex);
 
-					indices.push_back(index_offset + v);
+					group.indices.push_back(newIndex);
 				}
 
+				cornerCount += fv;
 				index_offset += fv;
 			}
+		}
 
-			// get material id
-			// Only try to read materials if the .mtl file is present
-			int a = shapes[s].mesh.material_ids.size();
-			if (a > 0 && materials.size()>0) {
-				materialId = shapes[s].mesh.material_ids[0];
-				if (materialId != -1) {
-					gps::Material currentMaterial;
-					currentMaterial.ambient = glm::vec3(materials[materialId].ambient[0], materials[materialId].ambient[1], materials[materialId].ambient[2]);
-					currentMaterial.diffuse = glm::vec3(materials[materialId].diffuse[0], materials[materialId].diffuse[1], materials[materialId].diffuse[2]);
-					currentMaterial.specular = glm::vec3(materials[materialId].specular[0], materials[materialId].specular[1], materials[materialId].specular[2]);
-
-					//ambient texture
-					std::string ambientTexturePath = materials[materialId].ambient_texname;
-					if (!ambientTexturePath.empty())
-					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + ambientTexturePath, "ambientTexture");
-						textures.push_back(currentTexture);
-					}
+		// One shared vertex/index buffer, one range per material
+		data->meshes.push_back(gps::MeshData());
+		gps::MeshData& meshData = data->meshes.back();
+		for (size_t g = 0; g < groups.size(); g++) {
+			gps::SubMesh submesh;
+			submesh.firstIndex = static_cast<GLuint>(meshData.indices.size());
+			submesh.indexCount = static_cast<GLsizei>(groups[g].indices.size());
+			submesh.baseVertex = static_cast<GLint>(meshData.vertices.size());
+			submesh.vertexCount = static_cast<GLsizei>(groups[g].vertices.size());
+			submesh.uvDensity = 0.0f;
+			if (groups[g].materialId != -1) {
+				submesh.textures = MaterialTextures(materials[groups[g].materialId], basePath);
+			}
+			meshData.submeshes.push_back(submesh);
+
+			meshData.vertices.insert(meshData.vertices.end(), groups[g].vertices.begin(), groups[g].vertices.end());
+			meshData.indices.insert(meshData.indices.end(), groups[g].indices.begin(), groups[g].indices.end());
+		}
+
+		std::cout << "# of ranges    : " << meshData.submeshes.size() << std::endl;
+		std::cout << "# of vertices  : " << cornerCount << " -> " << meshData.vertices.size() << " (indexed)" << std::endl;
+		return true;
+	}
+
+	void Model3D::OptimizeMeshes(std::string fileName, ModelData* data) {
+
+		for (size_t m = 0; m < data->meshes.size(); m++) {
+			gps::MeshOptimizationStats stats = gps::OptimizeMesh(&data->meshes[m]);
+
+			std::cout << "Optimized : " << fileName << " mesh " << m << std::endl;
+			std::cout << "# ACMR         : " << stats.before.acmr << " -> " << stats.after.acmr << std::endl;
+			std::cout << "# ATVR         : " << stats.before.atvr << " -> " << stats.after.atvr << std::endl;
+			if (stats.degenerateTriangles > 0 || stats.unusedVertices > 0) {
+				std::cout << "# dropped      : " << stats.degenerateTriangles << " degenerate triangles, "
+					<< stats.unusedVertices << " unused vertices" << std::endl;
+			}
+		}
+	}
+
+	void Model3D::BuildClusters(std::string fileName, ModelData* data) {
+
+		for (size_t m = 0; m < data->meshes.size(); m++) {
+			gps::MeshData& mesh = data->meshes[m];
+			gps::BuildMeshClusters(&mesh, optimizeMeshes);
+
+			size_t clusterCount = 0;
+			for (size_t s = 0; s < mesh.submeshes.size(); s++) {
+				clusterCount += mesh.submeshes[s].clusters.size();
+			}
+			std::cout << "Clustered : " << fileName << " mesh " << m << std::endl;
+			std::cout << "# of clusters  : " << clusterCount << " (" << mesh.indices.size() / 3 / std::max<size_t>(clusterCount, 1)
+				<< " triangles each)" << std::endl;
+			// the order the full detail is drawn in from here on
+			gps::VertexCacheStats cache = gps::AnalyzeMeshVertexCache(mesh);
+			std::cout << "# ACMR         : " << cache.acmr << " (clustered)" << std::endl;
+			std::cout << "# ATVR         : " << cache.atvr << " (clustered)" << std::endl;
+		}
+	}
+
+	void Model3D::GenerateMeshLods(std::string fileName, ModelData* data) {
+
+		for (size_t m = 0; m < data->meshes.size(); m++) {
+			gps::MeshData& mesh = data->meshes[m];
+			gps::GenerateLods(&mesh);
 
-					//diffuse texture
-					std::string diffuseTexturePath = materials[materialId].diffuse_texname;
-					if (!diffuseTexturePath.empty())
-					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + diffuseTexturePath, "diffuseTexture");
-						textures.push_back(currentTexture);
+			std::cout << "Simplified : " << fileName << " mesh " << m << std::endl;
+			for (size_t l = 1; l < mesh.lodErrors.size(); l++) {
+				size_t indexCount = 0;
+				for (size_t s = 0; s < mesh.submeshes.size(); s++) {
+					if (l <= mesh.submeshes[s].lods.size()) {
+						indexCount += mesh.submeshes[s].lods[l - 1].indexCount;
 					}
+				}
+				std::cout << "# LOD " << l << "        : " << indexCount / 3 << " triangles, error " << mesh.lodErrors[l] << std::endl;
+			}
+		}
+	}
+
+	// Loads the model from its binary cache; the meshes point straight into the mapped file
+	bool Model3D::ReadCache(std::string fileName, uint32_t flags, ModelData* data) {
+
+		std::unique_ptr<gps::MeshCache> cache(new gps::MeshCache());
+		if (!cache->Open(MeshCache::CacheFileName(fileName), fileName, flags)) {
+			return false;
+		}
 
-					//specular texture
-					std::string specularTexturePath = materials[materialId].specular_texname;
-					if (!specularTexturePath.empty())
-					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + specularTexturePath, "specularTexture");
-						textures.push_back(currentTexture);
+		std::cout << "Loading : " << fileName << " (cached)" << std::endl;
+
+		const gps::MeshCacheHeader& header = cache->Header();
+		for (uint32_t m = 0; m < header.meshCount; m++) {
+			const gps::MeshCacheMesh& cachedMesh = cache->Mesh(m);
+
+			gps::MeshData mesh;
+			for (uint32_t r = cachedMesh.firstRange; r < cachedMesh.firstRange + cachedMesh.rangeCount; r++) {
+				const gps::MeshCacheRange& range = cache->Range(r);
+				const gps::MeshCacheMaterial& material = cache->Material(range.material);
+
+				gps::SubMesh submesh;
+				submesh.firstIndex = range.firstIndex;
+				submesh.indexCount = static_cast<GLsizei>(range.indexCount);
+				submesh.baseVertex = static_cast<GLint>(range.baseVertex);
+				submesh.vertexCount = static_cast<GLsizei>(range.vertexCount);
+				submesh.uvDensity = 0.0f;
+				for (uint32_t l = 0; l < range.lodCount && l < MAX_LOD_LEVELS - 1; l++) {
+					gps::LodRange lod;
+					lod.firstIndex = range.lodFirstIndex[l];
+					lod.indexCount = static_cast<GLsizei>(range.lodIndexCount[l]);
+					lod.error = range.lodErrors[l];
+					submesh.lods.push_back(lod);
+				}
+				for (uint32_t c = range.firstCluster; c < range.firstCluster + range.clusterCount; c++) {
+					const gps::MeshCacheCluster& cachedCluster = cache->Cluster(c);
+					gps::Cluster cluster;
+					cluster.firstIndex = cachedCluster.firstIndex;
+					cluster.indexCount = static_cast<GLsizei>(cachedCluster.indexCount);
+					cluster.center = glm::vec3(cachedCluster.center[0], cachedCluster.center[1], cachedCluster.center[2]);
+					cluster.radius = cachedCluster.radius;
+					cluster.boundsMin = glm::vec3(cachedCluster.boundsMin[0], cachedCluster.boundsMin[1], cachedCluster.boundsMin[2]);
+					cluster.boundsMax = glm::vec3(cachedCluster.boundsMax[0], cachedCluster.boundsMax[1], cachedCluster.boundsMax[2]);
+					cluster.coneApex = glm::vec3(cachedCluster.coneApex[0], cachedCluster.coneApex[1], cachedCluster.coneApex[2]);
+					cluster.coneAxis = glm::vec3(cachedCluster.coneAxis[0], cachedCluster.coneAxis[1], cachedCluster.coneAxis[2]);
+					cluster.coneCutoff = cachedCluster.coneCutoff;
+					for (uint32_t l = 0; l < cachedCluster.lodCount && l < MAX_LOD_LEVELS - 1; l++) {
+						gps::LodRange lod;
+						lod.firstIndex = cachedCluster.lodFirstIndex[l];
+						lod.indexCount = static_cast<GLsizei>(cachedCluster.lodIndexCount[l]);
+						lod.error = cachedCluster.lodErrors[l];
+						cluster.lods.push_back(lod);
 					}
+					submesh.clusters.push_back(cluster);
+				}
+				for (uint32_t t = 0; t < material.textureCount; t++) {
+					gps::Texture currentTexture;
+					currentTexture.id = 0;
+					currentTexture.layer = -1;
+					currentTexture.type = cache->TextureType(material.textures[t]);
+					currentTexture.path = cache->TexturePath(material.textures[t]);
+					submesh.textures.push_back(currentTexture);
 				}
+				mesh.submeshes.push_back(submesh);
 			}
 
-			meshes.push_back(gps::Mesh(vertices, indices, textures));
+			mesh.lodErrors.assign(cachedMesh.lodErrors, cachedMesh.lodErrors + std::min<uint32_t>(cachedMesh.lodCount, MAX_LOD_LEVELS));
+			mesh.mappedVertices = cache->Vertices() + cachedMesh.firstVertex;
+			mesh.mappedVertexCount = cachedMesh.vertexCount;
+			mesh.mappedIndices = cache->Indices() + cachedMesh.firstIndex;
+			mesh.mappedIndexCount = cachedMesh.indexCount;
+			data->meshes.push_back(mesh);
 		}
+
+		std::cout << "# of vertices  : " << header.vertexCount << " (indexed)" << std::endl;
+		data->cache = std::move(cache);
+		return true;
 	}
 
-	// Retrieves a texture associated with the object - by its name and type
-	gps::Texture Model3D::LoadTexture(std::string path, std::string type) {
+	// Sums the object-space and UV areas of each range's full-detail triangles
+	void Model3D::MeasureUvDensity(ModelData* data) {
+		for (size_t m = 0; m < data->meshes.size(); m++) {
+			gps::MeshData& mesh = data->meshes[m];
+			const gps::Vertex* vertices = mesh.VertexData();
+			const GLuint* indices = mesh.IndexData();
 
-			for (int i = 0; i < loadedTextures.size(); i++) {
-				if (loadedTextures[i].path == path)
-				{
-					//already loaded texture
-					return loadedTextures[i];
+			for (size_t s = 0; s < mesh.submeshes.size(); s++) {
+				gps::SubMesh& submesh = mesh.submeshes[s];
+				const gps::Vertex* base = vertices + submesh.baseVertex;
+				double area = 0.0;
+				double uvArea = 0.0;
+				for (GLsizei i = 0; i + 2 < submesh.indexCount; i += 3) {
+					const gps::Vertex& a = base[indices[submesh.firstIndex + i]];
+					const gps::Vertex& b = base[indices[submesh.firstIndex + i + 1]];
+					const gps::Vertex& c = base[indices[submesh.firstIndex + i + 2]];
+					area += glm::length(glm::cross(b.Position - a.Position, c.Position - a.Position));
+					glm::vec2 uvAB = b.TexCoords - a.TexCoords;
+					glm::vec2 uvAC = c.TexCoords - a.TexCoords;
+					uvArea += std::fabs(uvAB.x * uvAC.y - uvAB.y * uvAC.x);
 				}
+				submesh.uvDensity = area > 0.0 ? static_cast<float>(std::sqrt(uvArea / area)) : 0.0f;
 			}
+		}
+	}
 
-			gps::Texture currentTexture;
-			currentTexture.id = ReadTextureFromFile(path.c_str());
-			currentTexture.type = std::string(type);
-			currentTexture.path = path;
+	// Decodes every texture referenced by the meshes, all of them at once on the decoder pool
+	void Model3D::DecodeTextures(ModelData* data) {
+
+		// textures another model already uploaded are picked up from the registry at upload time
+		std::vector<std::string> paths;
+		std::unordered_set<std::string> seen;
+		size_t shared = 0;
+		for (size_t m = 0; m < data->meshes.size(); m++) {
+			for (size_t s = 0; s < data->meshes[m].submeshes.size(); s++) {
+				for (size_t t = 0; t < data->meshes[m].submeshes[s].textures.size(); t++) {
+					const std::string& path = data->meshes[m].submeshes[s].textures[t].path;
+					std::string key = TextureRegistry::NormalizePath(path);
+					if (!seen.insert(key).second) {
+						continue;
+					}
+					if (TextureRegistry::Instance().Contains(key)) {
+						shared++;
+						continue;
+					}
+					paths.push_back(path);
+				}
+			}
+		}
+
+		// slots are filled in place, so the upload order stays the material order
+		size_t first = data->textures.size();
+		size_t batchesBefore = data->textureBatches.size();
+		data->textures.resize(first + paths.size());
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		gps::TaskGroup decodes;
+		for (size_t i = 0; i < paths.size(); i++) {
+			gps::TextureData* texture = &data->textures[first + i];
+			std::string path = paths[i];
+			decodes.Run(DecoderPool(), [texture, path]() {
+				DecodeTextureFile(path.c_str(), texture);
+			});
+		}
+		decodes.Wait();
+
+		BatchTextures(data, first);
+
+		if (!paths.empty() || shared > 0) {
+			std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+			std::cout << "# of textures  : " << paths.size() << " (decoded in " << elapsed.count() << " ms), " << shared << " shared, " <<
+				(data->textureBatches.size() - batchesBefore) << " uploads" << std::endl;
+		}
+	}
+
+	// Textures can share an array when every level has the same size and format
+	static bool SameLayout(const TextureData& a, const TextureData& b) {
+		if (a.compressedFormat != b.compressedFormat || a.width != b.width || a.height != b.height || a.mips.size() != b.mips.size())
+			return false;
+		for (size_t level = 0; level < a.mips.size(); level++) {
+			if (a.mips[level].size != b.mips[level].size)
+				return false;
+		}
+		return true;
+	}
+
+	// Groups same-layout textures in material order; a group of one stays a plain 2D texture
+	void Model3D::BatchTextures(ModelData* data, size_t first) {
+		std::vector<std::vector<size_t> > groups;
+		for (size_t i = first; i < data->textures.size(); i++) {
+			const TextureData& texture = data->textures[i];
+			bool decoded = texture.staged || !texture.levels.empty();
+			size_t g = 0;
+			if (packTextures && decoded) {
+				while (g < groups.size() && (groups[g].size() >= MAX_ARRAY_LAYERS || !SameLayout(data->textures[groups[g][0]], texture)))
+					g++;
+			}
+			else {
+				g = groups.size();
+			}
+			if (g == groups.size())
+				groups.push_back(std::vector<size_t>());
+			groups[g].push_back(i);
+		}
+		data->textureBatches.insert(data->textureBatches.end(), groups.begin(), groups.end());
+	}
 
-			loadedTextures.push_back(currentTexture);
+	// Retrieves a texture associated with the object - by its name and type
+	gps::Texture Model3D::LoadTexture(std::string path, std::string type) {
+		gps::Texture currentTexture;
+		currentTexture.layer = -1;
+		currentTexture.type = type;
+		currentTexture.path = path;
 
+		std::string key = TextureRegistry::NormalizePath(path);
+		std::unordered_map<std::string, LoadedTexture>::const_iterator owned = loadedTextures.find(key);
+		if (owned != loadedTextures.end()) {
+			//already loaded texture
+			currentTexture.id = owned->second.id;
+			currentTexture.layer = owned->second.layer;
 			return currentTexture;
 		}
 
+		// loaded by another model, or read now
+		LoadedTexture loaded;
+		loaded.layer = -1;
+		loaded.id = TextureRegistry::Instance().Acquire(key, &loaded.layer);
+		if (loaded.id == 0) {
+			GLuint id = ReadTextureFromFile(path.c_str());
+			if (id != 0) {
+				loaded = AddTexture(key, id, -1);
+			}
+		}
+		if (loaded.id != 0) {
+			loadedTextures[key] = loaded;
+		}
+
+		currentTexture.id = loaded.id;
+		currentTexture.layer = loaded.layer;
+		return currentTexture;
+	}
+
+	// Registers a fresh upload; when another model registered the same texture first, the copy is dropped
+	Model3D::LoadedTexture Model3D::AddTexture(const std::string& key, GLuint id, GLint layer) {
+		LoadedTexture registered;
+		registered.id = TextureRegistry::Instance().Add(key, id, layer, &registered.layer);
+		// an array stays alive for its other layers
+		if (registered.id != id && layer < 0) {
+			TextureStreamer::Instance().Remove(id);
+		}
+		return registered;
+	}
+
 	// Reads the pixel data from an image file and loads it into the video memory
 	GLuint Model3D::ReadTextureFromFile(const char* file_name) {
+		gps::TextureData texture;
+		DecodeTextureFile(file_name, &texture);
+		return UploadTexture(texture);
+	}
+
+	void Model3D::InitTextureUploads() {
+		static bool attempted = false;
+		if (attempted) {
+			return;
+		}
+		attempted = true;
+
+		if (!StagingRing().Create(STAGING_RING_SIZE)) {
+			std::cout << "Texture staging ring unavailable (needs GL 4.4 or ARB_buffer_storage), decoding into the heap" << std::endl;
+		}
+		if (!IsCompressedFormatSupported(GL_COMPRESSED_SRGB_S3TC_DXT1_EXT)) {
+			std::cout << "sRGB S3TC textures unsupported, uploading images uncompressed" << std::endl;
+			transcodeTextures = false;
+		}
+	}
+
+	// Reads the pixel data of an image file with the rows flipped for GL - safe to call from any thread.
+	// The mip chain is filtered on the encoder pool, and the flip is folded into the one copy of each
+	// level into the staging ring, or into the heap when the ring is full (or unavailable).
+	// DDS and KTX files are recognised by their signature and keep their compressed blocks.
+	bool Model3D::DecodeTextureFile(const char* file_name, TextureData* texture) {
+		texture->path = file_name;
+		texture->width = 0;
+		texture->height = 0;
+		texture->staged = false;
+		texture->stagingOffset = 0;
+		texture->compressedFormat = 0;
+		texture->mips.clear();
+		texture->levels.clear();
+
+		std::ifstream file(file_name, std::ios::binary);
+		if (!file) {
+			fprintf(stderr, "ERROR: could not load %s\n", file_name);
+			return false;
+		}
+		std::vector<unsigned char> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		file.close();
+
+		if (IsCompressedTextureFile(contents.data(), contents.size())) {
+			return ReadCompressedTexture(contents, texture);
+		}
+
+		// a cache hit skips the image decode, the flip and the mip filtering altogether
+		bool transcode = transcodeTextures;
+		uint64_t hash = 0;
+		if (transcode) {
+			hash = TextureCache::HashContents(contents.data(), contents.size());
+			std::vector<unsigned char> cached;
+			if (TextureCache::Shared().Read(hash, &cached) && ReadCompressedTexture(cached, texture)) {
+				return true;
+			}
+		}
+
 		int x, y, n;
 		int force_channels = 4;
-		unsigned char* image_data = stbi_load(file_name, &x, &y, &n, force_channels);
+		unsigned char* image_data = stbi_load_from_memory(contents.data(), static_cast<int>(contents.size()), &x, &y, &n, force_channels);
 		if (!image_data) {
 			fprintf(stderr, "ERROR: could not load %s\n", file_name);
 			return false;
 		}
 		// NPOT check
-		if ((x & (x - 1)) != 0 || (y & (y - 1)) != 0) {
+		bool powerOfTwo = (x & (x - 1)) == 0 && (y & (y - 1)) == 0;
+		if (!powerOfTwo) {
 			fprintf(
 				stderr, "WARNING: texture %s is not power-of-2 dimensions\n", file_name
 			);
 		}
 
-		int width_in_bytes = x * 4;
-		unsigned char *top = NULL;
-		unsigned char *bottom = NULL;
-		unsigned char temp = 0;
-		int half_height = y / 2;
+		// NPOT levels cannot be flipped block by block, so those stay RGBA8
+		if (transcode && powerOfTwo) {
+			std::vector<unsigned char> dds = TranscodeToDds(image_data, x, y, EncoderPool());
+			stbi_image_free(image_data);
+			TextureCache::Shared().Write(hash, dds);
+			return ReadCompressedTexture(dds, texture);
+		}
+
+		// the chain is filtered from the unflipped image; each level is flipped on its one copy out
+		std::vector<std::vector<unsigned char> > chain;
+		BuildMipChain(image_data, x, y, true, &chain, EncoderPool());
+
+		size_t levelsSize = 0;
+		for (size_t level = 0; level <= chain.size(); level++) {
+			gps::CompressedMip mip;
+			mip.width = std::max(1, x >> level);
+			mip.height = std::max(1, y >> level);
+			mip.fileOffset = 0;
+			mip.offset = levelsSize;
+			mip.size = static_cast<size_t>(mip.width) * mip.height * 4;
+			texture->mips.push_back(mip);
+			levelsSize += mip.size;
+		}
 
-		for (int row = 0; row < half_height; row++) {
-			top = image_data + row * width_in_bytes;
-			bottom = image_data + (y - row - 1) * width_in_bytes;
-			for (int col = 0; col < width_in_bytes; col++) {
-				temp = *top;
-				*top = *bottom;
-				*bottom = temp;
-				top++;
-				bottom++;
+		unsigned char* levels = NULL;
+		if (StagingRing().Allocate(levelsSize, &texture->stagingOffset, &levels)) {
+			texture->staged = true;
+		}
+		else {
+			texture->levels.resize(levelsSize);
+			levels = texture->levels.data();
+		}
+		for (size_t level = 0; level < texture->mips.size(); level++) {
+			const gps::CompressedMip& mip = texture->mips[level];
+			const unsigned char* source = level == 0 ? image_data : chain[level - 1].data();
+			size_t width_in_bytes = static_cast<size_t>(mip.width) * 4;
+			for (int row = 0; row < mip.height; row++) {
+				memcpy(levels + mip.offset + row * width_in_bytes, source + (mip.height - row - 1) * width_in_bytes, width_in_bytes);
 			}
 		}
+		stbi_image_free(image_data);
+
+		texture->width = x;
+		texture->height = y;
+		return true;
+	}
+
+	// Packs the mip chain straight into the staging ring, or into the heap when the ring is full
+	bool Model3D::ReadCompressedTexture(const std::vector<unsigned char>& file, TextureData* texture) {
+		const char* file_name = texture->path.c_str();
+		gps::CompressedTexture compressed;
+		if (!ParseCompressedTexture(file.data(), file.size(), file_name, &compressed)) {
+			return false;
+		}
+		if (compressed.faces != 1) {
+			fprintf(stderr, "ERROR: %s is a cube map, not a 2D texture\n", file_name);
+			return false;
+		}
+
+		// streamed textures keep their levels in system memory, so they skip the ring
+		unsigned char* staging = NULL;
+		if (!streamTextures && StagingRing().Allocate(compressed.dataSize, &texture->stagingOffset, &staging)) {
+			CopyCompressedMips(file.data(), compressed, staging);
+			texture->staged = true;
+		}
+		else {
+			texture->levels.resize(compressed.dataSize);
+			CopyCompressedMips(file.data(), compressed, texture->levels.data());
+		}
+
+		texture->compressedFormat = compressed.internalFormat;
+		texture->mips = compressed.mips;
+		texture->width = compressed.width;
+		texture->height = compressed.height;
+		return true;
+	}
+
+	// Loads decoded pixel data into the video memory, every level explicitly: RGBA8 chains
+	// into immutable storage, compressed textures as they come or streamed from their tail
+	GLuint Model3D::UploadTexture(TextureData& texture) {
+		if (!texture.staged && texture.levels.empty()) {
+			return 0;
+		}
+		if (texture.compressedFormat != 0 && !IsCompressedFormatSupported(texture.compressedFormat)) {
+			fprintf(stderr, "ERROR: texture %s uses a compressed format this driver lacks\n", texture.path.c_str());
+			return 0;
+		}
+		if (texture.compressedFormat != 0 && !texture.staged && streamTextures) {
+			std::vector<std::vector<unsigned char> > layers(1);
+			layers[0].swap(texture.levels);
+			return TextureStreamer::Instance().Create(texture.compressedFormat, texture.mips, layers);
+		}
+
+		// staged levels are read from the unpack buffer at their offset
+		const unsigned char* levels = texture.levels.data();
+		if (texture.staged) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, StagingRing().Buffer());
+			levels = reinterpret_cast<const unsigned char*>(texture.stagingOffset);
+		}
 
 		GLuint textureID;
 		glGenTextures(1, &textureID);
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(
-			GL_TEXTURE_2D,
-			0,
-			GL_SRGB, //GL_SRGB,//GL_RGBA,
-			x,
-			y,
-			0,
-			GL_RGBA,
-			GL_UNSIGNED_BYTE,
-			image_data
-		);
-		glGenerateMipmap(GL_TEXTURE_2D);
+		GLState::Instance().BindTexture(GL_TEXTURE_2D, textureID);
+		GLsizei levelCount = static_cast<GLsizei>(texture.mips.size());
+		bool immutable = texture.compressedFormat == 0 && HasTextureStorage();
+		if (immutable) {
+			glTexStorage2D(GL_TEXTURE_2D, levelCount, GL_SRGB8_ALPHA8, texture.width, texture.height);
+		}
+		for (GLsizei level = 0; level < levelCount; level++) {
+			const gps::CompressedMip& mip = texture.mips[level];
+			if (texture.compressedFormat != 0) {
+				glCompressedTexImage2D(GL_TEXTURE_2D, level, texture.compressedFormat, mip.width, mip.height, 0,
+					static_cast<GLsizei>(mip.size), levels + mip.offset);
+			}
+			else if (immutable) {
+				glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, mip.width, mip.height, GL_RGBA, GL_UNSIGNED_BYTE, levels + mip.offset);
+			}
+			else {
+				glTexImage2D(GL_TEXTURE_2D, level, GL_SRGB8_ALPHA8, mip.width, mip.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, levels + mip.offset);
+			}
+		}
+		// files without a full chain stay complete at the levels they have
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+
+		if (texture.staged) {
+			StagingRing().Fence(texture.stagingOffset);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glBindTexture(GL_TEXTURE_2D, 0);
+		GLState::Instance().BindTexture(GL_TEXTURE_2D, 0);
+
+		return textureID;
+	}
+
+	// Allocates every level for all layers, then fills the layers level by level from the ring or the heap
+	GLuint Model3D::UploadTextureArray(const std::vector<TextureData*>& layers) {
+		const TextureData& first = *layers[0];
+		GLsizei layerCount = static_cast<GLsizei>(layers.size());
+		if (first.compressedFormat != 0 && !IsCompressedFormatSupported(first.compressedFormat)) {
+			fprintf(stderr, "ERROR: texture %s uses a compressed format this driver lacks\n", first.path.c_str());
+			return 0;
+		}
+		// streaming keeps compressed textures out of the ring, so all layers are in the heap
+		if (first.compressedFormat != 0 && streamTextures) {
+			std::vector<std::vector<unsigned char> > data(layers.size());
+			for (size_t l = 0; l < layers.size(); l++) {
+				data[l].swap(layers[l]->levels);
+			}
+			return TextureStreamer::Instance().Create(first.compressedFormat, first.mips, data);
+		}
+
+		GLuint textureID;
+		glGenTextures(1, &textureID);
+		GLState::Instance().BindTexture(GL_TEXTURE_2D_ARRAY, textureID);
+		GLsizei levelCount = static_cast<GLsizei>(first.mips.size());
+		if (first.compressedFormat == 0 && HasTextureStorage()) {
+			glTexStorage3D(GL_TEXTURE_2D_ARRAY, levelCount, GL_SRGB8_ALPHA8, first.width, first.height, layerCount);
+		}
+		else {
+			for (GLsizei level = 0; level < levelCount; level++) {
+				const gps::CompressedMip& mip = first.mips[level];
+				if (first.compressedFormat != 0) {
+					glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, first.compressedFormat, mip.width, mip.height,
+						layerCount, 0, static_cast<GLsizei>(mip.size * layers.size()), NULL);
+				}
+				else {
+					glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_SRGB8_ALPHA8, mip.width, mip.height, layerCount, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+				}
+			}
+		}
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+
+		for (GLsizei l = 0; l < layerCount; l++) {
+			const TextureData& texture = *layers[l];
+			// staged levels are read from the unpack buffer at their offset
+			const unsigned char* levels = texture.levels.data();
+			if (texture.staged) {
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, StagingRing().Buffer());
+				levels = reinterpret_cast<const unsigned char*>(texture.stagingOffset);
+			}
+			else {
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			}
+
+			for (GLsizei level = 0; level < levelCount; level++) {
+				const gps::CompressedMip& mip = texture.mips[level];
+				if (texture.compressedFormat != 0) {
+					glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, l, mip.width, mip.height, 1,
+						texture.compressedFormat, static_cast<GLsizei>(mip.size), levels + mip.offset);
+				}
+				else {
+					glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, l, mip.width, mip.height, 1, GL_RGBA, GL_UNSIGNED_BYTE, levels + mip.offset);
+				}
+			}
+
+			if (texture.staged) {
+				StagingRing().Fence(texture.stagingOffset);
+			}
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		GLState::Instance().BindTexture(GL_TEXTURE_2D_ARRAY, 0);
 
 		return textureID;
 	}
 
 	Model3D::~Model3D() {
-        for (size_t i = 0; i < loadedTextures.size(); i++) {
-            glDeleteTextures(1, &loadedTextures.at(i).id);
+        for (size_t i = 0; i < pendingModels.size(); i++) {
+            if (pendingModels[i] == this) {
+                pendingModels.erase(pendingModels.begin() + i);
+                break;
+            }
+        }
+
+        // the last model using a texture deletes it
+        for (std::unordered_map<std::string, LoadedTexture>::const_iterator it = loadedTextures.begin(); it != loadedTextures.end(); ++it) {
+            if (TextureRegistry::Instance().Release(it->first)) {
+                TextureStreamer::Instance().Remove(it->second.id);
+            }
         }
 
+        // the geometry pool reuses the space for later meshes
         for (size_t i = 0; i < meshes.size(); i++) {
-            GLuint VBO = meshes.at(i).getBuffers().VBO;
-            GLuint EBO = meshes.at(i).getBuffers().EBO;
-            GLuint VAO = meshes.at(i).getBuffers().VAO;
-            glDeleteBuffers(1, &VBO);
-            glDeleteBuffers(1, &EBO);
-            glDeleteVertexArrays(1, &VAO);
+            meshes[i].Release();
         }
 	}
 }
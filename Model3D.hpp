@@ -1,43 +1,257 @@
 #ifndef Model3D_hpp
 #define Model3D_hpp
 
+#include "CompressedTexture.hpp"
 #include "Mesh.hpp"
+#include "MeshCache.hpp"
 
 #include "tiny_obj_loader.h"
 #include "stb_image.h"
 
+#include <atomic>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace gps {
 
+    // A decoded texture waiting for upload: every level, already flipped for
+    // GL, packed back to back either in the staging ring (staged) or in
+    // `levels`. Images carry the RGBA8 mip chain built on the CPU; DDS/KTX
+    // files keep their compressed blocks.
+    struct TextureData
+    {
+        std::string path;
+        int width;
+        int height;
+        bool staged;
+        size_t stagingOffset;
+        // 0 for RGBA8 levels
+        GLenum compressedFormat;
+        std::vector<gps::CompressedMip> mips;
+        std::vector<unsigned char> levels;
+    };
+
+    // Everything a model needs before touching the GL context. Built on a
+    // worker thread by LoadModelAsync, or inline by LoadModel.
+    struct ModelData
+    {
+        std::vector<gps::MeshData> meshes;
+        std::vector<gps::TextureData> textures;
+        // indices into textures uploaded together: the layers of one texture
+        // array, or a single texture
+        std::vector<std::vector<size_t> > textureBatches;
+        // .mtl files the .obj names, stamped into its mesh cache
+        std::vector<std::string> materialFiles;
+        // keeps the mapped pages behind cached meshes alive until upload
+        std::unique_ptr<gps::MeshCache> cache;
+
+        ModelData() {}
+        ~ModelData();
+
+    private:
+        ModelData(const ModelData&);
+        ModelData& operator=(const ModelData&);
+    };
+
     class Model3D
     {
 
     public:
+        Model3D();
         ~Model3D();
 
 		void LoadModel(std::string fileName);
 
 		void LoadModel(std::string fileName, std::string basePath);
 
+		// Parses and decodes on a worker thread; the GL upload happens in ProcessPendingUploads
+		void LoadModelAsync(std::string fileName);
+
+		void LoadModelAsync(std::string fileName, std::string basePath);
+
+		// Drawn instead of this model until it is resident
+		void SetPlaceholder(Model3D* placeholder);
+
+		bool IsResident() const;
+
+		// Draws every mesh at full detail without asking the texture streamer for
+		// anything, so depth-only passes don't pin textures at full resolution
 		void Draw(gps::Shader shaderProgram);
 
+		// Draws each mesh at the coarsest detail level whose error stays under the
+		// pixel threshold, given where `modelMatrix` puts it in front of the LOD camera.
+		// Clustered meshes choose the level cluster by cluster, so the far side of a
+		// large model the camera stands in still gets coarser.
+		void Draw(gps::Shader shaderProgram, const glm::mat4& modelMatrix);
+
+		// Draws every instance of `instances` with one instanced draw per range. The
+		// detail level and culling go by the sphere around all of them, so instances
+		// should be grouped by area, e.g. one buffer per patch of vegetation.
+		void DrawInstanced(gps::Shader shaderProgram, const InstanceBuffer& instances);
+
+		// Uploads finished background loads on the GL thread until the budget is spent
+		static void ProcessPendingUploads(double budgetSeconds);
+
+		// GL thread, before the context goes away: waits for background loads still
+		// running, drops what they loaded and releases the texture staging ring
+		static void Shutdown();
+
+		// Enables the vertex cache/overdraw/fetch optimization of freshly parsed meshes (on by default)
+		static void SetMeshOptimization(bool enabled);
+
+		// Uploads meshes in the quantized 16-byte vertex format where they allow it (on by default)
+		static void SetCompactVertices(bool enabled);
+
+		// Generates and caches simplified detail levels of freshly parsed meshes (on by default)
+		static void SetLodGeneration(bool enabled);
+
+		// Splits freshly parsed meshes into clusters that are culled one by one (on by default)
+		static void SetClusterGeneration(bool enabled);
+
+		// Packs the same-size, same-format textures of a model into texture arrays (on by default)
+		static void SetTexturePacking(bool enabled);
+
+		// Transcodes JPG/PNG textures to BC1 with mipmaps once, through the on-disk texture cache (on by default)
+		static void SetTextureTranscoding(bool enabled);
+
+		// Keeps only the mip levels compressed textures are sampled at in VRAM (on by default)
+		static void SetTextureStreaming(bool enabled);
+
+		// VRAM allowed for streamed mip levels before the least recently used ones are evicted
+		static void SetTextureBudget(size_t bytes);
+
+		// Streams in the levels the frame's draws asked for until the budget is spent; call after drawing
+		static void StreamTextures(double budgetSeconds);
+
+		// View the following Draw(shader, model) calls cull clusters against; backface
+		// culling of clusters needs the eye of a perspective view
+		static void SetCullingView(const glm::mat4& view, const glm::mat4& projection, bool cullBackfaces);
+
+		// Queue the following Draw(shader, model) and DrawInstanced calls push their ranges onto,
+		// in place of drawing them and of the caller setting the model matrix; NULL draws again
+		static void SetRenderQueue(RenderQueue* queue);
+
+		// Camera used to pick detail levels for the frame
+		static void SetLodCamera(const glm::mat4& view, const glm::mat4& projection, int viewportHeight);
+
+		// Each step of +1 doubles the screen-space error allowed before switching to a coarser level
+		static void SetLodBias(float bias);
+
     private:
 		// Component meshes - group of objects
         std::vector<gps::Mesh> meshes;
-		// Associated textures
-        std::vector<gps::Texture> loadedTextures;
+		struct LoadedTexture
+		{
+			GLuint id;
+			GLint layer;
+		};
+
+		// Textures this model holds a registry reference to, by normalized path
+        std::unordered_map<std::string, LoadedTexture> loadedTextures;
+
+		// State of a background load, shared with the worker thread
+		struct AsyncLoad
+		{
+			std::unique_ptr<ModelData> data;
+			std::atomic<bool> ready;
+			// set before ready when the file could not be read; data is NULL then
+			std::atomic<bool> failed;
+			// next texture batch and mesh to upload
+			size_t nextTexture;
+			size_t nextMesh;
+		};
+
+		std::shared_ptr<AsyncLoad> asyncLoad;
+		Model3D* placeholder;
+		bool resident;
+
+		// Models with a background load in flight, in submission order
+		static std::vector<Model3D*> pendingModels;
+
+		// Read by the loader threads
+		static std::atomic<bool> optimizeMeshes;
+		static std::atomic<bool> generateLods;
+		static std::atomic<bool> generateClusters;
+		static std::atomic<bool> packTextures;
+		static std::atomic<bool> transcodeTextures;
+		static std::atomic<bool> streamTextures;
+		// Read on the GL thread only
+		static bool compactVertices;
+		static glm::vec3 lodEye;
+		// pixels per unit of error at distance 1
+		static float lodProjectionScale;
+		static float lodBias;
+		static bool cullingEnabled;
+		static glm::mat4 cullingViewProjection;
+		static glm::vec3 cullingEye;
+		static bool cullingBackfaces;
+		static RenderQueue* renderQueue;
+
+		// Produces the CPU-side model data from the cache or the .obj file - no GL calls; NULL if
+		// the file can't be read
+		static std::unique_ptr<ModelData> ReadModelData(std::string fileName, std::string basePath);
+
+		// Does the parsing of the .obj file and fills in the data structure; false if it can't be read
+		static bool ReadOBJ(std::string fileName, std::string basePath, ModelData* data);
+
+		// Fills in the data structure from the binary mesh cache, if it is up to date
+		static bool ReadCache(std::string fileName, uint32_t flags, ModelData* data);
+
+		// Reorders the index and vertex buffers of parsed meshes and reports the cache efficiency
+		static void OptimizeMeshes(std::string fileName, ModelData* data);
 
-		// Does the parsing of the .obj file and fills in the data structure
-		void ReadOBJ(std::string fileName, std::string basePath);
+		// Reorders the full-detail triangles of parsed meshes into clusters and reports their count
+		static void BuildClusters(std::string fileName, ModelData* data);
 
-		// Retrieves a texture associated with the object - by its name and type
+		// Appends the simplified detail levels of parsed meshes and reports their size
+		static void GenerateMeshLods(std::string fileName, ModelData* data);
+
+		// Estimates the UV density of every range, for picking the texture levels it needs
+		static void MeasureUvDensity(ModelData* data);
+
+		// Decodes every texture referenced by the meshes that is not resident already
+		static void DecodeTextures(ModelData* data);
+
+		// Groups the decoded textures from `first` on into upload batches, one per texture array
+		static void BatchTextures(ModelData* data, size_t first);
+
+		// Reports the texture levels the ranges of `mesh` need, at `uvScale` object units per pixel
+		static void RequestTextures(const gps::Mesh& mesh, float uvScale);
+
+		// Coarsest detail level of `mesh` within the pixel threshold `distance` away at `scale`
+		static int SelectLod(const gps::Mesh& mesh, float scale, float distance);
+
+		// Uploads one texture batch or mesh; returns false once everything is uploaded
+		bool UploadStep(ModelData* data, size_t* nextTexture, size_t* nextMesh);
+
+		// Retrieves a texture associated with the object - by its name and type - from
+		// the shared registry, reading it from the file only when no model has it yet
 		gps::Texture LoadTexture(std::string path, std::string type);
 
+		// Registers a texture, or one layer of a texture array, this model uploaded and returns the one to use
+		static LoadedTexture AddTexture(const std::string& key, GLuint id, GLint layer);
+
 		// Reads the pixel data from an image file and loads it into the video memory
 		GLuint ReadTextureFromFile(const char* file_name);
+
+		// Reads the pixel data and mip chain of an image file, flipped for GL, into the staging ring
+		// or the heap; transcodes it to BC1 through the texture cache when that is enabled
+		static bool DecodeTextureFile(const char* file_name, TextureData* texture);
+
+		// Copies the blocks of a DDS/KTX file already in memory, without decoding them
+		static bool ReadCompressedTexture(const std::vector<unsigned char>& file, TextureData* texture);
+
+		// Creates the staging ring and checks the compressed formats on first use, from the GL thread
+		static void InitTextureUploads();
+
+		// Loads decoded pixel data into the video memory; streamed textures take over the level data
+		static GLuint UploadTexture(TextureData& texture);
+
+		// Loads textures of the same size and format into the layers of one GL_TEXTURE_2D_ARRAY
+		static GLuint UploadTextureArray(const std::vector<TextureData*>& layers);
     };
 }
 
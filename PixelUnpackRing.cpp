@@ -0,0 +1,173 @@
+#include "PixelUnpackRing.hpp"
+
+namespace gps {
+
+    // Region starts stay aligned for fast row copies and unpacking
+    static const size_t REGION_ALIGNMENT = 256;
+
+    static size_t AlignSize(size_t size)
+    {
+        return (size + REGION_ALIGNMENT - 1) & ~(REGION_ALIGNMENT - 1);
+    }
+
+    PixelUnpackRing::PixelUnpackRing()
+        : buffer(0), data(NULL), capacity(0)
+    {
+    }
+
+    bool PixelUnpackRing::Create(size_t size)
+    {
+        if (buffer != 0) {
+            return true;
+        }
+        if (!GLEW_VERSION_4_4 && !GLEW_ARB_buffer_storage) {
+            return false;
+        }
+
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(size), NULL, flags);
+        void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, static_cast<GLsizeiptr>(size), flags);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        if (mapped == NULL) {
+            glDeleteBuffers(1, &buffer);
+            buffer = 0;
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        data = static_cast<unsigned char*>(mapped);
+        capacity = size;
+        return true;
+    }
+
+    void PixelUnpackRing::Destroy()
+    {
+        if (buffer == 0) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < regions.size(); i++) {
+            if (regions[i].state == REGION_FENCED) {
+                glClientWaitSync(regions[i].fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+                glDeleteSync(regions[i].fence);
+            }
+        }
+        regions.clear();
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+        data = NULL;
+        capacity = 0;
+    }
+
+    bool PixelUnpackRing::IsCreated() const
+    {
+        return buffer != 0;
+    }
+
+    GLuint PixelUnpackRing::Buffer() const
+    {
+        return buffer;
+    }
+
+    bool PixelUnpackRing::Allocate(size_t size, size_t* offset, unsigned char** pointer)
+    {
+        // empty regions would share offsets with their neighbours
+        size = AlignSize(size > 0 ? size : 1);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (data == NULL || size > capacity) {
+            return false;
+        }
+
+        size_t start = 0;
+        if (!regions.empty()) {
+            const Region& oldest = regions.front();
+            const Region& newest = regions.back();
+            size_t head = newest.offset + newest.size;
+            if (newest.offset >= oldest.offset) {
+                // used space is one run: take the end of the buffer, or wrap to its start
+                if (head + size <= capacity) {
+                    start = head;
+                } else if (size <= oldest.offset) {
+                    start = 0;
+                } else {
+                    return false;
+                }
+            } else {
+                // already wrapped: the gap up to the oldest region is all there is
+                if (head + size > oldest.offset) {
+                    return false;
+                }
+                start = head;
+            }
+        }
+
+        Region region;
+        region.offset = start;
+        region.size = size;
+        region.state = REGION_WRITING;
+        region.fence = NULL;
+        regions.push_back(region);
+
+        *offset = start;
+        *pointer = data + start;
+        return true;
+    }
+
+    void PixelUnpackRing::Fence(size_t offset)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Region* region = FindRegion(offset);
+        if (region != NULL && region->state == REGION_WRITING) {
+            region->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            region->state = REGION_FENCED;
+        }
+    }
+
+    void PixelUnpackRing::Discard(size_t offset)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Region* region = FindRegion(offset);
+        if (region != NULL && region->state == REGION_WRITING) {
+            region->state = REGION_FREE;
+        }
+    }
+
+    void PixelUnpackRing::Retire()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (!regions.empty()) {
+            Region& oldest = regions.front();
+            if (oldest.state == REGION_WRITING) {
+                break;
+            }
+            if (oldest.state == REGION_FENCED) {
+                GLenum status = glClientWaitSync(oldest.fence, 0, 0);
+                if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+                    break;
+                }
+                glDeleteSync(oldest.fence);
+            }
+            regions.pop_front();
+        }
+    }
+
+    PixelUnpackRing::Region* PixelUnpackRing::FindRegion(size_t offset)
+    {
+        for (size_t i = 0; i < regions.size(); i++) {
+            if (regions[i].offset == offset) {
+                return &regions[i];
+            }
+        }
+        return NULL;
+    }
+
+}
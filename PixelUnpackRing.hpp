@@ -0,0 +1,73 @@
+#ifndef PixelUnpackRing_hpp
+#define PixelUnpackRing_hpp
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+namespace gps {
+
+// Persistently mapped GL_PIXEL_UNPACK_BUFFER that decoder threads write
+// texture rows into and the GL thread uploads from. Regions are handed out
+// in ring order and recycled once the fence after their upload signals.
+// Needs GL 4.4 or ARB_buffer_storage; without it Create fails and callers
+// keep decoding into heap memory.
+class PixelUnpackRing
+{
+public:
+    PixelUnpackRing();
+
+    // GL thread: allocates and maps the buffer
+    bool Create(size_t capacity);
+    // GL thread: waits for pending uploads, then unmaps and deletes the buffer
+    void Destroy();
+
+    bool IsCreated() const;
+    GLuint Buffer() const;
+
+    // Any thread: reserves `size` bytes without blocking; fails when the ring is full
+    bool Allocate(size_t size, size_t* offset, unsigned char** data);
+
+    // GL thread: marks a region as read by the commands just issued
+    void Fence(size_t offset);
+
+    // Any thread: gives back a region that will never be uploaded
+    void Discard(size_t offset);
+
+    // GL thread: recycles the regions whose uploads have completed
+    void Retire();
+
+private:
+    PixelUnpackRing(const PixelUnpackRing&);
+    PixelUnpackRing& operator=(const PixelUnpackRing&);
+
+    enum RegionState
+    {
+        REGION_WRITING,
+        REGION_FENCED,
+        REGION_FREE
+    };
+
+    struct Region
+    {
+        size_t offset;
+        size_t size;
+        RegionState state;
+        GLsync fence;
+    };
+
+    GLuint buffer;
+    unsigned char* data;
+    size_t capacity;
+    // live regions in allocation order; the front one is the oldest
+    std::deque<Region> regions;
+    std::mutex mutex;
+
+    Region* FindRegion(size_t offset);
+};
+
+}
+
+#endif /* PixelUnpackRing_hpp */
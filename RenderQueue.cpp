@@ -0,0 +1,393 @@
+#include "RenderQueue.hpp"
+#include "GLState.hpp"
+#include "InstanceBuffer.hpp"
+
+#include "glm/gtc/matrix_inverse.hpp"
+#include "glm/gtc/type_ptr.hpp"
+
+#include <chrono>
+#include <cstring>
+
+namespace gps {
+
+    // Key fields from the most significant bits down
+    static const int PASS_BITS = 4;
+    static const int PROGRAM_BITS = 8;
+    static const int MATERIAL_BITS = 16;
+    static const int VERTEX_ARRAY_BITS = 16;
+    static const int DEPTH_BITS = 20;
+
+    // Storage buffer bindings of the indirect shaders
+    static const GLuint TRANSFORM_BINDING = 0;
+    static const GLuint DRAW_BINDING = 1;
+
+    RenderQueue::RenderQueue()
+        : pass(0), view(1.0f), multiDrawIndirect(false), transformBuffer(0), drawBuffer(0), commandBuffer(0)
+    {
+        memset(&stats, 0, sizeof(stats));
+    }
+
+    RenderQueue::~RenderQueue()
+    {
+        GLuint buffers[] = { transformBuffer, drawBuffer, commandBuffer };
+        for (int i = 0; i < 3; i++) {
+            if (buffers[i] != 0) {
+                glDeleteBuffers(1, &buffers[i]);
+            }
+        }
+    }
+
+    bool RenderQueue::SupportsMultiDrawIndirect()
+    {
+        return GLEW_VERSION_4_3 && GLEW_ARB_shader_draw_parameters;
+    }
+
+    void RenderQueue::SetMultiDrawIndirect(bool enabled)
+    {
+        multiDrawIndirect = enabled;
+    }
+
+    void RenderQueue::Begin(int pass, const glm::mat4& view)
+    {
+        this->pass = static_cast<uint64_t>(pass) & ((1u << PASS_BITS) - 1);
+        this->view = view;
+        items.clear();
+        transforms.clear();
+        shaders.clear();
+        runCounts.clear();
+        runOffsets.clear();
+    }
+
+    float RenderQueue::ViewDepth(const glm::vec3& point) const
+    {
+        return -(view * glm::vec4(point, 1.0f)).z;
+    }
+
+    uint32_t RenderQueue::AddTransform(const glm::mat4& model)
+    {
+        transforms.push_back(model);
+        return static_cast<uint32_t>(transforms.size() - 1);
+    }
+
+    // Same set of textures, whatever the layers - ranges of one texture array share a key
+    static uint32_t MaterialKey(const std::vector<Texture>& textures)
+    {
+        uint32_t hash = 0x811c9dc5u;
+        for (size_t i = 0; i < textures.size(); i++) {
+            hash = (hash ^ textures[i].id) * 0x01000193u;
+        }
+        return textures.empty() ? 0 : hash;
+    }
+
+    uint64_t RenderQueue::MakeKey(uint64_t pass, GLuint program, uint32_t material, GLuint vertexArray, float depth)
+    {
+        // the bits of a non-negative float sort like its value; the top ones are enough
+        uint32_t depthBits;
+        float clamped = depth > 0.0f ? depth : 0.0f;
+        memcpy(&depthBits, &clamped, sizeof(depthBits));
+        depthBits >>= 32 - 1 - DEPTH_BITS;
+
+        uint64_t key = pass;
+        key = (key << PROGRAM_BITS) | (program & ((1u << PROGRAM_BITS) - 1));
+        key = (key << MATERIAL_BITS) | (material & ((1u << MATERIAL_BITS) - 1));
+        key = (key << VERTEX_ARRAY_BITS) | (vertexArray & ((1u << VERTEX_ARRAY_BITS) - 1));
+        key = (key << DEPTH_BITS) | (depthBits & ((1u << DEPTH_BITS) - 1));
+        return key;
+    }
+
+    void RenderQueue::Push(const Shader& shader, Mesh& mesh, const SubMesh& submesh, uint32_t transform, float depth,
+        const std::vector<GLsizei>& counts, const std::vector<GLvoid*>& offsets, const InstanceBuffer* instances)
+    {
+        uint32_t shaderIndex = 0;
+        while (shaderIndex < shaders.size() && shaders[shaderIndex].shaderProgram != shader.shaderProgram) {
+            shaderIndex++;
+        }
+        if (shaderIndex == shaders.size()) {
+            shaders.push_back(shader);
+        }
+
+        DrawItem item;
+        item.key = MakeKey(pass, shader.shaderProgram, MaterialKey(submesh.textures), mesh.buffers.VAO, depth);
+        item.transform = transform;
+        item.shader = shaderIndex;
+        item.firstRun = static_cast<uint32_t>(runCounts.size());
+        item.runCount = static_cast<uint32_t>(counts.size());
+        item.mesh = &mesh;
+        item.submesh = &submesh;
+        item.instances = instances;
+        items.push_back(item);
+        runCounts.insert(runCounts.end(), counts.begin(), counts.end());
+        runOffsets.insert(runOffsets.end(), offsets.begin(), offsets.end());
+    }
+
+    void RenderQueue::Sort()
+    {
+        order.resize(items.size());
+        scratch.resize(items.size());
+        size_t histogram[8][256];
+        memset(histogram, 0, sizeof(histogram));
+        for (size_t i = 0; i < items.size(); i++) {
+            order[i].key = items[i].key;
+            order[i].item = static_cast<uint32_t>(i);
+            for (int digit = 0; digit < 8; digit++) {
+                histogram[digit][(items[i].key >> (digit * 8)) & 0xff]++;
+            }
+        }
+
+        for (int digit = 0; digit < 8; digit++) {
+            size_t* counts = histogram[digit];
+            // every key has the same byte here: the pass would not move anything
+            if (items.empty() || counts[(order[0].key >> (digit * 8)) & 0xff] == items.size()) {
+                continue;
+            }
+            size_t offset = 0;
+            for (int bucket = 0; bucket < 256; bucket++) {
+                size_t count = counts[bucket];
+                counts[bucket] = offset;
+                offset += count;
+            }
+            for (size_t i = 0; i < order.size(); i++) {
+                scratch[counts[(order[i].key >> (digit * 8)) & 0xff]++] = order[i];
+            }
+            order.swap(scratch);
+        }
+    }
+
+    void RenderQueue::Submit()
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        Sort();
+        std::chrono::duration<double, std::milli> sortTime = std::chrono::steady_clock::now() - start;
+
+        memset(&stats, 0, sizeof(stats));
+        stats.items = items.size();
+        stats.sortMilliseconds = sortTime.count();
+
+        if (multiDrawIndirect) {
+            SubmitIndirect();
+        }
+        else {
+            SubmitDirect();
+        }
+    }
+
+    void RenderQueue::SubmitDirect()
+    {
+        uint32_t shaderIndex = ~0u;
+        uint32_t transform = ~0u;
+        const Mesh* mesh = NULL;
+        const std::vector<Texture>* textures = NULL;
+        GLint modelLocation = -1;
+        GLint normalMatrixLocation = -1;
+        GLint instancedLocation = -1;
+        // -1 until set for the current program
+        int instanced = -1;
+        for (size_t i = 0; i < order.size(); i++) {
+            const DrawItem& item = items[order[i].item];
+            Shader& shader = shaders[item.shader];
+
+            // uniforms belong to the program, so everything is set again after a switch
+            if (item.shader != shaderIndex) {
+                // programs keep their uniforms; leave none in instanced mode for other draws
+                if (instanced == 1) {
+                    glUniform1i(instancedLocation, 0);
+                }
+                shader.useShaderProgram();
+                modelLocation = shader.uniformLocation("model");
+                normalMatrixLocation = shader.uniformLocation("normalMatrix");
+                instancedLocation = shader.uniformLocation("instanced");
+                instanced = -1;
+                shaderIndex = item.shader;
+                transform = ~0u;
+                mesh = NULL;
+                textures = NULL;
+                stats.programChanges++;
+            }
+            if (item.mesh != mesh) {
+                item.mesh->bindVertexFormat(shader);
+                mesh = item.mesh;
+                stats.meshChanges++;
+            }
+            int itemInstanced = item.instances != NULL ? 1 : 0;
+            if (itemInstanced != instanced) {
+                glUniform1i(instancedLocation, itemInstanced);
+                instanced = itemInstanced;
+            }
+            if (item.instances == NULL && item.transform != transform) {
+                const glm::mat4& model = transforms[item.transform];
+                glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(model));
+                if (normalMatrixLocation >= 0) {
+                    glm::mat3 normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
+                    glUniformMatrix3fv(normalMatrixLocation, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+                }
+                transform = item.transform;
+                stats.transformChanges++;
+            }
+            if (Mesh::bindTextures(shader, item.submesh->textures, textures)) {
+                stats.materialChanges++;
+            }
+            textures = &item.submesh->textures;
+            item.mesh->drawRuns(*item.submesh, &runCounts[item.firstRun], &runOffsets[item.firstRun], item.runCount,
+                item.instances);
+            stats.drawCalls++;
+        }
+        if (instanced == 1) {
+            glUniform1i(instancedLocation, 0);
+        }
+    }
+
+    // Same texture objects in the same slots; the layers come from the draw records
+    static bool SameTextureObjects(const std::vector<Texture>& a, const std::vector<Texture>& b)
+    {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); i++) {
+            if (a[i].id != b[i].id || a[i].type != b[i].type) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool RenderQueue::SameBatch(const DrawItem& a, const DrawItem& b)
+    {
+        // positionScale, positionOffset and the layers are per draw; the rest is bound once.
+        // Each vertex format has its own pooled vertex array, so the VAO stands for the format.
+        return a.shader == b.shader && a.instances == b.instances && a.mesh->buffers.VAO == b.mesh->buffers.VAO &&
+            a.mesh->indexType == b.mesh->indexType &&
+            SameTextureObjects(a.submesh->textures, b.submesh->textures);
+    }
+
+    void RenderQueue::UploadBuffer(GLenum target, GLuint* buffer, const void* data, size_t bytes)
+    {
+        if (*buffer == 0) {
+            glGenBuffers(1, buffer);
+        }
+        glBindBuffer(target, *buffer);
+        // orphans last frame's storage instead of waiting for draws still reading it
+        glBufferData(target, bytes, data, GL_STREAM_DRAW);
+    }
+
+    void RenderQueue::SubmitIndirect()
+    {
+        indirectTransforms.resize(transforms.size());
+        for (size_t t = 0; t < transforms.size(); t++) {
+            indirectTransforms[t].model = transforms[t];
+            indirectTransforms[t].normalMatrix = glm::mat4(glm::mat3(glm::inverseTranspose(view * transforms[t])));
+        }
+        stats.transformChanges = transforms.size();
+        // a pass of instances alone still binds a non-empty buffer
+        if (indirectTransforms.empty()) {
+            IndirectTransform identity = { glm::mat4(1.0f), glm::mat4(1.0f) };
+            indirectTransforms.push_back(identity);
+        }
+
+        static const uint32_t DIFFUSE_TEXTURE = Shader::hashName("diffuseTexture");
+        static const uint32_t SPECULAR_TEXTURE = Shader::hashName("specularTexture");
+        indirectDraws.clear();
+        indirectCommands.clear();
+        indirectBatches.clear();
+        for (size_t i = 0; i < order.size(); i++) {
+            const DrawItem& item = items[order[i].item];
+            const Mesh& mesh = *item.mesh;
+            if (indirectBatches.empty() || !SameBatch(items[indirectBatches.back().item], item)) {
+                IndirectBatch batch;
+                batch.item = order[i].item;
+                batch.firstCommand = static_cast<uint32_t>(indirectCommands.size());
+                batch.commandCount = 0;
+                indirectBatches.push_back(batch);
+            }
+
+            IndirectDraw draw;
+            draw.transform = item.instances != NULL ? 0 : item.transform;
+            draw.diffuseLayer = -1;
+            draw.specularLayer = -1;
+            draw.instanced = item.instances != NULL ? 1 : 0;
+            draw.positionScale = glm::vec4(mesh.positionScale, 0.0f);
+            draw.positionOffset = glm::vec4(mesh.positionOffset, 0.0f);
+            const std::vector<Texture>& textures = item.submesh->textures;
+            for (size_t t = 0; t < textures.size(); t++) {
+                uint32_t type = Shader::hashName(textures[t].type.c_str());
+                if (type == DIFFUSE_TEXTURE) {
+                    draw.diffuseLayer = textures[t].layer;
+                }
+                else if (type == SPECULAR_TEXTURE) {
+                    draw.specularLayer = textures[t].layer;
+                }
+            }
+
+            // runs hold byte offsets into the pool's index buffer; commands count indices
+            size_t indexSize = mesh.indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+            for (uint32_t r = item.firstRun; r < item.firstRun + item.runCount; r++) {
+                IndirectCommand command;
+                command.count = static_cast<GLuint>(runCounts[r]);
+                command.instanceCount = item.instances != NULL ? static_cast<GLuint>(item.instances->Count()) : 1;
+                command.firstIndex = static_cast<GLuint>(reinterpret_cast<size_t>(runOffsets[r]) / indexSize);
+                command.baseVertex = mesh.buffers.baseVertex + item.submesh->baseVertex;
+                command.baseInstance = 0;
+                indirectCommands.push_back(command);
+                indirectDraws.push_back(draw);
+            }
+            indirectBatches.back().commandCount += item.runCount;
+        }
+        if (indirectCommands.empty()) {
+            return;
+        }
+
+        UploadBuffer(GL_SHADER_STORAGE_BUFFER, &transformBuffer, indirectTransforms.data(),
+            indirectTransforms.size() * sizeof(IndirectTransform));
+        UploadBuffer(GL_SHADER_STORAGE_BUFFER, &drawBuffer, indirectDraws.data(), indirectDraws.size() * sizeof(IndirectDraw));
+        UploadBuffer(GL_DRAW_INDIRECT_BUFFER, &commandBuffer, indirectCommands.data(),
+            indirectCommands.size() * sizeof(IndirectCommand));
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TRANSFORM_BINDING, transformBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_BINDING, drawBuffer);
+
+        uint32_t shaderIndex = ~0u;
+        GLuint vertexArray = 0;
+        const std::vector<Texture>* textures = NULL;
+        GLint drawOffsetLocation = -1;
+        for (size_t b = 0; b < indirectBatches.size(); b++) {
+            const IndirectBatch& batch = indirectBatches[b];
+            const DrawItem& item = items[batch.item];
+            Shader& shader = shaders[item.shader];
+
+            if (item.shader != shaderIndex) {
+                shader.useShaderProgram();
+                drawOffsetLocation = shader.uniformLocation("drawOffset");
+                shaderIndex = item.shader;
+                vertexArray = 0;
+                textures = NULL;
+                stats.programChanges++;
+            }
+            if (item.mesh->buffers.VAO != vertexArray) {
+                item.mesh->bindVertexFormat(shader);
+                vertexArray = item.mesh->buffers.VAO;
+                stats.meshChanges++;
+            }
+            if (Mesh::bindTextures(shader, item.submesh->textures, textures)) {
+                stats.materialChanges++;
+            }
+            textures = &item.submesh->textures;
+
+            glUniform1ui(drawOffsetLocation, batch.firstCommand);
+            // a batch shares its instance buffer, if any
+            if (item.instances != NULL) {
+                item.instances->BindAttributes();
+            }
+            glMultiDrawElementsIndirect(GL_TRIANGLES, item.mesh->indexType,
+                reinterpret_cast<const GLvoid*>(batch.firstCommand * sizeof(IndirectCommand)), batch.commandCount, 0);
+            if (item.instances != NULL) {
+                InstanceBuffer::UnbindAttributes();
+            }
+            stats.drawCalls++;
+        }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    const RenderQueue::Stats& RenderQueue::LastStats() const
+    {
+        return stats;
+    }
+
+}
@@ -0,0 +1,161 @@
+#ifndef RenderQueue_hpp
+#define RenderQueue_hpp
+
+#include "Mesh.hpp"
+#include "Shader.hpp"
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+// One range of a mesh waiting to be drawn. The key orders the queue: pass,
+// then program, material, vertex array and finally depth, so draws sharing
+// state end up next to each other and each group goes front to back.
+struct DrawItem
+{
+    uint64_t key;
+    // into the queue's transforms, shaders and index runs
+    uint32_t transform;
+    uint32_t shader;
+    uint32_t firstRun;
+    uint32_t runCount;
+    Mesh* mesh;
+    const SubMesh* submesh;
+    // drawn once per instance, which then ignores `transform`; NULL for one copy
+    const InstanceBuffer* instances;
+};
+
+// Collects the draws of a pass, sorts them by key and submits them in that
+// order, setting each piece of state only when it changes. With multi-draw
+// indirect on, consecutive draws sharing program, vertex array and texture
+// objects go out as one glMultiDrawElementsIndirect; the shaders then read
+// their transforms and per-draw data from storage buffers (see
+// shaders/basicIndirect.vert) instead of uniforms.
+class RenderQueue
+{
+public:
+    struct Stats
+    {
+        size_t items;
+        double sortMilliseconds;
+        size_t programChanges;
+        size_t meshChanges;
+        size_t materialChanges;
+        size_t transformChanges;
+        size_t drawCalls;
+    };
+
+    RenderQueue();
+    ~RenderQueue();
+
+    // GL 4.3 with ARB_shader_draw_parameters, whose gl_DrawIDARB the indirect shaders read;
+    // a core 4.6 driver that does not list the extension would fail to compile them
+    static bool SupportsMultiDrawIndirect();
+
+    // Off by default; the queue's shaders must be the indirect variants while on
+    void SetMultiDrawIndirect(bool enabled);
+
+    // Drops what was queued before. `view` measures the depth of the draws and
+    // gives shaders with a normalMatrix uniform their normal matrices.
+    void Begin(int pass, const glm::mat4& view);
+
+    // Distance in front of the view, for the depth of a draw
+    float ViewDepth(const glm::vec3& point) const;
+
+    // Stores the model matrix of the following draws and returns its index
+    uint32_t AddTransform(const glm::mat4& model);
+
+    // Queues one range of `mesh`; `counts` and `offsets` are its index runs
+    void Push(const Shader& shader, Mesh& mesh, const SubMesh& submesh, uint32_t transform, float depth,
+        const std::vector<GLsizei>& counts, const std::vector<GLvoid*>& offsets, const InstanceBuffer* instances = NULL);
+
+    // Sorts and draws everything queued since Begin
+    void Submit();
+
+    const Stats& LastStats() const;
+
+private:
+    RenderQueue(const RenderQueue&);
+    RenderQueue& operator=(const RenderQueue&);
+
+    struct SortEntry
+    {
+        uint64_t key;
+        uint32_t item;
+    };
+
+    // Layouts shared with the std430 blocks of the indirect shaders
+    struct IndirectTransform
+    {
+        glm::mat4 model;
+        // mat3 in the upper left, padded to a mat4
+        glm::mat4 normalMatrix;
+    };
+    struct IndirectDraw
+    {
+        GLuint transform;
+        GLint diffuseLayer;
+        GLint specularLayer;
+        // 1 when the transforms come from the instance attributes
+        GLuint instanced;
+        glm::vec4 positionScale;
+        glm::vec4 positionOffset;
+    };
+    // DrawElementsIndirectCommand
+    struct IndirectCommand
+    {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+    // Commands [firstCommand, firstCommand + commandCount) drawn by one call
+    struct IndirectBatch
+    {
+        uint32_t item;
+        uint32_t firstCommand;
+        uint32_t commandCount;
+    };
+
+    uint64_t pass;
+    glm::mat4 view;
+    std::vector<DrawItem> items;
+    std::vector<glm::mat4> transforms;
+    std::vector<Shader> shaders;
+    std::vector<GLsizei> runCounts;
+    std::vector<GLvoid*> runOffsets;
+    // sort order and its scratch buffer, kept between frames
+    std::vector<SortEntry> order;
+    std::vector<SortEntry> scratch;
+    Stats stats;
+
+    bool multiDrawIndirect;
+    // GL buffers and their staging copies, refilled every Submit
+    GLuint transformBuffer;
+    GLuint drawBuffer;
+    GLuint commandBuffer;
+    std::vector<IndirectTransform> indirectTransforms;
+    std::vector<IndirectDraw> indirectDraws;
+    std::vector<IndirectCommand> indirectCommands;
+    std::vector<IndirectBatch> indirectBatches;
+
+    static uint64_t MakeKey(uint64_t pass, GLuint program, uint32_t material, GLuint vertexArray, float depth);
+    // LSD radix sort of `order` by key, a byte at a time, skipping bytes all keys share
+    void Sort();
+    // One draw call per item
+    void SubmitDirect();
+    // One draw call per run of items that can share it
+    void SubmitIndirect();
+    static bool SameBatch(const DrawItem& a, const DrawItem& b);
+    static void UploadBuffer(GLenum target, GLuint* buffer, const void* data, size_t bytes);
+};
+
+}
+
+#endif /* RenderQueue_hpp */
@@ -1,4 +1,7 @@
 #include "Shader.hpp"
+#include "GLState.hpp"
+
+#include <algorithm>
 
 namespace gps {
     std::string Shader::readShaderFile(std::string fileName)
@@ -80,11 +83,70 @@ namespace gps {
         glDeleteShader(fragmentShader);
         //check linking info
         shaderLinkLog(this->shaderProgram);
+        reflectUniforms();
+    }
+
+    bool Shader::byNameHash(const Uniform& a, const Uniform& b)
+    {
+        return a.nameHash < b.nameHash;
+    }
+
+    void Shader::reflectUniforms()
+    {
+        GLint count = 0;
+        GLint maxLength = 0;
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+        std::shared_ptr<std::vector<Uniform> > table = std::make_shared<std::vector<Uniform> >();
+        std::vector<GLchar> name(maxLength > 0 ? maxLength : 1);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(this->shaderProgram, static_cast<GLuint>(i), static_cast<GLsizei>(name.size()), &length, &size, &type, name.data());
+            std::string uniformName(name.data(), length);
+
+            // members of uniform blocks have no location
+            Uniform uniform;
+            uniform.location = glGetUniformLocation(this->shaderProgram, uniformName.c_str());
+            if (uniform.location < 0)
+                continue;
+
+            // arrays are reported as "name[0]"
+            size_t bracket = uniformName.find('[');
+            if (bracket != std::string::npos)
+                uniformName.erase(bracket);
+            uniform.nameHash = hashName(uniformName.c_str());
+            table->push_back(uniform);
+        }
+
+        std::sort(table->begin(), table->end(), byNameHash);
+        for (size_t i = 1; i < table->size(); i++)
+        {
+            if ((*table)[i].nameHash == (*table)[i - 1].nameHash)
+                std::cout << "Shader uniform name hash collision, rename one of the uniforms" << std::endl;
+        }
+        uniforms = table;
+    }
+
+    GLint Shader::uniformLocation(uint32_t nameHash) const
+    {
+        if (!uniforms)
+            return -1;
+        Uniform key;
+        key.nameHash = nameHash;
+        key.location = -1;
+        std::vector<Uniform>::const_iterator found = std::lower_bound(uniforms->begin(), uniforms->end(), key, byNameHash);
+        if (found == uniforms->end() || found->nameHash != nameHash)
+            return -1;
+        return found->location;
     }
 
     void Shader::useShaderProgram()
     {
-        glUseProgram(this->shaderProgram);
+        GLState::Instance().UseProgram(this->shaderProgram);
     }
 
 }
@@ -3,11 +3,14 @@
 
 #include <GL/glew.h>
 
+#include <cstdint>
 #include <iostream>
 #include <fstream>
+#include <memory>
 #include <sstream>
 #include <iostream>
 #include <string>
+#include <vector>
 
 namespace gps {
 
@@ -18,10 +21,37 @@ public:
     void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName);
     void useShaderProgram();
 
+    // FNV-1a hash of a uniform name; literal names fold at compile time.
+    // Passing the hash of a prefix as `seed` hashes the concatenation.
+    static constexpr uint32_t hashName(const char* name, uint32_t seed = 0x811c9dc5u)
+    {
+        for (; *name != '\0'; name++) {
+            seed = (seed ^ static_cast<unsigned char>(*name)) * 0x01000193u;
+        }
+        return seed;
+    }
+
+    // Location of an active uniform, from the table reflected after linking;
+    // -1 when the program has no such uniform. Arrays go by their bare name.
+    GLint uniformLocation(uint32_t nameHash) const;
+    GLint uniformLocation(const char* name) const { return uniformLocation(hashName(name)); }
+    GLint uniformLocation(const std::string& name) const { return uniformLocation(hashName(name.c_str())); }
+
 private:
+    struct Uniform
+    {
+        uint32_t nameHash;
+        GLint location;
+    };
+
+    // sorted by hash; shared by the copies draw calls take by value
+    std::shared_ptr<const std::vector<Uniform> > uniforms;
+
     std::string readShaderFile(std::string fileName);
     void shaderCompileLog(GLuint shaderId);
     void shaderLinkLog(GLuint shaderProgramId);
+    void reflectUniforms();
+    static bool byNameHash(const Uniform& a, const Uniform& b);
 };
 
 }
@@ -7,8 +7,126 @@
 //
 
 #include "SkyBox.hpp"
+#include "GLState.hpp"
+#include "CompressedTexture.hpp"
+#include "TextureCache.hpp"
+#include "TextureEncoder.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <string>
 
 namespace gps {
+
+    // The faces were always sampled as plain GL_RGB, so they stay out of sRGB decoding
+    static const bool SKYBOX_SRGB = false;
+    static const GLenum SKYBOX_COMPRESSED_FORMAT = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+
+    static void FreeFaces(unsigned char* faces[6])
+    {
+        for (int i = 0; i < 6; i++) {
+            if (faces[i]) {
+                stbi_image_free(faces[i]);
+                faces[i] = NULL;
+            }
+        }
+    }
+
+    // Decodes the six faces as RGBA8 at once; they must be square and all the same size
+    static bool DecodeFaces(const std::vector<const GLchar*>& names, ThreadPool& pool, unsigned char* faces[6], int* size)
+    {
+        int widths[6];
+        int heights[6];
+        TaskGroup decodes;
+        for (int i = 0; i < 6; i++) {
+            faces[i] = NULL;
+            const char* name = names[i];
+            unsigned char** face = &faces[i];
+            int* width = &widths[i];
+            int* height = &heights[i];
+            decodes.Run(pool, [name, face, width, height]() {
+                int n;
+                *face = stbi_load(name, width, height, &n, 4);
+            });
+        }
+        decodes.Wait();
+
+        for (int i = 0; i < 6; i++) {
+            if (!faces[i]) {
+                fprintf(stderr, "ERROR: could not load %s\n", names[i]);
+                FreeFaces(faces);
+                return false;
+            }
+            if (widths[i] != heights[i] || widths[i] != widths[0]) {
+                fprintf(stderr, "ERROR: sky box face %s is not square or differs in size from %s\n", names[i], names[0]);
+                FreeFaces(faces);
+                return false;
+            }
+        }
+        *size = widths[0];
+        return true;
+    }
+
+    static void SetCubeMapParameters(GLint levelCount)
+    {
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    }
+
+    // Uploads every level of every face of a cube map DDS
+    static GLuint UploadCompressedCubeMap(const std::vector<unsigned char>& file, const char* name)
+    {
+        CompressedTexture cube;
+        if (!ParseCompressedTexture(file.data(), file.size(), name, &cube)) {
+            return 0;
+        }
+        if (cube.faces != 6) {
+            fprintf(stderr, "ERROR: %s is not a cube map\n", name);
+            return 0;
+        }
+        std::vector<unsigned char> levels(cube.dataSize);
+        CopyCompressedMips(file.data(), cube, levels.data());
+
+        GLuint textureID;
+        glGenTextures(1, &textureID);
+        GLState::Instance().BindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+        for (int face = 0; face < 6; face++) {
+            for (size_t level = 0; level < cube.mips.size(); level++) {
+                const CompressedMip& mip = cube.mips[level];
+                glCompressedTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, static_cast<GLint>(level), cube.internalFormat,
+                    mip.width, mip.height, 0, static_cast<GLsizei>(mip.size), levels.data() + face * cube.faceSize + mip.offset);
+            }
+        }
+        SetCubeMapParameters(static_cast<GLint>(cube.mips.size()));
+        GLState::Instance().BindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        return textureID;
+    }
+
+    // Fallback without S3TC: RGBA8 faces with their mip chains built on the CPU
+    static GLuint UploadCubeMap(unsigned char* faces[6], int size, ThreadPool& pool)
+    {
+        GLuint textureID;
+        glGenTextures(1, &textureID);
+        GLState::Instance().BindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+        GLint levelCount = 1;
+        for (int face = 0; face < 6; face++) {
+            std::vector<std::vector<unsigned char> > mips;
+            BuildMipChain(faces[face], size, size, SKYBOX_SRGB, &mips, pool);
+            levelCount = static_cast<GLint>(mips.size()) + 1;
+            for (GLint level = 0; level < levelCount; level++) {
+                int levelSize = std::max(1, size >> level);
+                const unsigned char* texels = level == 0 ? faces[face] : mips[level - 1].data();
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGBA8, levelSize, levelSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels);
+            }
+        }
+        SetCubeMapParameters(levelCount);
+        GLState::Instance().BindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        return textureID;
+    }
     
     SkyBox::SkyBox()
     {
@@ -27,52 +145,61 @@ namespace gps {
         
         //set the view and projection matrices
         glm::mat4 transformedView = glm::mat4(glm::mat3(viewMatrix));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(transformedView));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projectionMatrix));
+        glUniformMatrix4fv(shader.uniformLocation("view"), 1, GL_FALSE, glm::value_ptr(transformedView));
+        glUniformMatrix4fv(shader.uniformLocation("projection"), 1, GL_FALSE, glm::value_ptr(projectionMatrix));
         
-        glDepthFunc(GL_LEQUAL);
+        GLState& state = GLState::Instance();
+        state.SetDepthFunc(GL_LEQUAL);
         
-        glBindVertexArray(skyboxVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glUniform1i(glGetUniformLocation(shader.shaderProgram, "skybox"), 0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+        state.BindVertexArray(skyboxVAO);
+        glUniform1i(shader.uniformLocation("skybox"), 0);
+        state.BindTexture(0, GL_TEXTURE_CUBE_MAP, cubemapTexture);
         glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
         
-        glDepthFunc(GL_LESS);
+        state.SetDepthFunc(GL_LESS);
     }
     
+    // The faces are decoded in parallel and transcoded once into a BC1 cube map
+    // in the texture cache, keyed on the face files' stamps, so later runs read
+    // nothing but that one entry
     GLuint SkyBox::LoadSkyBoxTextures(std::vector<const GLchar*> skyBoxFaces)
     {
-        GLuint textureID;
-        glGenTextures(1, &textureID);
-        glActiveTexture(GL_TEXTURE0);
-        
-        int width,height, n;
-        unsigned char* image;
-        int force_channels = 3;
-        
-        glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-        for(GLuint i = 0; i < skyBoxFaces.size(); i++)
-        {
-            image = stbi_load(skyBoxFaces[i], &width, &height, &n, force_channels);
-            if (!image) {
-                fprintf(stderr, "ERROR: could not load %s\n", skyBoxFaces[i]);
-                return false;
+        if (skyBoxFaces.size() != 6) {
+            fprintf(stderr, "ERROR: a sky box needs 6 faces, got %u\n", static_cast<unsigned int>(skyBoxFaces.size()));
+            return 0;
+        }
+
+        bool compress = IsCompressedFormatSupported(SKYBOX_COMPRESSED_FORMAT);
+        std::vector<std::string> fileNames(skyBoxFaces.begin(), skyBoxFaces.end());
+        uint64_t hash = 0;
+        bool cacheable = compress && TextureCache::HashFileStamps(fileNames, &hash);
+
+        std::vector<unsigned char> file;
+        if (cacheable && TextureCache::Shared().Read(hash, &file)) {
+            GLuint textureID = UploadCompressedCubeMap(file, skyBoxFaces[0]);
+            if (textureID != 0) {
+                return textureID;
             }
-            glTexImage2D(
-                         GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
-                         GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image
-                         );
         }
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-        
-        return textureID;
+
+        ThreadPool pool;
+        unsigned char* faces[6];
+        int size;
+        if (!DecodeFaces(skyBoxFaces, pool, faces, &size)) {
+            return 0;
+        }
+        if (!compress) {
+            GLuint textureID = UploadCubeMap(faces, size, pool);
+            FreeFaces(faces);
+            return textureID;
+        }
+
+        file = TranscodeCubeToDds(faces, size, SKYBOX_SRGB, pool);
+        FreeFaces(faces);
+        if (cacheable) {
+            TextureCache::Shared().Write(hash, file);
+        }
+        return UploadCompressedCubeMap(file, skyBoxFaces[0]);
     }
     
     void SkyBox::InitSkyBox()
@@ -124,14 +251,14 @@ namespace gps {
         glGenVertexArrays(1, &(this->skyboxVAO));
         glGenBuffers(1, &skyboxVBO);
         
-        glBindVertexArray(skyboxVAO);
+        GLState::Instance().BindVertexArray(skyboxVAO);
         glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
         glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
         
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
         
-        glBindVertexArray(0);
+        GLState::Instance().BindVertexArray(0);
     }
     
     GLuint SkyBox::GetTextureId()
@@ -0,0 +1,249 @@
+#include "TextureCache.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <direct.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <utime.h>
+#endif
+
+namespace gps {
+
+    static const char* ENTRY_EXTENSION = ".dds";
+
+    // Transcoded textures, shared by every run from the same working directory
+    static const char* SHARED_DIRECTORY = "texturecache";
+    static const uint64_t SHARED_CAPACITY = 512ULL * 1024 * 1024;
+
+    struct CacheEntry
+    {
+        std::string fileName;
+        uint64_t size;
+        int64_t lastUsed;
+    };
+
+    static bool ByLastUse(const CacheEntry& a, const CacheEntry& b)
+    {
+        return a.lastUsed < b.lastUsed;
+    }
+
+    static void MakeDirectory(const std::string& directory)
+    {
+#ifdef _WIN32
+        _mkdir(directory.c_str());
+#else
+        mkdir(directory.c_str(), 0755);
+#endif
+    }
+
+    // Sets the modification time to now; it doubles as the last-use stamp since
+    // access times are often not maintained
+    static void Touch(const std::string& fileName)
+    {
+#ifdef _WIN32
+        _utime(fileName.c_str(), NULL);
+#else
+        utime(fileName.c_str(), NULL);
+#endif
+    }
+
+    static bool HasExtension(const std::string& name)
+    {
+        size_t length = strlen(ENTRY_EXTENSION);
+        return name.size() > length && name.compare(name.size() - length, length, ENTRY_EXTENSION) == 0;
+    }
+
+    static std::vector<CacheEntry> ListEntries(const std::string& directory)
+    {
+        std::vector<CacheEntry> entries;
+#ifdef _WIN32
+        WIN32_FIND_DATAA found;
+        HANDLE search = FindFirstFileA((directory + "/*").c_str(), &found);
+        if (search == INVALID_HANDLE_VALUE) {
+            return entries;
+        }
+        do {
+            std::string name = found.cFileName;
+            if ((found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0 || !HasExtension(name)) {
+                continue;
+            }
+            CacheEntry entry;
+            entry.fileName = directory + "/" + name;
+            entry.size = (static_cast<uint64_t>(found.nFileSizeHigh) << 32) | found.nFileSizeLow;
+            entry.lastUsed = (static_cast<int64_t>(found.ftLastWriteTime.dwHighDateTime) << 32) | found.ftLastWriteTime.dwLowDateTime;
+            entries.push_back(entry);
+        } while (FindNextFileA(search, &found));
+        FindClose(search);
+#else
+        DIR* dir = opendir(directory.c_str());
+        if (dir == NULL) {
+            return entries;
+        }
+        while (struct dirent* item = readdir(dir)) {
+            std::string name = item->d_name;
+            if (!HasExtension(name)) {
+                continue;
+            }
+            CacheEntry entry;
+            entry.fileName = directory + "/" + name;
+            struct stat st;
+            if (stat(entry.fileName.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+                continue;
+            }
+            entry.size = static_cast<uint64_t>(st.st_size);
+            entry.lastUsed = static_cast<int64_t>(st.st_mtime);
+            entries.push_back(entry);
+        }
+        closedir(dir);
+#endif
+        return entries;
+    }
+
+    TextureCache::TextureCache(const std::string& directory, uint64_t capacityBytes)
+        : directory(directory), capacity(capacityBytes)
+    {
+    }
+
+    TextureCache& TextureCache::Shared()
+    {
+        static TextureCache cache(SHARED_DIRECTORY, SHARED_CAPACITY);
+        return cache;
+    }
+
+    // FNV-1a over 8-byte words, seeded with the cache version
+    uint64_t TextureCache::HashContents(const unsigned char* data, size_t size)
+    {
+        const uint64_t prime = 0x100000001b3ULL;
+        uint64_t hash = 0xcbf29ce484222325ULL ^ VERSION;
+
+        size_t words = size / 8;
+        for (size_t i = 0; i < words; i++) {
+            uint64_t word;
+            memcpy(&word, data + i * 8, sizeof(word));
+            hash = (hash ^ word) * prime;
+        }
+        for (size_t i = words * 8; i < size; i++) {
+            hash = (hash ^ data[i]) * prime;
+        }
+
+        // word-wise FNV mixes high bits poorly; finish with an avalanche step
+        hash ^= size;
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ULL;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    bool TextureCache::HashFileStamps(const std::vector<std::string>& fileNames, uint64_t* hash)
+    {
+        std::string stamps;
+        for (size_t i = 0; i < fileNames.size(); i++) {
+#ifdef _WIN32
+            struct _stat64 st;
+            if (_stat64(fileNames[i].c_str(), &st) != 0) {
+                return false;
+            }
+#else
+            struct stat st;
+            if (stat(fileNames[i].c_str(), &st) != 0) {
+                return false;
+            }
+#endif
+            char stamp[64];
+            snprintf(stamp, sizeof(stamp), "|%llu|%lld\n", static_cast<unsigned long long>(st.st_size), static_cast<long long>(st.st_mtime));
+            stamps += fileNames[i];
+            stamps += stamp;
+        }
+        *hash = HashContents(reinterpret_cast<const unsigned char*>(stamps.data()), stamps.size());
+        return true;
+    }
+
+    std::string TextureCache::EntryFileName(uint64_t hash) const
+    {
+        char name[17];
+        snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+        return directory + "/" + name + ENTRY_EXTENSION;
+    }
+
+    bool TextureCache::Read(uint64_t hash, std::vector<unsigned char>* contents)
+    {
+        std::string fileName = EntryFileName(hash);
+        std::ifstream file(fileName.c_str(), std::ios::binary);
+        if (!file) {
+            return false;
+        }
+        contents->assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        file.close();
+
+        Touch(fileName);
+        return !contents->empty();
+    }
+
+    bool TextureCache::Write(uint64_t hash, const std::vector<unsigned char>& contents)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        MakeDirectory(directory);
+
+        // write then rename, so a crash never leaves a truncated entry behind
+        std::string fileName = EntryFileName(hash);
+        std::string tempFileName = fileName + ".tmp";
+        {
+            std::ofstream file(tempFileName.c_str(), std::ios::binary | std::ios::trunc);
+            if (!file) {
+                return false;
+            }
+            file.write(reinterpret_cast<const char*>(contents.data()), static_cast<std::streamsize>(contents.size()));
+            if (!file) {
+                file.close();
+                remove(tempFileName.c_str());
+                return false;
+            }
+        }
+
+        remove(fileName.c_str());
+        if (rename(tempFileName.c_str(), fileName.c_str()) != 0) {
+            remove(tempFileName.c_str());
+            return false;
+        }
+
+        Evict();
+        return true;
+    }
+
+    void TextureCache::Evict()
+    {
+        std::vector<CacheEntry> entries = ListEntries(directory);
+
+        uint64_t total = 0;
+        for (size_t i = 0; i < entries.size(); i++) {
+            total += entries[i].size;
+        }
+        if (total <= capacity) {
+            return;
+        }
+
+        std::sort(entries.begin(), entries.end(), ByLastUse);
+        for (size_t i = 0; i < entries.size() && total > capacity; i++) {
+            // an entry that is open elsewhere may refuse to go; it is retried next time
+            if (remove(entries[i].fileName.c_str()) == 0) {
+                total -= entries[i].size;
+            }
+        }
+    }
+
+}
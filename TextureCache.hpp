@@ -0,0 +1,54 @@
+#ifndef TextureCache_hpp
+#define TextureCache_hpp
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+// Directory of transcoded textures named after a hash of the source file's
+// contents, so renamed or copied images still hit and edited ones miss.
+// Sources that are slow to read whole key on their file stamps instead.
+// Reading an entry refreshes its timestamp; writing one evicts the least
+// recently used entries until the directory fits in its size cap.
+class TextureCache
+{
+public:
+    TextureCache(const std::string& directory, uint64_t capacityBytes);
+
+    // The cache under texturecache/ that every loader shares
+    static TextureCache& Shared();
+
+    // Bump when the transcoder's output changes, to orphan the old entries
+    static const uint32_t VERSION = 2;
+
+    static uint64_t HashContents(const unsigned char* data, size_t size);
+
+    // Hash of the names, sizes and modification times of files, read without
+    // opening them; false when one of them is missing
+    static bool HashFileStamps(const std::vector<std::string>& fileNames, uint64_t* hash);
+
+    // Any thread: loads the entry for `hash` and marks it as just used
+    bool Read(uint64_t hash, std::vector<unsigned char>* contents);
+
+    // Any thread: stores an entry, then trims the directory to the cap
+    bool Write(uint64_t hash, const std::vector<unsigned char>& contents);
+
+private:
+    TextureCache(const TextureCache&);
+    TextureCache& operator=(const TextureCache&);
+
+    std::string directory;
+    uint64_t capacity;
+    // serializes directory creation, writes and eviction
+    std::mutex mutex;
+
+    std::string EntryFileName(uint64_t hash) const;
+    void Evict();
+};
+
+}
+
+#endif /* TextureCache_hpp */
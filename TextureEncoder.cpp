@@ -0,0 +1,452 @@
+#include "TextureEncoder.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define GPS_ENCODER_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace gps {
+
+    // Block rows handed to one encoder job
+    static const int ROWS_PER_JOB = 16;
+
+    static const uint32_t DDSD_CAPS = 0x1;
+    static const uint32_t DDSD_HEIGHT = 0x2;
+    static const uint32_t DDSD_WIDTH = 0x4;
+    static const uint32_t DDSD_PIXELFORMAT = 0x1000;
+    static const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+    static const uint32_t DDSD_LINEARSIZE = 0x80000;
+    static const uint32_t DDPF_FOURCC = 0x4;
+    static const uint32_t DDSCAPS_COMPLEX = 0x8;
+    static const uint32_t DDSCAPS_TEXTURE = 0x1000;
+    static const uint32_t DDSCAPS_MIPMAP = 0x400000;
+    static const uint32_t DDSCAPS2_CUBEMAP_ALLFACES = 0xFE00;
+    static const uint32_t DXGI_FORMAT_BC1_UNORM = 71;
+    static const uint32_t DXGI_FORMAT_BC1_UNORM_SRGB = 72;
+    static const uint32_t D3D10_RESOURCE_DIMENSION_TEXTURE2D = 3;
+    static const uint32_t D3D10_RESOURCE_MISC_TEXTURECUBE = 0x4;
+
+    // sRGB <-> linear conversions through tables; the inverse one has enough
+    // steps that every 8-bit value round-trips
+    static const int LINEAR_STEPS = 4096;
+
+    struct SrgbTables
+    {
+        float toLinear[256];
+        unsigned char toSrgb[LINEAR_STEPS + 1];
+
+        SrgbTables()
+        {
+            for (int i = 0; i < 256; i++) {
+                float c = i / 255.0f;
+                toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+            }
+            for (int i = 0; i <= LINEAR_STEPS; i++) {
+                float l = static_cast<float>(i) / LINEAR_STEPS;
+                float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+                toSrgb[i] = static_cast<unsigned char>(std::min(255.0f, std::max(0.0f, c * 255.0f + 0.5f)));
+            }
+        }
+    };
+
+    static const SrgbTables& Tables()
+    {
+        static const SrgbTables tables;
+        return tables;
+    }
+
+    // Four channels of an RGBA8 texel in linear space; the color is decoded from sRGB when `srgb` is set
+    static inline void ToLinear(const unsigned char* texel, bool srgb, const SrgbTables& tables, float* linear)
+    {
+        for (int c = 0; c < 3; c++) {
+            linear[c] = srgb ? tables.toLinear[texel[c]] : texel[c] * (1.0f / 255.0f);
+        }
+        // alpha is coverage, already linear
+        linear[3] = texel[3] * (1.0f / 255.0f);
+    }
+
+    static inline void FromLinear(const float* linear, bool srgb, const SrgbTables& tables, unsigned char* texel)
+    {
+        for (int c = 0; c < 3; c++) {
+            float value = std::min(1.0f, linear[c]);
+            texel[c] = srgb ? tables.toSrgb[static_cast<int>(value * LINEAR_STEPS + 0.5f)] :
+                static_cast<unsigned char>(value * 255.0f + 0.5f);
+        }
+        texel[3] = static_cast<unsigned char>(std::min(1.0f, linear[3]) * 255.0f + 0.5f);
+    }
+
+    // Filters rows [firstRow, lastRow) of the next level from either the
+    // bytes or the linear floats of the level above. `nextLinear` may be
+    // NULL when no further level is built from this one.
+    static void FilterRows(const unsigned char* sourceBytes, const float* sourceLinear, int width, int height, bool srgb,
+        int firstRow, int lastRow, unsigned char* next, float* nextLinear)
+    {
+        const SrgbTables& tables = Tables();
+        int nextWidth = std::max(1, width / 2);
+
+        for (int y = firstRow; y < lastRow; y++) {
+            // odd sizes fold the last row/column into the one before it
+            int y0 = std::min(2 * y, height - 1);
+            int y1 = std::min(2 * y + 1, height - 1);
+            for (int x = 0; x < nextWidth; x++) {
+                int x0 = std::min(2 * x, width - 1);
+                int x1 = std::min(2 * x + 1, width - 1);
+                size_t corners[4] = {
+                    static_cast<size_t>(y0) * width + x0,
+                    static_cast<size_t>(y0) * width + x1,
+                    static_cast<size_t>(y1) * width + x0,
+                    static_cast<size_t>(y1) * width + x1
+                };
+
+                float loaded[4][4];
+                const float* texels[4];
+                for (int i = 0; i < 4; i++) {
+                    if (sourceLinear != NULL) {
+                        texels[i] = sourceLinear + corners[i] * 4;
+                    }
+                    else {
+                        ToLinear(sourceBytes + corners[i] * 4, srgb, tables, loaded[i]);
+                        texels[i] = loaded[i];
+                    }
+                }
+
+                size_t index = static_cast<size_t>(y) * nextWidth + x;
+                float average[4];
+#ifdef GPS_ENCODER_SSE2
+                // one RGBA texel per register
+                __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(texels[0]), _mm_loadu_ps(texels[1])),
+                    _mm_add_ps(_mm_loadu_ps(texels[2]), _mm_loadu_ps(texels[3])));
+                _mm_storeu_ps(average, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+                for (int c = 0; c < 4; c++) {
+                    average[c] = (texels[0][c] + texels[1][c] + texels[2][c] + texels[3][c]) * 0.25f;
+                }
+#endif
+                if (nextLinear != NULL) {
+                    memcpy(nextLinear + index * 4, average, sizeof(average));
+                }
+                FromLinear(average, srgb, tables, next + index * 4);
+            }
+        }
+    }
+
+    void BuildMipChain(const unsigned char* pixels, int width, int height, bool srgb,
+        std::vector<std::vector<unsigned char> >* levels, ThreadPool& pool)
+    {
+        levels->clear();
+
+        std::vector<float> linear;
+        std::vector<float> nextLinear;
+        while (width > 1 || height > 1) {
+            int nextWidth = std::max(1, width / 2);
+            int nextHeight = std::max(1, height / 2);
+            bool last = nextWidth == 1 && nextHeight == 1;
+
+            levels->push_back(std::vector<unsigned char>(static_cast<size_t>(nextWidth) * nextHeight * 4));
+            nextLinear.resize(last ? 0 : static_cast<size_t>(nextWidth) * nextHeight * 4);
+
+            const unsigned char* sourceBytes = levels->size() == 1 ? pixels : NULL;
+            const float* sourceLinear = levels->size() == 1 ? NULL : linear.data();
+            unsigned char* next = levels->back().data();
+            float* nextFloats = last ? NULL : nextLinear.data();
+
+            int rowsPerJob = ROWS_PER_JOB * 4;
+            if (nextHeight <= rowsPerJob) {
+                FilterRows(sourceBytes, sourceLinear, width, height, srgb, 0, nextHeight, next, nextFloats);
+            }
+            else {
+                TaskGroup jobs;
+                for (int first = 0; first < nextHeight; first += rowsPerJob) {
+                    int lastRow = std::min(nextHeight, first + rowsPerJob);
+                    jobs.Run(pool, [sourceBytes, sourceLinear, width, height, srgb, first, lastRow, next, nextFloats]() {
+                        FilterRows(sourceBytes, sourceLinear, width, height, srgb, first, lastRow, next, nextFloats);
+                    });
+                }
+                jobs.Wait();
+            }
+
+            linear.swap(nextLinear);
+            width = nextWidth;
+            height = nextHeight;
+        }
+    }
+
+    static uint16_t Pack565(const float* color)
+    {
+        int r = static_cast<int>(color[0] * 31.0f / 255.0f + 0.5f);
+        int g = static_cast<int>(color[1] * 63.0f / 255.0f + 0.5f);
+        int b = static_cast<int>(color[2] * 31.0f / 255.0f + 0.5f);
+        return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+    }
+
+    static void Unpack565(uint16_t packed, float* color)
+    {
+        int r = (packed >> 11) & 31;
+        int g = (packed >> 5) & 63;
+        int b = packed & 31;
+        color[0] = static_cast<float>((r << 3) | (r >> 2));
+        color[1] = static_cast<float>((g << 2) | (g >> 4));
+        color[2] = static_cast<float>((b << 3) | (b >> 2));
+    }
+
+    // Index of the closest palette entry for each of the 16 texels, two bits each
+    static uint32_t SelectIndices(const float texels[3][16], const float palette[4][3])
+    {
+        uint32_t indices = 0;
+#ifdef GPS_ENCODER_SSE2
+        for (int group = 0; group < 4; group++) {
+            __m128 r = _mm_loadu_ps(&texels[0][group * 4]);
+            __m128 g = _mm_loadu_ps(&texels[1][group * 4]);
+            __m128 b = _mm_loadu_ps(&texels[2][group * 4]);
+
+            __m128 best = _mm_set1_ps(3.0e38f);
+            __m128i bestIndex = _mm_setzero_si128();
+            for (int k = 0; k < 4; k++) {
+                __m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[k][0]));
+                __m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[k][1]));
+                __m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[k][2]));
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+                __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+                best = _mm_min_ps(distance, best);
+                bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(k)), _mm_andnot_si128(closer, bestIndex));
+            }
+
+            int32_t lanes[4];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), bestIndex);
+            for (int i = 0; i < 4; i++) {
+                indices |= static_cast<uint32_t>(lanes[i]) << (2 * (group * 4 + i));
+            }
+        }
+#else
+        for (int i = 0; i < 16; i++) {
+            float best = 3.0e38f;
+            uint32_t bestIndex = 0;
+            for (int k = 0; k < 4; k++) {
+                float dr = texels[0][i] - palette[k][0];
+                float dg = texels[1][i] - palette[k][1];
+                float db = texels[2][i] - palette[k][2];
+                float distance = dr * dr + dg * dg + db * db;
+                if (distance < best) {
+                    best = distance;
+                    bestIndex = static_cast<uint32_t>(k);
+                }
+            }
+            indices |= bestIndex << (2 * i);
+        }
+#endif
+        return indices;
+    }
+
+    // Range fit: endpoints at the extremes of the texels along their principal
+    // axis, pulled in slightly, then the nearest of the four palette colours
+    static void EncodeBlock(const float texels[3][16], unsigned char* block)
+    {
+        float mean[3] = { 0.0f, 0.0f, 0.0f };
+        float lo[3] = { 255.0f, 255.0f, 255.0f };
+        float hi[3] = { 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; i++) {
+            for (int c = 0; c < 3; c++) {
+                mean[c] += texels[c][i];
+                lo[c] = std::min(lo[c], texels[c][i]);
+                hi[c] = std::max(hi[c], texels[c][i]);
+            }
+        }
+        for (int c = 0; c < 3; c++) {
+            mean[c] /= 16.0f;
+        }
+
+        float covariance[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; i++) {
+            float r = texels[0][i] - mean[0];
+            float g = texels[1][i] - mean[1];
+            float b = texels[2][i] - mean[2];
+            covariance[0] += r * r;
+            covariance[1] += r * g;
+            covariance[2] += r * b;
+            covariance[3] += g * g;
+            covariance[4] += g * b;
+            covariance[5] += b * b;
+        }
+
+        // power iteration from the bounding box diagonal
+        float axis[3] = { hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2] };
+        for (int iteration = 0; iteration < 4; iteration++) {
+            float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+            float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+            float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+            float length = std::max(std::max(std::fabs(x), std::fabs(y)), std::fabs(z));
+            if (length <= 0.0f) {
+                break;
+            }
+            axis[0] = x / length;
+            axis[1] = y / length;
+            axis[2] = z / length;
+        }
+
+        float minProjection = 3.0e38f;
+        float maxProjection = -3.0e38f;
+        for (int i = 0; i < 16; i++) {
+            float t = (texels[0][i] - mean[0]) * axis[0] + (texels[1][i] - mean[1]) * axis[1] + (texels[2][i] - mean[2]) * axis[2];
+            minProjection = std::min(minProjection, t);
+            maxProjection = std::max(maxProjection, t);
+        }
+
+        float lengthSquared = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+        float start[3];
+        float end[3];
+        for (int c = 0; c < 3; c++) {
+            float unit = lengthSquared > 0.0f ? axis[c] / lengthSquared : 0.0f;
+            start[c] = mean[c] + unit * minProjection;
+            end[c] = mean[c] + unit * maxProjection;
+            // inset by 1/16 of the range, which lowers the error of the interpolated colours
+            float inset = (end[c] - start[c]) / 16.0f;
+            start[c] = std::min(255.0f, std::max(0.0f, start[c] + inset));
+            end[c] = std::min(255.0f, std::max(0.0f, end[c] - inset));
+        }
+
+        uint16_t color0 = Pack565(end);
+        uint16_t color1 = Pack565(start);
+        // four-colour mode needs color0 > color1
+        if (color0 < color1) {
+            std::swap(color0, color1);
+        }
+
+        uint32_t indices = 0;
+        if (color0 != color1) {
+            float palette[4][3];
+            Unpack565(color0, palette[0]);
+            Unpack565(color1, palette[1]);
+            for (int c = 0; c < 3; c++) {
+                palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+                palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+            }
+            indices = SelectIndices(texels, palette);
+        }
+
+        block[0] = static_cast<unsigned char>(color0 & 0xFF);
+        block[1] = static_cast<unsigned char>(color0 >> 8);
+        block[2] = static_cast<unsigned char>(color1 & 0xFF);
+        block[3] = static_cast<unsigned char>(color1 >> 8);
+        for (int i = 0; i < 4; i++) {
+            block[4 + i] = static_cast<unsigned char>(indices >> (8 * i));
+        }
+    }
+
+    static void EncodeBlockRows(const unsigned char* pixels, int width, int height, int firstRow, int lastRow, unsigned char* blocks)
+    {
+        int blocksX = (width + 3) / 4;
+        float texels[3][16];
+        for (int by = firstRow; by < lastRow; by++) {
+            for (int bx = 0; bx < blocksX; bx++) {
+                // edge blocks repeat the last row/column
+                for (int i = 0; i < 16; i++) {
+                    int x = std::min(bx * 4 + (i & 3), width - 1);
+                    int y = std::min(by * 4 + (i >> 2), height - 1);
+                    const unsigned char* texel = pixels + (static_cast<size_t>(y) * width + x) * 4;
+                    texels[0][i] = texel[0];
+                    texels[1][i] = texel[1];
+                    texels[2][i] = texel[2];
+                }
+                EncodeBlock(texels, blocks + (static_cast<size_t>(by) * blocksX + bx) * 8);
+            }
+        }
+    }
+
+    void EncodeBC1(const unsigned char* pixels, int width, int height, unsigned char* blocks, ThreadPool& pool)
+    {
+        int blocksY = (height + 3) / 4;
+        if (blocksY <= ROWS_PER_JOB) {
+            EncodeBlockRows(pixels, width, height, 0, blocksY, blocks);
+            return;
+        }
+
+        TaskGroup jobs;
+        for (int first = 0; first < blocksY; first += ROWS_PER_JOB) {
+            int last = std::min(blocksY, first + ROWS_PER_JOB);
+            jobs.Run(pool, [pixels, width, height, first, last, blocks]() {
+                EncodeBlockRows(pixels, width, height, first, last, blocks);
+            });
+        }
+        jobs.Wait();
+    }
+
+    static void PutU32(unsigned char* bytes, uint32_t value)
+    {
+        memcpy(bytes, &value, sizeof(value));
+    }
+
+    // BC1 DDS of one sRGB image (legacy DXT1 header) or of the six faces of a
+    // cube map (DX10 header), each image followed by its mip chain
+    static std::vector<unsigned char> WriteDds(const unsigned char* const* images, bool cube, int width, int height,
+        bool srgb, ThreadPool& pool)
+    {
+        size_t imageCount = cube ? 6 : 1;
+        size_t headerSize = cube ? 148 : 128;
+
+        size_t levelCount = 1;
+        for (int size = std::max(width, height); size > 1; size /= 2) {
+            levelCount++;
+        }
+        std::vector<size_t> levelOffsets;
+        size_t imageSize = 0;
+        for (size_t level = 0; level < levelCount; level++) {
+            int levelWidth = std::max(1, width >> level);
+            int levelHeight = std::max(1, height >> level);
+            levelOffsets.push_back(imageSize);
+            imageSize += static_cast<size_t>((levelWidth + 3) / 4) * ((levelHeight + 3) / 4) * 8;
+        }
+
+        std::vector<unsigned char> file(headerSize + imageSize * imageCount, 0);
+        unsigned char* header = file.data();
+        memcpy(header, "DDS ", 4);
+        PutU32(header + 4, 124);
+        PutU32(header + 8, DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE);
+        PutU32(header + 12, static_cast<uint32_t>(height));
+        PutU32(header + 16, static_cast<uint32_t>(width));
+        PutU32(header + 20, static_cast<uint32_t>((levelCount > 1 ? levelOffsets[1] : imageSize) - levelOffsets[0]));
+        PutU32(header + 28, static_cast<uint32_t>(levelCount));
+        PutU32(header + 76, 32);
+        PutU32(header + 80, DDPF_FOURCC);
+        PutU32(header + 108, DDSCAPS_COMPLEX | DDSCAPS_TEXTURE | DDSCAPS_MIPMAP);
+        if (cube) {
+            memcpy(header + 84, "DX10", 4);
+            PutU32(header + 112, DDSCAPS2_CUBEMAP_ALLFACES);
+            PutU32(header + 128, srgb ? DXGI_FORMAT_BC1_UNORM_SRGB : DXGI_FORMAT_BC1_UNORM);
+            PutU32(header + 132, D3D10_RESOURCE_DIMENSION_TEXTURE2D);
+            PutU32(header + 136, D3D10_RESOURCE_MISC_TEXTURECUBE);
+            PutU32(header + 140, 1);
+        }
+        else {
+            memcpy(header + 84, "DXT1", 4);
+        }
+
+        for (size_t image = 0; image < imageCount; image++) {
+            std::vector<std::vector<unsigned char> > mips;
+            BuildMipChain(images[image], width, height, srgb, &mips, pool);
+            unsigned char* blocks = file.data() + headerSize + image * imageSize;
+            for (size_t level = 0; level < levelCount; level++) {
+                int levelWidth = std::max(1, width >> level);
+                int levelHeight = std::max(1, height >> level);
+                const unsigned char* texels = level == 0 ? images[image] : mips[level - 1].data();
+                EncodeBC1(texels, levelWidth, levelHeight, blocks + levelOffsets[level], pool);
+            }
+        }
+        return file;
+    }
+
+    std::vector<unsigned char> TranscodeToDds(const unsigned char* pixels, int width, int height, ThreadPool& pool)
+    {
+        return WriteDds(&pixels, false, width, height, true, pool);
+    }
+
+    std::vector<unsigned char> TranscodeCubeToDds(const unsigned char* const faces[6], int size, bool srgb, ThreadPool& pool)
+    {
+        return WriteDds(faces, true, size, size, srgb, pool);
+    }
+
+}
@@ -0,0 +1,34 @@
+#ifndef TextureEncoder_hpp
+#define TextureEncoder_hpp
+
+#include "ThreadPool.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+    // Builds levels 1 and down of the mip chain of an RGBA8 image (rows
+    // top-down, as stbi_load returns them). Each level averages 2x2 texels of
+    // the one above in linear space - sRGB colours are linearized first - kept
+    // in float between levels so rounding does not build up; the rows of large
+    // levels are spread over `pool`.
+    void BuildMipChain(const unsigned char* pixels, int width, int height, bool srgb,
+        std::vector<std::vector<unsigned char> >* levels, ThreadPool& pool);
+
+    // Encodes an RGBA8 image as BC1 blocks (alpha ignored), spreading block rows
+    // over `pool`; `blocks` needs ((width + 3) / 4) * ((height + 3) / 4) * 8 bytes
+    void EncodeBC1(const unsigned char* pixels, int width, int height, unsigned char* blocks, ThreadPool& pool);
+
+    // Complete DDS file (legacy DXT1 header, full mip chain) for an sRGB RGBA8
+    // image, readable by ParseCompressedTexture
+    std::vector<unsigned char> TranscodeToDds(const unsigned char* pixels, int width, int height, ThreadPool& pool);
+
+    // Complete DDS file (DX10 header, BC1, a full mip chain per face) for the
+    // six square RGBA8 faces of a cube map in +X, -X, +Y, -Y, +Z, -Z order, rows
+    // top-down as GL addresses cube faces. `srgb` picks BC1_UNORM_SRGB.
+    std::vector<unsigned char> TranscodeCubeToDds(const unsigned char* const faces[6], int size, bool srgb, ThreadPool& pool);
+
+}
+
+#endif /* TextureEncoder_hpp */
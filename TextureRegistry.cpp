@@ -0,0 +1,131 @@
+#include "TextureRegistry.hpp"
+#include "GLState.hpp"
+
+#include <cctype>
+#include <vector>
+
+namespace gps {
+
+    TextureRegistry::TextureRegistry()
+    {
+    }
+
+    TextureRegistry& TextureRegistry::Instance()
+    {
+        static TextureRegistry* registry = new TextureRegistry();
+        return *registry;
+    }
+
+    std::string TextureRegistry::NormalizePath(const std::string& path)
+    {
+        std::string slashed = path;
+        for (size_t i = 0; i < slashed.size(); i++) {
+            if (slashed[i] == '\\') {
+                slashed[i] = '/';
+            }
+#ifdef _WIN32
+            // NTFS paths are case-insensitive
+            slashed[i] = static_cast<char>(tolower(static_cast<unsigned char>(slashed[i])));
+#endif
+        }
+
+        bool absolute = !slashed.empty() && slashed[0] == '/';
+        std::vector<std::string> segments;
+        size_t start = 0;
+        while (start <= slashed.size()) {
+            size_t end = slashed.find('/', start);
+            if (end == std::string::npos) {
+                end = slashed.size();
+            }
+            std::string segment = slashed.substr(start, end - start);
+            start = end + 1;
+
+            if (segment.empty() || segment == ".") {
+                continue;
+            }
+            // ".." only cancels a real directory; leading ones are kept
+            if (segment == ".." && !segments.empty() && segments.back() != "..") {
+                segments.pop_back();
+                continue;
+            }
+            segments.push_back(segment);
+        }
+
+        std::string normalized = absolute ? "/" : "";
+        for (size_t i = 0; i < segments.size(); i++) {
+            if (i > 0) {
+                normalized += '/';
+            }
+            normalized += segments[i];
+        }
+        return normalized;
+    }
+
+    bool TextureRegistry::Contains(const std::string& key) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.find(key) != entries.end();
+    }
+
+    GLuint TextureRegistry::Acquire(const std::string& key, GLint* layer)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unordered_map<std::string, Entry>::iterator found = entries.find(key);
+        if (found == entries.end()) {
+            return 0;
+        }
+        found->second.references++;
+        *layer = found->second.layer;
+        return found->second.id;
+    }
+
+    GLuint TextureRegistry::Add(const std::string& key, GLuint id, GLint layer, GLint* registeredLayer)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unordered_map<std::string, Entry>::iterator found = entries.find(key);
+        if (found != entries.end()) {
+            if (id != found->second.id && keyCounts.find(id) == keyCounts.end()) {
+                GLState::Instance().DeleteTexture(id);
+            }
+            found->second.references++;
+            *registeredLayer = found->second.layer;
+            return found->second.id;
+        }
+
+        Entry entry;
+        entry.id = id;
+        entry.layer = layer;
+        entry.references = 1;
+        entries[key] = entry;
+        keyCounts[id]++;
+        *registeredLayer = layer;
+        return id;
+    }
+
+    bool TextureRegistry::Release(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unordered_map<std::string, Entry>::iterator found = entries.find(key);
+        if (found == entries.end() || --found->second.references > 0) {
+            return false;
+        }
+        GLuint id = found->second.id;
+        entries.erase(found);
+
+        // the other layers of an array keep it alive
+        std::unordered_map<GLuint, size_t>::iterator keys = keyCounts.find(id);
+        if (keys != keyCounts.end() && --keys->second > 0) {
+            return false;
+        }
+        keyCounts.erase(id);
+        GLState::Instance().DeleteTexture(id);
+        return true;
+    }
+
+    size_t TextureRegistry::TextureCount() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.size();
+    }
+
+}
@@ -0,0 +1,68 @@
+#ifndef TextureRegistry_hpp
+#define TextureRegistry_hpp
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace gps {
+
+// Process-wide table of uploaded textures keyed by normalized path. Models
+// hold one reference per texture they use; the GL texture is deleted when
+// the last reference goes. Several keys may name layers of one texture array,
+// which then lives until the last of them is released.
+class TextureRegistry
+{
+public:
+    // Never destroyed, and neither are GeometryPool, TextureStreamer and GLState:
+    // global Model3D objects hand their textures and buffers back from their
+    // destructors during static destruction, in no defined order relative to
+    // these, so all four are leaked on purpose
+    static TextureRegistry& Instance();
+
+    // Forward slashes, no "." or "dir/.." segments, lower case on Windows
+    static std::string NormalizePath(const std::string& path);
+
+    // Any thread: whether a texture is uploaded under `key` right now
+    bool Contains(const std::string& key) const;
+
+    // GL thread: adds a reference to the texture under `key` and stores its
+    // array layer (-1 for a plain 2D texture); 0 when there is none
+    GLuint Acquire(const std::string& key, GLint* layer);
+
+    // GL thread: registers a freshly uploaded texture, or one layer of it, with
+    // one reference. When another load got there first, `id` is deleted unless
+    // other keys already use it, and the existing texture is referenced and
+    // returned instead.
+    GLuint Add(const std::string& key, GLuint id, GLint layer, GLint* registeredLayer);
+
+    // GL thread: drops a reference; deleting the texture returns true
+    bool Release(const std::string& key);
+
+    size_t TextureCount() const;
+
+private:
+    TextureRegistry();
+    TextureRegistry(const TextureRegistry&);
+    TextureRegistry& operator=(const TextureRegistry&);
+
+    struct Entry
+    {
+        GLuint id;
+        GLint layer;
+        size_t references;
+    };
+
+    std::unordered_map<std::string, Entry> entries;
+    // keys naming each GL texture
+    std::unordered_map<GLuint, size_t> keyCounts;
+    // loader threads check for resident textures while the GL thread edits the table
+    mutable std::mutex mutex;
+};
+
+}
+
+#endif /* TextureRegistry_hpp */
@@ -0,0 +1,237 @@
+#include "TextureStreamer.hpp"
+#include "GLState.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+
+namespace gps {
+
+    // Levels this size and smaller are uploaded with the texture and never evicted
+    static const int STREAM_TAIL_SIZE = 64;
+    static const size_t DEFAULT_BUDGET = 256 * 1024 * 1024;
+
+    TextureStreamer::TextureStreamer()
+        : budget(DEFAULT_BUDGET), residentBytes(0), frame(0)
+    {
+    }
+
+    TextureStreamer& TextureStreamer::Instance()
+    {
+        static TextureStreamer* streamer = new TextureStreamer();
+        return *streamer;
+    }
+
+    void TextureStreamer::SetBudget(size_t bytes)
+    {
+        budget = bytes;
+    }
+
+    size_t TextureStreamer::Budget() const
+    {
+        return budget;
+    }
+
+    size_t TextureStreamer::ResidentBytes() const
+    {
+        return residentBytes;
+    }
+
+    GLuint TextureStreamer::Create(GLenum internalFormat, const std::vector<CompressedMip>& mips, std::vector<std::vector<unsigned char> >& layers)
+    {
+        if (mips.empty() || layers.empty()) {
+            return 0;
+        }
+
+        GLuint id;
+        glGenTextures(1, &id);
+        StreamedTexture& texture = textures[id];
+        texture.target = layers.size() > 1 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+        texture.internalFormat = internalFormat;
+        texture.mips = mips;
+        texture.layers.swap(layers);
+        texture.tailLevel = static_cast<int>(mips.size()) - 1;
+        for (size_t level = 0; level < mips.size(); level++) {
+            if (std::max(mips[level].width, mips[level].height) <= STREAM_TAIL_SIZE) {
+                texture.tailLevel = static_cast<int>(level);
+                break;
+            }
+        }
+        texture.residentLevel = static_cast<int>(mips.size());
+        texture.wantedLevel = static_cast<int>(mips.size());
+        texture.lastUsedFrame = frame;
+
+        GLState::Instance().BindTexture(texture.target, id);
+        glTexParameteri(texture.target, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(mips.size()) - 1);
+        glTexParameteri(texture.target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(texture.target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(texture.target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(texture.target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        GLState::Instance().BindTexture(texture.target, 0);
+
+        // coarse to fine, so the base level only ever moves down
+        for (int level = static_cast<int>(mips.size()) - 1; level >= texture.tailLevel; level--) {
+            UploadLevel(id, texture, level);
+        }
+        return id;
+    }
+
+    void TextureStreamer::Remove(GLuint id)
+    {
+        std::unordered_map<GLuint, StreamedTexture>::iterator found = textures.find(id);
+        if (found == textures.end()) {
+            return;
+        }
+        const StreamedTexture& texture = found->second;
+        for (int level = texture.residentLevel; level < static_cast<int>(texture.mips.size()); level++) {
+            residentBytes -= LevelBytes(texture, level);
+        }
+        textures.erase(found);
+    }
+
+    void TextureStreamer::Request(GLuint id, float uvPerPixel)
+    {
+        std::unordered_map<GLuint, StreamedTexture>::iterator found = textures.find(id);
+        if (found == textures.end()) {
+            return;
+        }
+        StreamedTexture& texture = found->second;
+
+        // one texel per pixel at the chosen level; round down to stay sharp
+        int level = 0;
+        float texelsPerPixel = uvPerPixel * std::max(texture.mips[0].width, texture.mips[0].height);
+        if (texelsPerPixel > 1.0f) {
+            level = std::min(static_cast<int>(std::floor(std::log2(texelsPerPixel))), static_cast<int>(texture.mips.size()) - 1);
+        }
+
+        texture.wantedLevel = std::min(texture.wantedLevel, level);
+        texture.lastUsedFrame = frame;
+    }
+
+    void TextureStreamer::Update(double budgetSeconds)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        // the textures furthest from what they need go first
+        std::vector<std::pair<int, GLuint> > upgrades;
+        for (std::unordered_map<GLuint, StreamedTexture>::iterator it = textures.begin(); it != textures.end(); ++it) {
+            const StreamedTexture& texture = it->second;
+            if (texture.lastUsedFrame == frame && texture.wantedLevel < texture.residentLevel) {
+                upgrades.push_back(std::make_pair(texture.residentLevel - texture.wantedLevel, it->first));
+            }
+        }
+        std::sort(upgrades.begin(), upgrades.end(), std::greater<std::pair<int, GLuint> >());
+
+        // one level per texture per pass, so every texture sharpens a little each frame
+        bool progress = !upgrades.empty();
+        bool outOfTime = false;
+        while (progress && !outOfTime) {
+            progress = false;
+            for (size_t i = 0; i < upgrades.size() && !outOfTime; i++) {
+                GLuint id = upgrades[i].second;
+                StreamedTexture& texture = textures[id];
+                if (texture.residentLevel <= texture.wantedLevel) {
+                    continue;
+                }
+                int level = texture.residentLevel - 1;
+                if (!MakeRoom(LevelBytes(texture, level), id)) {
+                    continue;
+                }
+                UploadLevel(id, texture, level);
+                progress = true;
+
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                outOfTime = elapsed.count() >= budgetSeconds;
+            }
+        }
+
+        frame++;
+        for (std::unordered_map<GLuint, StreamedTexture>::iterator it = textures.begin(); it != textures.end(); ++it) {
+            it->second.wantedLevel = static_cast<int>(it->second.mips.size());
+        }
+    }
+
+    size_t TextureStreamer::LevelBytes(const StreamedTexture& texture, int level)
+    {
+        return texture.mips[level].size * texture.layers.size();
+    }
+
+    void TextureStreamer::UploadLevel(GLuint id, StreamedTexture& texture, int level)
+    {
+        const CompressedMip& mip = texture.mips[level];
+        GLState::Instance().BindTexture(texture.target, id);
+        if (texture.target == GL_TEXTURE_2D) {
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, texture.internalFormat, mip.width, mip.height, 0,
+                static_cast<GLsizei>(mip.size), texture.layers[0].data() + mip.offset);
+        }
+        else {
+            // allocate the level for every layer, then fill the layers one by one
+            GLsizei layerCount = static_cast<GLsizei>(texture.layers.size());
+            glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, texture.internalFormat, mip.width, mip.height, layerCount, 0,
+                static_cast<GLsizei>(LevelBytes(texture, level)), NULL);
+            for (GLsizei layer = 0; layer < layerCount; layer++) {
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, mip.width, mip.height, 1, texture.internalFormat,
+                    static_cast<GLsizei>(mip.size), texture.layers[layer].data() + mip.offset);
+            }
+        }
+        glTexParameteri(texture.target, GL_TEXTURE_BASE_LEVEL, level);
+        GLState::Instance().BindTexture(texture.target, 0);
+
+        texture.residentLevel = level;
+        residentBytes += LevelBytes(texture, level);
+    }
+
+    void TextureStreamer::EvictLevel(GLuint id, StreamedTexture& texture)
+    {
+        int level = texture.residentLevel;
+        GLState::Instance().BindTexture(texture.target, id);
+        glTexParameteri(texture.target, GL_TEXTURE_BASE_LEVEL, level + 1);
+        // a 0x0 image releases the level's storage
+        if (texture.target == GL_TEXTURE_2D) {
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, texture.internalFormat, 0, 0, 0, 0, NULL);
+        }
+        else {
+            glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, texture.internalFormat, 0, 0, 0, 0, 0, NULL);
+        }
+        GLState::Instance().BindTexture(texture.target, 0);
+
+        texture.residentLevel = level + 1;
+        residentBytes -= LevelBytes(texture, level);
+    }
+
+    int TextureStreamer::KeepLevel(const StreamedTexture& texture) const
+    {
+        if (texture.lastUsedFrame == frame) {
+            return std::min(texture.wantedLevel, texture.tailLevel);
+        }
+        return texture.tailLevel;
+    }
+
+    bool TextureStreamer::MakeRoom(size_t bytes, GLuint keep)
+    {
+        while (residentBytes + bytes > budget) {
+            // least recently used first; among equals, the one freeing the most
+            GLuint victim = 0;
+            StreamedTexture* victimTexture = NULL;
+            for (std::unordered_map<GLuint, StreamedTexture>::iterator it = textures.begin(); it != textures.end(); ++it) {
+                StreamedTexture& texture = it->second;
+                if (it->first == keep || texture.residentLevel >= KeepLevel(texture)) {
+                    continue;
+                }
+                if (victimTexture == NULL || texture.lastUsedFrame < victimTexture->lastUsedFrame ||
+                    (texture.lastUsedFrame == victimTexture->lastUsedFrame &&
+                        LevelBytes(texture, texture.residentLevel) > LevelBytes(*victimTexture, victimTexture->residentLevel))) {
+                    victim = it->first;
+                    victimTexture = &texture;
+                }
+            }
+            if (victimTexture == NULL) {
+                return false;
+            }
+            EvictLevel(victim, *victimTexture);
+        }
+        return true;
+    }
+
+}
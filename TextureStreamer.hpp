@@ -0,0 +1,83 @@
+#ifndef TextureStreamer_hpp
+#define TextureStreamer_hpp
+
+#include "CompressedTexture.hpp"
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+// Keeps the mip levels of block-compressed textures in system memory and
+// only the ones the current view needs in VRAM. Textures start with their
+// small tail levels; draws report how fine a level they sample, and Update
+// streams finer levels in one at a time, evicting the finest levels of the
+// least recently used textures when the budget would be exceeded.
+class TextureStreamer
+{
+public:
+    static TextureStreamer& Instance();
+
+    // Bytes of streamed levels allowed in VRAM
+    void SetBudget(size_t bytes);
+    size_t Budget() const;
+    size_t ResidentBytes() const;
+
+    // GL thread: creates a texture holding only the levels up to the tail size
+    // and takes over the packed level data for the rest. Several layers (all
+    // with the same layout) make a GL_TEXTURE_2D_ARRAY streamed as a whole.
+    GLuint Create(GLenum internalFormat, const std::vector<CompressedMip>& mips, std::vector<std::vector<unsigned char> >& layers);
+
+    // GL thread: forgets a texture that has been deleted
+    void Remove(GLuint id);
+
+    // GL thread, while drawing: the texture is sampled at `uvPerPixel` texture
+    // coordinate units per screen pixel this frame (0 = needs full resolution).
+    // Ignored for textures that are not streamed.
+    void Request(GLuint id, float uvPerPixel);
+
+    // GL thread, once per frame after the draws: uploads and evicts levels
+    // until the time budget is spent
+    void Update(double budgetSeconds);
+
+private:
+    TextureStreamer();
+    TextureStreamer(const TextureStreamer&);
+    TextureStreamer& operator=(const TextureStreamer&);
+
+    struct StreamedTexture
+    {
+        GLenum target;
+        GLenum internalFormat;
+        std::vector<CompressedMip> mips;
+        std::vector<std::vector<unsigned char> > layers;
+        // finest level in VRAM, and the coarsest one, which always stays
+        int residentLevel;
+        int tailLevel;
+        // finest level asked for this frame; mips.size() when unused
+        int wantedLevel;
+        uint64_t lastUsedFrame;
+    };
+
+    std::unordered_map<GLuint, StreamedTexture> textures;
+    size_t budget;
+    size_t residentBytes;
+    uint64_t frame;
+
+    // VRAM taken by one level of every layer
+    static size_t LevelBytes(const StreamedTexture& texture, int level);
+    void UploadLevel(GLuint id, StreamedTexture& texture, int level);
+    void EvictLevel(GLuint id, StreamedTexture& texture);
+    // frees room for `bytes` more by shedding levels of other textures; false if it cannot
+    bool MakeRoom(size_t bytes, GLuint keep);
+    // finest level that may not be evicted right now
+    int KeepLevel(const StreamedTexture& texture) const;
+};
+
+}
+
+#endif /* TextureStreamer_hpp */
@@ -0,0 +1,94 @@
+#include "ThreadPool.hpp"
+
+namespace gps {
+
+    ThreadPool::ThreadPool(unsigned int threadCount)
+        : stopping(false)
+    {
+        if (threadCount == 0) {
+            unsigned int cores = std::thread::hardware_concurrency();
+            threadCount = cores > 1 ? cores - 1 : 1;
+        }
+
+        for (unsigned int i = 0; i < threadCount; i++) {
+            workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+    }
+
+    void ThreadPool::Enqueue(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(job);
+        }
+        wake.notify_one();
+    }
+
+    unsigned int ThreadPool::ThreadCount() const
+    {
+        return static_cast<unsigned int>(workers.size());
+    }
+
+    void ThreadPool::WorkerLoop()
+    {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                // finish the queue before shutting down
+                if (jobs.empty()) {
+                    return;
+                }
+                job = jobs.front();
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+    TaskGroup::TaskGroup()
+        : pending(0)
+    {
+    }
+
+    TaskGroup::~TaskGroup()
+    {
+        Wait();
+    }
+
+    void TaskGroup::Run(ThreadPool& pool, std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending++;
+        }
+        pool.Enqueue([this, job]() {
+            job();
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0) {
+                finished.notify_all();
+            }
+        });
+    }
+
+    void TaskGroup::Wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this]() { return pending == 0; });
+    }
+
+}
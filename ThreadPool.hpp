@@ -0,0 +1,63 @@
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+    // Fixed set of worker threads running queued jobs in FIFO order.
+    // Jobs must not touch the GL context.
+    class ThreadPool
+    {
+    public:
+        // 0 = one thread per core, minus the GL thread
+        explicit ThreadPool(unsigned int threadCount = 0);
+        ~ThreadPool();
+
+        void Enqueue(std::function<void()> job);
+
+        unsigned int ThreadCount() const;
+
+    private:
+        ThreadPool(const ThreadPool&);
+        ThreadPool& operator=(const ThreadPool&);
+
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()> > jobs;
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool stopping;
+
+        void WorkerLoop();
+    };
+
+    // Jobs submitted to a pool that one thread waits for as a whole
+    class TaskGroup
+    {
+    public:
+        TaskGroup();
+        // Waits for the jobs still running
+        ~TaskGroup();
+
+        // The job must not wait on a group whose jobs queue behind it in the same pool
+        void Run(ThreadPool& pool, std::function<void()> job);
+
+        void Wait();
+
+    private:
+        TaskGroup(const TaskGroup&);
+        TaskGroup& operator=(const TaskGroup&);
+
+        std::mutex mutex;
+        std::condition_variable finished;
+        size_t pending;
+    };
+
+}
+
+#endif /* ThreadPool_hpp */
@@ -8,15 +8,35 @@
 #include <glm/gtc/type_ptr.hpp> //glm extension for accessing the internal data structure of glm types
 
 #include "Window.h"
+#include "GLState.hpp"
+#include "InstanceBuffer.hpp"
 #include "Shader.hpp"
 #include "Camera.hpp"
 #include "Model3D.hpp"
+#include "RenderQueue.hpp"
 #include "SkyBox.hpp"
+#include "Benchmarks.hpp"
 
+#include <algorithm>
 #include <iostream>
+#include <random>
 
 const unsigned int SHADOW_WIDTH = 2048;
 const unsigned int SHADOW_HEIGHT = 2048;
+// time per frame spent uploading models that finished loading in the background
+const double UPLOAD_BUDGET_SECONDS = 0.004;
+// time per frame spent streaming in finer texture levels, and the VRAM they may take
+const double TEXTURE_STREAM_BUDGET_SECONDS = 0.002;
+const size_t TEXTURE_BUDGET_BYTES = 256 * 1024 * 1024;
+// change of the LOD bias per [ / ] key press
+const float LOD_BIAS_STEP = 0.5f;
+// spruces in a ring around the ground, drawn instanced
+const int FOREST_TREES = 2048;
+const float FOREST_INNER_RADIUS = 8.0f;
+const float FOREST_OUTER_RADIUS = 18.0f;
+// angular sectors of the ring, one instance buffer each, so far patches get
+// coarser levels and patches behind the camera are culled
+const int FOREST_PATCHES = 12;
 //const GLfloat near_plane = 0.1f, far_plane = 5.0f;
 
 GLuint shadowMapFBO;
@@ -26,6 +46,10 @@ int fog=0;
 
 bool showDepthMap;
 bool foc;
+// print the GL state calls and render queue work of the next frame
+bool reportGLState;
+// higher values switch to coarser detail levels closer to the camera
+float lodBias = 0.0f;
 
 //GLuint textureID;
 gps::SkyBox mySkyBox;
@@ -73,6 +97,12 @@ gps::Model3D rata;
 gps::Model3D pasari;
 gps::Model3D camion;
 gps::Model3D scena2;
+gps::Model3D spruce;
+gps::InstanceBuffer forest[FOREST_PATCHES];
+
+// draws of the shadow and lit passes, sorted by state before submission
+gps::RenderQueue depthQueue;
+gps::RenderQueue litQueue;
 
 GLfloat angle;
 GLfloat lightAngle;
@@ -147,6 +177,19 @@ void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
     if (key == GLFW_KEY_B && action == GLFW_PRESS)
         fog = !fog;
 
+    if (key == GLFW_KEY_G && action == GLFW_PRESS)
+        reportGLState = true;
+
+    if (key == GLFW_KEY_LEFT_BRACKET && action == GLFW_PRESS) {
+        lodBias -= LOD_BIAS_STEP;
+        gps::Model3D::SetLodBias(lodBias);
+    }
+
+    if (key == GLFW_KEY_RIGHT_BRACKET && action == GLFW_PRESS) {
+        lodBias += LOD_BIAS_STEP;
+        gps::Model3D::SetLodBias(lodBias);
+    }
+
 
 	if (key >= 0 && key < 1024) {
         if (action == GLFW_PRESS) {
@@ -280,31 +323,71 @@ void initOpenGLState() {
 	glClearColor(0.7f, 0.7f, 0.7f, 1.0f);
 	glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
     glEnable(GL_FRAMEBUFFER_SRGB);
-	glEnable(GL_DEPTH_TEST); // enable depth-testing
-	glDepthFunc(GL_LESS); // depth-testing interprets a smaller value as "closer"
-	glEnable(GL_CULL_FACE); // cull face
-	glCullFace(GL_BACK); // cull back face
+	gps::GLState& state = gps::GLState::Instance();
+	state.SetDepthTest(true); // enable depth-testing
+	state.SetDepthFunc(GL_LESS); // depth-testing interprets a smaller value as "closer"
+	state.SetCullFace(true); // cull face
+	state.SetCullFaceMode(GL_BACK); // cull back face
 	glFrontFace(GL_CCW); // GL_CCW for counter clock-wise
 }
 
 void initModels() {
-    brazi.LoadModel("models/brazi/scena.obj");
-    teren.LoadModel("models/brazi/ground.obj");
+    gps::Model3D::SetTextureBudget(TEXTURE_BUDGET_BYTES);
+
+    // small helpers are needed right away
     lightCube.LoadModel("models/cube/cube.obj");
     screenQuad.LoadModel("models/quad/quad.obj");
-    rata.LoadModel("models/brazi/model.obj");
-    pasari.LoadModel("models/brazi/pasari.obj");
-    camion.LoadModel("models/brazi/tanc.obj");
-    scena2.LoadModel("models/brazi/scena2.obj");
+
+    // everything else streams in while the first frames render,
+    // in the order it is needed (scena2 is only shown after pressing N)
+    brazi.LoadModelAsync("models/brazi/scena.obj");
+    teren.LoadModelAsync("models/brazi/ground.obj");
+    camion.LoadModelAsync("models/brazi/tanc.obj");
+    pasari.LoadModelAsync("models/brazi/pasari.obj");
+    rata.LoadModelAsync("models/brazi/model.obj");
+    scena2.LoadModelAsync("models/brazi/scena2.obj");
+    spruce.LoadModelAsync("models/brazi/Spruce.obj");
+
+    // moving objects show a cube until their meshes are resident
+    camion.SetPlaceholder(&lightCube);
+    pasari.SetPlaceholder(&lightCube);
+    rata.SetPlaceholder(&lightCube);
+}
+
+void initForest() {
+    // the same forest every run
+    std::mt19937 random(20);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<glm::mat4> trees[FOREST_PATCHES];
+    for (int i = 0; i < FOREST_TREES; i++) {
+        float turn = unit(random);
+        int patch = std::min(static_cast<int>(turn * FOREST_PATCHES), FOREST_PATCHES - 1);
+        float angle = glm::radians(360.0f * turn);
+        float distance = FOREST_INNER_RADIUS + unit(random) * (FOREST_OUTER_RADIUS - FOREST_INNER_RADIUS);
+        glm::mat4 tree = glm::translate(glm::mat4(1.0f), glm::vec3(std::cos(angle) * distance, -2.0f, std::sin(angle) * distance));
+        tree = glm::rotate(tree, glm::radians(360.0f * unit(random)), glm::vec3(0.0f, 1.0f, 0.0f));
+        // Spruce.obj is z-up and about 11.5 units tall
+        tree = glm::scale(tree, glm::vec3(0.12f + 0.08f * unit(random)));
+        tree = glm::rotate(tree, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+        trees[patch].push_back(tree);
+    }
+    for (int patch = 0; patch < FOREST_PATCHES; patch++) {
+        forest[patch].Update(trees[patch]);
+    }
 }
 
 void initShaders() {
+    // the queued passes become a few multi-draws when the driver has ARB_shader_draw_parameters;
+    // their vertex shaders then read transforms from storage buffers
+    bool multiDrawIndirect = gps::RenderQueue::SupportsMultiDrawIndirect();
 	myBasicShader.loadShader(
-        "shaders/basic.vert",
+        multiDrawIndirect ? "shaders/basicIndirect.vert" : "shaders/basic.vert",
         "shaders/basic.frag");
     skyboxShader.loadShader("shaders/skyboxShader.vert", "shaders/skyboxShader.frag");
     screenQuadShader.loadShader("shaders/screenQuad.vert", "shaders/screenQuad.frag");
-    depthMapShader.loadShader("shaders/FBO.vert", "shaders/FBO.frag");
+    depthMapShader.loadShader(multiDrawIndirect ? "shaders/FBOIndirect.vert" : "shaders/FBO.vert", "shaders/FBO.frag");
+    depthQueue.SetMultiDrawIndirect(multiDrawIndirect);
+    litQueue.SetMultiDrawIndirect(multiDrawIndirect);
     lightShader.loadShader("shaders/lightCube.vert", "shaders/lightCube.frag");
 }
 
@@ -313,41 +396,45 @@ void initUniforms() {
 
     // create model matrix for teapot
     model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -1.0f, 0.0f));
-	modelLoc = glGetUniformLocation(myBasicShader.shaderProgram, "model");
+	modelLoc = myBasicShader.uniformLocation("model");
 
 	// get view matrix for current camera
 	view = myCamera.getViewMatrix();
-	viewLoc = glGetUniformLocation(myBasicShader.shaderProgram, "view");
+	viewLoc = myBasicShader.uniformLocation("view");
 	// send view matrix to shader
     glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 
     // compute normal matrix for teapot
     normalMatrix = glm::mat3(glm::inverseTranspose(view*model));
-	normalMatrixLoc = glGetUniformLocation(myBasicShader.shaderProgram, "normalMatrix");
+	normalMatrixLoc = myBasicShader.uniformLocation("normalMatrix");
 
 	// create projection matrix
 	projection = glm::perspective(glm::radians(45.0f),
                                (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height,
                                0.1f, 20.0f);
-	projectionLoc = glGetUniformLocation(myBasicShader.shaderProgram, "projection");
+	projectionLoc = myBasicShader.uniformLocation("projection");
 	// send projection matrix to shader
 	glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));	
 
+	// array samplers left on unit 0 would clash with the sampler2Ds there
+	glUniform1i(myBasicShader.uniformLocation("diffuseTextureArray"), gps::TEXTURE_ARRAY_UNIT_BASE);
+	glUniform1i(myBasicShader.uniformLocation("specularTextureArray"), gps::TEXTURE_ARRAY_UNIT_BASE + 1);
+
 	//set the light direction (direction towards the light)
 	lightDir = glm::vec3(10.0f, 10.0f, 1.0f);
     lightRotation = glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f));
-	lightDirLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightDir");
+	lightDirLoc = myBasicShader.uniformLocation("lightDir");
 	// send light dir to shader
     glUniform3fv(lightDirLoc, 1, glm::value_ptr(glm::inverseTranspose(glm::mat3(view * lightRotation)) * lightDir));
 
 	//set light color
 	lightColor = glm::vec3(1.0f, 1.0f, 1.0f); //white light
-	lightColorLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightColor");
+	lightColorLoc = myBasicShader.uniformLocation("lightColor");
 	// send light color to shader
 	glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
 
     lightShader.useShaderProgram();
-    glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    glUniformMatrix4fv(lightShader.uniformLocation("projection"), 1, GL_FALSE, glm::value_ptr(projection));
 
     faces.push_back("hills/right.tga");
     faces.push_back("hills/left.tga");
@@ -360,19 +447,23 @@ void initUniforms() {
 
     skyboxShader.useShaderProgram();
     view = myCamera.getViewMatrix();
-    glUniformMatrix4fv(glGetUniformLocation(skyboxShader.shaderProgram, "view"), 1, GL_FALSE,
+    glUniformMatrix4fv(skyboxShader.uniformLocation("view"), 1, GL_FALSE,
         glm::value_ptr(view));
 
     projection = glm::perspective(glm::radians(45.0f), (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height, 0.1f, 1000.0f);
-    glUniformMatrix4fv(glGetUniformLocation(skyboxShader.shaderProgram, "projection"), 1, GL_FALSE,
+    glUniformMatrix4fv(skyboxShader.uniformLocation("projection"), 1, GL_FALSE,
         glm::value_ptr(projection));
 
 
 }
 
+glm::mat4 computeLightView() {
+    return glm::lookAt(glm::mat3(lightRotation) * lightDir, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
 glm::mat4 computeLightSpaceTrMatrix() {
     //TODO - Return the light-space transformation matrix
-    glm::mat4 lightView = glm::lookAt(glm::mat3(lightRotation) * lightDir, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 lightView = computeLightView();
     const GLfloat near_plane = 0.1f, far_plane = 30.0f;
     glm::mat4 lightProjection = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, near_plane, far_plane);
     glm::mat4 lightSpaceTrMatrix = lightProjection * lightView;
@@ -388,7 +479,7 @@ void initFBO() {
 
     //create depth texture for FBO
     glGenTextures(1, &depthMapTexture);
-    glBindTexture(GL_TEXTURE_2D, depthMapTexture);
+    gps::GLState::Instance().BindTexture(GL_TEXTURE_2D, depthMapTexture);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
         SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -419,7 +510,8 @@ double lastTimeStamp = glfwGetTime();
 float rotate = 0.0f;
 float delta = 0.0f;
 
-void renderObject(gps::Shader shader,bool depthPass) {
+// Queues the scene objects; the render queue sets the model and normal matrix of each
+void renderObject(gps::Shader shader) {
 
 
     // select active shader program
@@ -436,21 +528,12 @@ void renderObject(gps::Shader shader,bool depthPass) {
         model = glm::rotate(model, glm::radians(-90.0f + rotate), glm::vec3(0.0f, 1.0f, 0.0f));
     }
     model = glm::scale(model, glm::vec3(0.5f, 0.5f, 0.5f));
-    //send teapot model matrix data to shader
-    //glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    //send teapot normal matrix data to shader
-    //glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    }
     if (foc == false) {
         // draw teapot
-        brazi.Draw(shader);
+        brazi.Draw(shader, model);
     }
     else {
-        scena2.Draw(shader);
+        scena2.Draw(shader, model);
 
         delta2 += 0.01;
 
@@ -462,15 +545,8 @@ void renderObject(gps::Shader shader,bool depthPass) {
         }
         model = glm::rotate(model, glm::radians(170.0f), glm::vec3(0.0f, 1.0f, 0.0f));
         model = glm::scale(model, glm::vec3(0.5f, 0.5f, 0.5f));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-        //send teapot normal matrix data to shader
-        //glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-        if (!depthPass) {
-            normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-            glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-        }
         // draw teapot
-        camion.Draw(shader);
+        camion.Draw(shader, model);
     }
 
 
@@ -482,17 +558,12 @@ void renderObject(gps::Shader shader,bool depthPass) {
         model = glm::rotate(model, glm::radians(-90.0f + rotate), glm::vec3(0.0f, 1.0f, 0.0f));
     }
     model = glm::scale(model, glm::vec3(0.5f, 0.5f, 0.5f));
-    //send teapot model matrix data to shader
-    //glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    //send teapot normal matrix data to shader
-    //glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    }
     // draw teapot
-    teren.Draw(shader);
+    teren.Draw(shader, model);
+
+    for (int patch = 0; patch < FOREST_PATCHES; patch++) {
+        spruce.DrawInstanced(shader, forest[patch]);
+    }
 
     model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 1.0f, 8.0f-(3 * delta)));
     if (ok == 0) {
@@ -503,17 +574,8 @@ void renderObject(gps::Shader shader,bool depthPass) {
         model = glm::rotate(model, glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f));
     }
     model = glm::scale(model, glm::vec3(0.5f, 0.5f, 0.5f));
-    //send teapot model matrix data to shader
-    //glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    //send teapot normal matrix data to shader
-    //glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    }
     // draw teapot
-    pasari.Draw(shader);
+    pasari.Draw(shader, model);
 
     float delta2;
     if (delta  > 5.0f) {
@@ -536,22 +598,18 @@ void renderObject(gps::Shader shader,bool depthPass) {
         model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
     }
     //model = glm::scale(model, glm::vec3(0.5f, 0.5f, 0.5f));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    //send teapot normal matrix data to shader
-    //glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    }
     // draw teapot
     if(rotate > 360)
-        rata.Draw(shader);
+        rata.Draw(shader, model);
 }
 
 void renderScene() {
 
+    // both passes draw the same detail levels, so shadows match the lit geometry
+    gps::Model3D::SetLodCamera(myCamera.getViewMatrix(), projection, myWindow.getWindowDimensions().height);
+
     depthMapShader.useShaderProgram();
-    glUniformMatrix4fv(glGetUniformLocation(depthMapShader.shaderProgram, "lightSpaceTrMatrix"),
+    glUniformMatrix4fv(depthMapShader.uniformLocation("lightSpaceTrMatrix"),
         1,
         GL_FALSE,
         glm::value_ptr(computeLightSpaceTrMatrix()));
@@ -559,7 +617,13 @@ void renderScene() {
     glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
     glClear(GL_DEPTH_BUFFER_BIT);
     
-    renderObject(depthMapShader, true);
+    // shadow casters only need to be inside the light's frustum
+    gps::Model3D::SetCullingView(glm::mat4(1.0f), computeLightSpaceTrMatrix(), false);
+    depthQueue.Begin(0, computeLightView());
+    gps::Model3D::SetRenderQueue(&depthQueue);
+    renderObject(depthMapShader);
+    gps::Model3D::SetRenderQueue(NULL);
+    depthQueue.Submit();
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -572,13 +636,12 @@ void renderScene() {
         screenQuadShader.useShaderProgram();
 
         //bind the depth map
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-        glUniform1i(glGetUniformLocation(screenQuadShader.shaderProgram, "depthMap"), 0);
+        gps::GLState::Instance().BindTexture(0, GL_TEXTURE_2D, depthMapTexture);
+        glUniform1i(screenQuadShader.uniformLocation("depthMap"), 0);
 
-        glDisable(GL_DEPTH_TEST);
+        gps::GLState::Instance().SetDepthTest(false);
         screenQuad.Draw(screenQuadShader);
-        glEnable(GL_DEPTH_TEST);
+        gps::GLState::Instance().SetDepthTest(true);
     }
     else {
 
@@ -597,29 +660,33 @@ void renderScene() {
 		glUniform3fv(lightDirLoc, 1, glm::value_ptr(glm::inverseTranspose(glm::mat3(view * lightRotation)) * lightDir));
 
         //bind the shadow map
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-        glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "shadowMap"), 3);
+        gps::GLState::Instance().BindTexture(3, GL_TEXTURE_2D, depthMapTexture);
+        glUniform1i(myBasicShader.uniformLocation("shadowMap"), 3);
 
-        //glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "fog"), fog);
+        //glUniform1i(myBasicShader.uniformLocation("fog"), fog);
 
-        glUniformMatrix4fv(glGetUniformLocation(myBasicShader.shaderProgram, "lightSpaceTrMatrix"),
+        glUniformMatrix4fv(myBasicShader.uniformLocation("lightSpaceTrMatrix"),
             1,
             GL_FALSE,
             glm::value_ptr(computeLightSpaceTrMatrix()));
 
-        renderObject(myBasicShader, false);
+        gps::Model3D::SetCullingView(view, projection, true);
+        litQueue.Begin(0, view);
+        gps::Model3D::SetRenderQueue(&litQueue);
+        renderObject(myBasicShader);
+        gps::Model3D::SetRenderQueue(NULL);
+        litQueue.Submit();
 
         //draw a white cube around the light
 
         lightShader.useShaderProgram();
 
-        glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(lightShader.uniformLocation("view"), 1, GL_FALSE, glm::value_ptr(view));
 
         model = lightRotation;
         model = glm::translate(model, 1.0f * lightDir);
         model = glm::scale(model, glm::vec3(0.05f, 0.05f, 0.05f));
-        glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
+        glUniformMatrix4fv(lightShader.uniformLocation("model"), 1, GL_FALSE, glm::value_ptr(model));
 
         lightCube.Draw(lightShader);
         mySkyBox.Draw(skyboxShader, view, projection);
@@ -629,13 +696,50 @@ void renderScene() {
     }
 }
 
+void printRenderQueueStats(const char* pass, const gps::RenderQueue& queue) {
+    const gps::RenderQueue::Stats& stats = queue.LastStats();
+    std::cout << pass << " pass: " << stats.items << " draws sorted in " << stats.sortMilliseconds << " ms, "
+        << stats.programChanges << " program, " << stats.meshChanges << " mesh, " << stats.materialChanges << " material and "
+        << stats.transformChanges << " transform changes, " << stats.drawCalls << " draw calls" << std::endl;
+}
+
+void printFrameStats() {
+    const char* names[gps::GLState::STATE_KIND_COUNT] = { "program", "vertex array", "texture", "depth", "cull" };
+    for (int kind = 0; kind < gps::GLState::STATE_KIND_COUNT; kind++) {
+        gps::GLState::Counters counters = gps::GLState::Instance().GetCounters(static_cast<gps::GLState::Kind>(kind));
+        std::cout << names[kind] << ": " << counters.issued << " issued, " << counters.skipped << " skipped" << std::endl;
+    }
+    gps::GLState::Counters total = gps::GLState::Instance().GetTotalCounters();
+    std::cout << "GL state calls this frame: " << total.issued << " issued, " << total.skipped << " skipped" << std::endl;
+    printRenderQueueStats("shadow", depthQueue);
+    printRenderQueueStats("lit", litQueue);
+}
+
 void cleanup() {
+    gps::Model3D::Shutdown();
     myWindow.Delete();
     //cleanup code for your own data
 }
 
 int main(int argc, const char * argv[]) {
 
+    // proiect.exe --bench-obj [file.obj ...]     : OBJ parser throughput, no window
+    // proiect.exe --bench-numbers [file.obj ...] : number parsing only, per core
+    std::string mode = argc > 1 ? argv[1] : "";
+    if (mode == "--bench-obj" || mode == "--bench-numbers") {
+        std::vector<std::string> files(argv + 2, argv + argc);
+        if (files.empty()) {
+            files.push_back("models/brazi/ground.obj");
+            files.push_back("models/brazi/tanc.obj");
+            files.push_back("models/teapot/teapot20segUT.obj");
+        }
+        if (mode == "--bench-obj") {
+            gps::RunObjParseBenchmark(files);
+        } else {
+            gps::RunObjNumberBenchmark(files);
+        }
+        return EXIT_SUCCESS;
+    }
 
     try {
         initOpenGLWindow();
@@ -646,6 +750,7 @@ int main(int argc, const char * argv[]) {
 
     initOpenGLState();
 	initModels();
+	initForest();
 	initShaders();
 	initUniforms();
     setWindowCallbacks();
@@ -654,8 +759,15 @@ int main(int argc, const char * argv[]) {
 	glCheckError();
 	// application loop
 	while (!glfwWindowShouldClose(myWindow.getWindow())) {
+        gps::Model3D::ProcessPendingUploads(UPLOAD_BUDGET_SECONDS);
         processMovement();
+        gps::GLState::Instance().ResetCounters();
 	    renderScene();
+        if (reportGLState) {
+            reportGLState = false;
+            printFrameStats();
+        }
+        gps::Model3D::StreamTextures(TEXTURE_STREAM_BUDGET_SECONDS);
 
 		glfwPollEvents();
 		glfwSwapBuffers(myWindow.getWindow());
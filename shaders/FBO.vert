@@ -1,9 +1,18 @@
 #version 410 core
 
 layout(location=0) in vec3 vPosition;
+// per-instance model matrix, see gps::InstanceBuffer
+layout(location=3) in mat4 instanceModel;
 uniform mat4 lightSpaceTrMatrix;
 uniform mat4 model;
+uniform bool instanced;
+
+// compact vertex decode, see gps::CompactVertex
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+
 void main()
 {
- gl_Position = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
+ mat4 modelMatrix = instanced ? instanceModel : model;
+ gl_Position = lightSpaceTrMatrix * modelMatrix * vec4(positionOffset + vPosition * positionScale, 1.0f);
 }
@@ -0,0 +1,35 @@
+#version 430 core
+#extension GL_ARB_shader_draw_parameters : require
+
+layout(location=0) in vec3 vPosition;
+// per-instance model matrix, see gps::InstanceBuffer
+layout(location=3) in mat4 instanceModel;
+uniform mat4 lightSpaceTrMatrix;
+// record of the first command of the current multi-draw
+uniform uint drawOffset;
+
+// per-draw data uploaded by gps::RenderQueue, see basicIndirect.vert
+struct Transform
+{
+	mat4 model;
+	mat4 normalMatrix;
+};
+struct Draw
+{
+	uint transform;
+	int diffuseLayer;
+	int specularLayer;
+	uint instanced;
+	vec4 positionScale;
+	vec4 positionOffset;
+};
+layout(std430, binding = 0) readonly buffer Transforms { Transform transforms[]; };
+layout(std430, binding = 1) readonly buffer Draws { Draw draws[]; };
+
+void main()
+{
+ Draw draw = draws[drawOffset + uint(gl_DrawIDARB)];
+ vec3 position = draw.positionOffset.xyz + vPosition * draw.positionScale.xyz;
+ mat4 model = draw.instanced != 0u ? instanceModel : transforms[draw.transform].model;
+ gl_Position = lightSpaceTrMatrix * model * vec4(position, 1.0f);
+}
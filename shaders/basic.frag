@@ -1,16 +1,17 @@
 #version 410 core
 
-in vec3 fPosition;
-in vec3 fNormal;
+in vec3 fPosEye;
+in vec3 fNormalEye;
 in vec2 fTexCoords;
 in vec4 fragPosLightSpace;
+// array layers of the textures, -1 for the plain samplers
+flat in int fDiffuseLayer;
+flat in int fSpecularLayer;
 
 out vec4 fColor;
 
 //matrices
-uniform mat4 model;
 uniform mat4 view;
-uniform mat3 normalMatrix;
  
 //lighting
 uniform vec3 lightDir;
@@ -19,6 +20,9 @@ uniform vec3 lightColor;
 uniform sampler2D diffuseTexture;
 uniform sampler2D specularTexture;
 uniform sampler2D shadowMap;
+// textures packed into arrays
+uniform sampler2DArray diffuseTextureArray;
+uniform sampler2DArray specularTextureArray;
 
 //components
 vec3 ambient;
@@ -43,15 +47,14 @@ float computeShadow(){
 
 void computeDirLight()
 {
-    //compute eye space coordinates
-    vec4 fPosEye = view * model * vec4(fPosition, 1.0f);
-    vec3 normalEye = normalize(normalMatrix * fNormal);
+    //eye space coordinates come from the vertex shader
+    vec3 normalEye = normalize(fNormalEye);
 
     //normalize light direction
     vec3 lightDirN = vec3(normalize(view * vec4(lightDir, 0.0f)));
 
     //compute view direction (in eye coordinates, the viewer is situated at the origin
-    vec3 viewDir = normalize(- fPosEye.xyz);
+    vec3 viewDir = normalize(- fPosEye);
 
     //compute ambient light
     ambient = ambientStrength * lightColor;
@@ -71,9 +74,14 @@ void main()
 	
 	vec3 baseColor = vec3(0.9f, 0.35f, 0.0f);//orange
 	
-	ambient *= texture(diffuseTexture, fTexCoords).rgb;
-	diffuse *= texture(diffuseTexture, fTexCoords).rgb;
-	specular *= texture(specularTexture, fTexCoords).rgb;
+	vec3 diffuseColor = fDiffuseLayer < 0 ? texture(diffuseTexture, fTexCoords).rgb
+		: texture(diffuseTextureArray, vec3(fTexCoords, fDiffuseLayer)).rgb;
+	vec3 specularColor = fSpecularLayer < 0 ? texture(specularTexture, fTexCoords).rgb
+		: texture(specularTextureArray, vec3(fTexCoords, fSpecularLayer)).rgb;
+
+	ambient *= diffuseColor;
+	diffuse *= diffuseColor;
+	specular *= specularColor;
 	float shadow = computeShadow();
 
 	vec3 color = min((ambient + (1.0f - shadow) * diffuse) + (1.0f - shadow) * specular, 1.0f);
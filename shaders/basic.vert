@@ -3,22 +3,61 @@
 layout(location=0) in vec3 vPosition;
 layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoords;
+// per-instance transforms, see gps::InstanceBuffer
+layout(location=3) in mat4 instanceModel;
+layout(location=7) in mat3 instanceNormalMatrix;
 
-out vec3 fPosition;
-out vec3 fNormal;
+out vec3 fPosEye;
+out vec3 fNormalEye;
 out vec2 fTexCoords;
 out vec4 fragPosLightSpace;
+flat out int fDiffuseLayer;
+flat out int fSpecularLayer;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform mat3 normalMatrix;
 uniform mat4 lightSpaceTrMatrix;
+// take the transforms from the instance attributes instead of model and normalMatrix
+uniform bool instanced;
+// layers of the textures packed into arrays; -1 selects the plain samplers
+uniform int diffuseTextureLayer = -1;
+uniform int specularTextureLayer = -1;
+
+// compact vertex decode, see gps::CompactVertex
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+uniform bool octahedralNormals;
+
+vec3 decodeNormal(vec3 n)
+{
+	if (!octahedralNormals)
+		return n;
+	// unfold the octahedron; z is unused in the compact format
+	n.z = 1.0f - abs(n.x) - abs(n.y);
+	float t = max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+	return normalize(n);
+}
 
 void main() 
 {
-	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
-	fPosition = vPosition;
-	fNormal = vNormal;
+	mat4 modelMatrix = model;
+	mat3 normalMatrixEye = normalMatrix;
+	if (instanced) {
+		// the view is rigid, so its rotation carries the normals over to eye space
+		modelMatrix = instanceModel;
+		normalMatrixEye = mat3(view) * instanceNormalMatrix;
+	}
+	vec3 position = positionOffset + vPosition * positionScale;
+	vec4 posEye = view * modelMatrix * vec4(position, 1.0f);
+	gl_Position = projection * posEye;
+	fPosEye = posEye.xyz;
+	fNormalEye = normalMatrixEye * decodeNormal(vNormal);
 	fTexCoords = vTexCoords;
-	fragPosLightSpace = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
+	fragPosLightSpace = lightSpaceTrMatrix * modelMatrix * vec4(position, 1.0f);
+	fDiffuseLayer = diffuseTextureLayer;
+	fSpecularLayer = specularTextureLayer;
 }
@@ -0,0 +1,78 @@
+#version 430 core
+#extension GL_ARB_shader_draw_parameters : require
+
+layout(location=0) in vec3 vPosition;
+layout(location=1) in vec3 vNormal;
+layout(location=2) in vec2 vTexCoords;
+// per-instance transforms, see gps::InstanceBuffer
+layout(location=3) in mat4 instanceModel;
+layout(location=7) in mat3 instanceNormalMatrix;
+
+out vec3 fPosEye;
+out vec3 fNormalEye;
+out vec2 fTexCoords;
+out vec4 fragPosLightSpace;
+flat out int fDiffuseLayer;
+flat out int fSpecularLayer;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform mat4 lightSpaceTrMatrix;
+uniform bool octahedralNormals;
+// record of the first command of the current multi-draw
+uniform uint drawOffset;
+
+// per-draw data uploaded by gps::RenderQueue, indexed by gl_DrawIDARB
+struct Transform
+{
+	mat4 model;
+	mat4 normalMatrix;
+};
+struct Draw
+{
+	uint transform;
+	int diffuseLayer;
+	int specularLayer;
+	uint instanced;
+	vec4 positionScale;
+	vec4 positionOffset;
+};
+layout(std430, binding = 0) readonly buffer Transforms { Transform transforms[]; };
+layout(std430, binding = 1) readonly buffer Draws { Draw draws[]; };
+
+vec3 decodeNormal(vec3 n)
+{
+	if (!octahedralNormals)
+		return n;
+	// unfold the octahedron; z is unused in the compact format
+	n.z = 1.0f - abs(n.x) - abs(n.y);
+	float t = max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+	return normalize(n);
+}
+
+void main() 
+{
+	Draw draw = draws[drawOffset + uint(gl_DrawIDARB)];
+	mat4 model;
+	mat3 normalMatrix;
+	if (draw.instanced != 0u) {
+		// the view is rigid, so its rotation carries the normals over to eye space
+		model = instanceModel;
+		normalMatrix = mat3(view) * instanceNormalMatrix;
+	}
+	else {
+		model = transforms[draw.transform].model;
+		normalMatrix = mat3(transforms[draw.transform].normalMatrix);
+	}
+	vec3 position = draw.positionOffset.xyz + vPosition * draw.positionScale.xyz;
+	vec4 posEye = view * model * vec4(position, 1.0f);
+	gl_Position = projection * posEye;
+	fPosEye = posEye.xyz;
+	fNormalEye = normalMatrix * decodeNormal(vNormal);
+	fTexCoords = vTexCoords;
+	fragPosLightSpace = lightSpaceTrMatrix * model * vec4(position, 1.0f);
+	fDiffuseLayer = draw.diffuseLayer;
+	fSpecularLayer = draw.specularLayer;
+}
@@ -8,7 +8,11 @@ uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+// compact vertex decode, see gps::CompactVertex
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+
 void main() 
 {
-	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
+	gl_Position = projection * view * model * vec4(positionOffset + vPosition * positionScale, 1.0f);
 }
@@ -23,6 +23,9 @@
  */
 
 //
+// local         : Add LoadObjParallel(), a multi-threaded chunked parser
+// local         : Parse numbers in place with a fast path in LoadObjParallel()
+// local         : LoadObjParallel() reports the .mtl files it looked for
 // version 1.0.2 : Improve parsing speed by about a factor of 2 for large files(#105)
 // version 1.0.1 : Fixes a shape is lost if obj ends with a 'usemtl'(#104)
 // version 1.0.0 : Change data structure. Change license from BSD to MIT.
@@ -228,6 +231,26 @@ namespace tinyobj {
                  std::istream *inStream, MaterialReader *readMatFn = NULL,
                  bool triangulate = true);
     
+    /// Loads .obj from a file like LoadObj(), but splits the file into
+    /// newline-aligned chunks and parses them on `num_threads` threads
+    /// (0 = all hardware threads). The output is identical to LoadObj(),
+    /// except that vertex attributes may differ from it by 1 ulp: numbers are
+    /// parsed in place with a correctly rounded fast path.
+    /// The path of every .mtl file named by the .obj, found or not, is
+    /// appended to `mtl_filenames` if given.
+    bool LoadObjParallel(attrib_t *attrib, std::vector<shape_t> *shapes,
+                         std::vector<material_t> *materials, std::string *err,
+                         const char *filename, const char *mtl_basepath = NULL,
+                         bool triangulate = true, unsigned int num_threads = 0,
+                         std::vector<std::string> *mtl_filenames = NULL);
+    
+    /// Parses the numbers of every `v`, `vn` and `vt` line of .obj text into
+    /// `values`, with the fast path used by LoadObjParallel() or, when
+    /// `reference` is true, with the one used by LoadObj().
+    /// Exposed for benchmarking the number parser on its own.
+    void ParseObjAttributes(const char *text, size_t length,
+                            std::vector<float> *values, bool reference);
+    
     /// Loads materials into std::map
     void LoadMtl(std::map<std::string, int> *material_map,
                  std::vector<material_t> *materials, std::istream *inStream);
@@ -243,8 +266,11 @@ namespace tinyobj {
 #include <cstring>
 #include <utility>
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <sstream>
+#include <thread>
 
 namespace tinyobj {
     
@@ -511,6 +537,130 @@ namespace tinyobj {
         (*w) = parseFloat(token, 1.0);
     }
     
+    // Powers of ten that are exact in a double.
+    static const double kExactPow10[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+    
+    // Same grammar as tryParseDouble(), with a fast path for the common case:
+    // up to 19 significant digits are accumulated in an integer and scaled by
+    // one exact power of ten (Clinger's fast path), which gives the correctly
+    // rounded double. Anything longer or with a larger exponent falls back to
+    // tryParseDouble().
+    static bool tryParseDoubleFast(const char *s, const char *s_end,
+                                   double *result) {
+        if (s >= s_end) {
+            return false;
+        }
+        
+        const char *curr = s;
+        bool negative = false;
+        if (*curr == '+' || *curr == '-') {
+            negative = (*curr == '-');
+            curr++;
+        }
+        
+        unsigned long long mantissa = 0;
+        int digits = 0;  // significant digits in `mantissa`
+        int exponent = 0;
+        
+        // Read the integer part; at least one digit is required.
+        const char *int_begin = curr;
+        while (curr != s_end && IS_DIGIT(*curr)) {
+            if (digits == 19) return tryParseDouble(s, s_end, result);
+            mantissa = mantissa * 10 + static_cast<unsigned int>(*curr - '0');
+            if (mantissa != 0) digits++;
+            curr++;
+        }
+        if (curr == int_begin) return false;
+        
+        // Read the decimal part.
+        if (curr != s_end && *curr == '.') {
+            curr++;
+            while (curr != s_end && IS_DIGIT(*curr)) {
+                if (digits == 19) return tryParseDouble(s, s_end, result);
+                mantissa = mantissa * 10 + static_cast<unsigned int>(*curr - '0');
+                if (mantissa != 0) digits++;
+                exponent--;
+                curr++;
+            }
+        }
+        
+        // Read the exponent part; an empty exponent is not allowed.
+        if (curr != s_end && (*curr == 'e' || *curr == 'E')) {
+            curr++;
+            bool exp_negative = false;
+            if (curr != s_end && (*curr == '+' || *curr == '-')) {
+                exp_negative = (*curr == '-');
+                curr++;
+            }
+            const char *exp_begin = curr;
+            int exp_value = 0;
+            while (curr != s_end && IS_DIGIT(*curr)) {
+                if (exp_value < 100000) exp_value = exp_value * 10 + (*curr - '0');
+                curr++;
+            }
+            if (curr == exp_begin) return false;
+            exponent += exp_negative ? -exp_value : exp_value;
+        }
+        
+        double value = 0.0;
+        if (mantissa != 0) {
+            if (mantissa > (1ULL << 53) || exponent < -22 || exponent > 22) {
+                return tryParseDouble(s, s_end, result);
+            }
+            value = static_cast<double>(mantissa);
+            if (exponent < 0) {
+                value /= kExactPow10[-exponent];
+            } else {
+                value *= kExactPow10[exponent];
+            }
+        }
+        *result = negative ? -value : value;
+        return true;
+    }
+    
+    // parseFloat() over the line [*token, line_end), which need not be
+    // terminated.
+    static inline float parseFloatInPlace(const char **token,
+                                          const char *line_end,
+                                          double default_value = 0.0) {
+        while ((*token) != line_end && IS_SPACE(**token)) (*token)++;
+        const char *end = (*token);
+        while (end != line_end && !IS_SPACE(*end) && *end != '\r' &&
+               *end != '\0')
+            end++;
+        double val = default_value;
+        tryParseDoubleFast((*token), end, &val);
+        (*token) = end;
+        return static_cast<float>(val);
+    }
+    
+    // atoi() over [s, s_end).
+    static inline int parseIntInPlace(const char *s, const char *s_end) {
+        while (s != s_end && IS_SPACE(*s)) s++;
+        bool negative = false;
+        if (s != s_end && (*s == '+' || *s == '-')) {
+            negative = (*s == '-');
+            s++;
+        }
+        int value = 0;
+        while (s != s_end && IS_DIGIT(*s)) {
+            value = value * 10 + (*s - '0');
+            s++;
+        }
+        return negative ? -value : value;
+    }
+    
+    // strcspn(s, "/ \t\r") over [s, s_end).
+    static inline const char *skipIndexInPlace(const char *s, const char *s_end) {
+        while (s != s_end && *s != '/' && !IS_SPACE(*s) && *s != '\r' &&
+               *s != '\0')
+            s++;
+        return s;
+    }
+    
     static tag_sizes parseTagTriple(const char **token) {
         tag_sizes ts;
         
@@ -1377,6 +1527,668 @@ namespace tinyobj {
         return true;
     }
     
+    // ---------------------------------------------------------------------
+    // Parallel parser
+    //
+    // The file is split into newline-aligned chunks that are parsed on all
+    // cores. Each chunk collects its own `v`/`vn`/`vt` arrays, a flat list
+    // of face corners and an ordered list of records (face runs, usemtl,
+    // mtllib, g, o, t). Relative (negative) indices are resolved against
+    // the chunk-local counts and rebased with prefix-sum offsets during the
+    // merge. Records are then replayed in file order to build the shapes
+    // exactly as LoadObj() does.
+    
+    struct obj_chunk {
+        enum record_type {
+            RECORD_FACES,
+            RECORD_USEMTL,
+            RECORD_MTLLIB,
+            RECORD_GROUP,
+            RECORD_OBJECT,
+            RECORD_TAG
+        };
+        
+        struct record {
+            int type;
+            size_t begin;   // first face (RECORD_FACES) or string/tag slot
+            size_t end;     // one past the last face (RECORD_FACES)
+            size_t corner;  // first corner of face `begin` (RECORD_FACES)
+        };
+        
+        // corner whose components were given as relative indices.
+        // mask bits: 1 = v, 2 = vt, 4 = vn
+        struct relative_index {
+            size_t corner;
+            int mask;
+        };
+        
+        const char *text_begin;
+        const char *text_end;
+        
+        std::vector<float> v;
+        std::vector<float> vn;
+        std::vector<float> vt;
+        std::vector<vertex_index> corners;
+        std::vector<int> face_sizes;
+        std::vector<relative_index> relative;
+        std::vector<record> records;
+        std::vector<std::string> strings;
+        std::vector<tag_t> tags;
+    };
+    
+    // run of consecutive faces of one chunk
+    struct obj_face_span {
+        size_t chunk;
+        size_t begin;
+        size_t end;
+        size_t corner;
+    };
+    
+    static inline int fixChunkIndex(int idx, int n, int bit, int *mask) {
+        if (idx < 0) (*mask) |= bit;
+        return fixIndex(idx, n);
+    }
+    
+    // Same as parseTriple(), but reads the line in place and flags the
+    // relative components in `mask`.
+    static vertex_index parseChunkTriple(const char **token, const char *line_end,
+                                         int vsize, int vnsize, int vtsize,
+                                         int *mask) {
+        vertex_index vi(-1);
+        
+        vi.v_idx = fixChunkIndex(parseIntInPlace((*token), line_end), vsize, 1, mask);
+        (*token) = skipIndexInPlace((*token), line_end);
+        if ((*token) == line_end || (*token)[0] != '/') {
+            return vi;
+        }
+        (*token)++;
+        
+        // i//k
+        if ((*token) != line_end && (*token)[0] == '/') {
+            (*token)++;
+            vi.vn_idx = fixChunkIndex(parseIntInPlace((*token), line_end), vnsize, 4, mask);
+            (*token) = skipIndexInPlace((*token), line_end);
+            return vi;
+        }
+        
+        // i/j/k or i/j
+        vi.vt_idx = fixChunkIndex(parseIntInPlace((*token), line_end), vtsize, 2, mask);
+        (*token) = skipIndexInPlace((*token), line_end);
+        if ((*token) == line_end || (*token)[0] != '/') {
+            return vi;
+        }
+        
+        // i/j/k
+        (*token)++;  // skip '/'
+        vi.vn_idx = fixChunkIndex(parseIntInPlace((*token), line_end), vnsize, 4, mask);
+        (*token) = skipIndexInPlace((*token), line_end);
+        return vi;
+    }
+    
+    static void parseObjChunk(obj_chunk *chunk) {
+        std::string linebuf;
+        const char *p = chunk->text_begin;
+        const char *text_end = chunk->text_end;
+        
+        while (p < text_end) {
+            // Same line splitting as safeGetline(): '\n', '\r\n' or '\r'.
+            const char *line_begin = p;
+            const char *line_end = p;
+            while (line_end < text_end && *line_end != '\n' && *line_end != '\r')
+                line_end++;
+            p = line_end;
+            if (p < text_end) {
+                if (*p == '\r') {
+                    p++;
+                    if (p < text_end && *p == '\n') p++;
+                } else {
+                    p++;
+                }
+            }
+            
+            // Skip leading space. Attribute and face lines are parsed in
+            // place, straight from the file buffer.
+            const char *token = line_begin;
+            while (token != line_end && IS_SPACE(*token)) token++;
+            
+            if (token == line_end || token[0] == '\0') continue;  // empty line
+            
+            if (token[0] == '#') continue;  // comment line
+            
+            size_t length = static_cast<size_t>(line_end - token);
+            
+            // vertex
+            if (length > 1 && token[0] == 'v' && IS_SPACE((token[1]))) {
+                token += 2;
+                chunk->v.push_back(parseFloatInPlace(&token, line_end));
+                chunk->v.push_back(parseFloatInPlace(&token, line_end));
+                chunk->v.push_back(parseFloatInPlace(&token, line_end));
+                continue;
+            }
+            
+            // normal
+            if (length > 2 && token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
+                token += 3;
+                chunk->vn.push_back(parseFloatInPlace(&token, line_end));
+                chunk->vn.push_back(parseFloatInPlace(&token, line_end));
+                chunk->vn.push_back(parseFloatInPlace(&token, line_end));
+                continue;
+            }
+            
+            // texcoord
+            if (length > 2 && token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
+                token += 3;
+                chunk->vt.push_back(parseFloatInPlace(&token, line_end));
+                chunk->vt.push_back(parseFloatInPlace(&token, line_end));
+                continue;
+            }
+            
+            // face
+            if (length > 1 && token[0] == 'f' && IS_SPACE((token[1]))) {
+                token += 2;
+                while (token != line_end && IS_SPACE(*token)) token++;
+                
+                size_t face = chunk->face_sizes.size();
+                size_t first_corner = chunk->corners.size();
+                
+                while (token != line_end && token[0] != '\0') {
+                    int mask = 0;
+                    vertex_index vi = parseChunkTriple(
+                                                       &token, line_end, static_cast<int>(chunk->v.size() / 3),
+                                                       static_cast<int>(chunk->vn.size() / 3),
+                                                       static_cast<int>(chunk->vt.size() / 2), &mask);
+                    if (mask) {
+                        obj_chunk::relative_index rel;
+                        rel.corner = chunk->corners.size();
+                        rel.mask = mask;
+                        chunk->relative.push_back(rel);
+                    }
+                    chunk->corners.push_back(vi);
+                    while (token != line_end && IS_SPACE(*token)) token++;
+                }
+                chunk->face_sizes.push_back(
+                                            static_cast<int>(chunk->corners.size() - first_corner));
+                
+                // extend the current run of faces or start a new one
+                if (!chunk->records.empty() &&
+                    chunk->records.back().type == obj_chunk::RECORD_FACES &&
+                    chunk->records.back().end == face) {
+                    chunk->records.back().end = face + 1;
+                } else {
+                    obj_chunk::record r;
+                    r.type = obj_chunk::RECORD_FACES;
+                    r.begin = face;
+                    r.end = face + 1;
+                    r.corner = first_corner;
+                    chunk->records.push_back(r);
+                }
+                
+                continue;
+            }
+            
+            // The remaining statements are rare; they get a terminated copy
+            // of the line.
+            linebuf.assign(token, line_end);
+            token = linebuf.c_str();
+            
+            int named_type = -1;
+            std::string named;
+            
+            // use mtl
+            if ((0 == strncmp(token, "usemtl", 6)) && IS_SPACE((token[6]))) {
+                char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
+                token += 7;
+#ifdef _MSC_VER
+                sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+#else
+                sscanf(token, "%s", namebuf);
+#endif
+                named_type = obj_chunk::RECORD_USEMTL;
+                named = namebuf;
+            }
+            
+            // load mtl
+            else if ((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6]))) {
+                char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
+                token += 7;
+#ifdef _MSC_VER
+                sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+#else
+                sscanf(token, "%s", namebuf);
+#endif
+                named_type = obj_chunk::RECORD_MTLLIB;
+                named = namebuf;
+            }
+            
+            // group name
+            else if (token[0] == 'g' && IS_SPACE((token[1]))) {
+                std::vector<std::string> names;
+                names.reserve(2);
+                
+                while (!IS_NEW_LINE(token[0])) {
+                    std::string str = parseString(&token);
+                    names.push_back(str);
+                    token += strspn(token, " \t\r");  // skip tag
+                }
+                
+                // names[0] must be 'g', so skip the 0th element.
+                named_type = obj_chunk::RECORD_GROUP;
+                named = names.size() > 1 ? names[1] : "";
+            }
+            
+            // object name
+            else if (token[0] == 'o' && IS_SPACE((token[1]))) {
+                char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
+                token += 2;
+#ifdef _MSC_VER
+                sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+#else
+                sscanf(token, "%s", namebuf);
+#endif
+                named_type = obj_chunk::RECORD_OBJECT;
+                named = namebuf;
+            }
+            
+            else if (token[0] == 't' && IS_SPACE(token[1])) {
+                tag_t tag;
+                
+                char namebuf[4096];
+                token += 2;
+#ifdef _MSC_VER
+                sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+#else
+                sscanf(token, "%s", namebuf);
+#endif
+                tag.name = std::string(namebuf);
+                
+                token += tag.name.size() + 1;
+                
+                tag_sizes ts = parseTagTriple(&token);
+                
+                tag.intValues.resize(static_cast<size_t>(ts.num_ints));
+                
+                for (size_t i = 0; i < static_cast<size_t>(ts.num_ints); ++i) {
+                    tag.intValues[i] = atoi(token);
+                    token += strcspn(token, "/ \t\r") + 1;
+                }
+                
+                tag.floatValues.resize(static_cast<size_t>(ts.num_floats));
+                for (size_t i = 0; i < static_cast<size_t>(ts.num_floats); ++i) {
+                    tag.floatValues[i] = parseFloat(&token);
+                    token += strcspn(token, "/ \t\r") + 1;
+                }
+                
+                tag.stringValues.resize(static_cast<size_t>(ts.num_strings));
+                for (size_t i = 0; i < static_cast<size_t>(ts.num_strings); ++i) {
+                    char stringValueBuffer[4096];
+                    
+#ifdef _MSC_VER
+                    sscanf_s(token, "%s", stringValueBuffer,
+                             (unsigned)_countof(stringValueBuffer));
+#else
+                    sscanf(token, "%s", stringValueBuffer);
+#endif
+                    tag.stringValues[i] = stringValueBuffer;
+                    token += tag.stringValues[i].size() + 1;
+                }
+                
+                obj_chunk::record r;
+                r.type = obj_chunk::RECORD_TAG;
+                r.begin = chunk->tags.size();
+                r.end = r.begin;
+                r.corner = 0;
+                chunk->records.push_back(r);
+                chunk->tags.push_back(tag);
+            }
+            
+            if (named_type >= 0) {
+                obj_chunk::record r;
+                r.type = named_type;
+                r.begin = chunk->strings.size();
+                r.end = r.begin;
+                r.corner = 0;
+                chunk->records.push_back(r);
+                chunk->strings.push_back(named);
+            }
+            
+            // Ignore unknown command.
+        }
+    }
+    
+    // Same output as exportFaceGroupToShape(), reading the faces from chunk
+    // spans instead of a vector of per-face vectors.
+    static bool exportFaceSpansToShape(shape_t *shape,
+                                       const std::vector<obj_chunk> &chunks,
+                                       const std::vector<obj_face_span> &spans,
+                                       const std::vector<tag_t> &tags,
+                                       const int material_id,
+                                       const std::string &name, bool triangulate) {
+        if (spans.empty()) {
+            return false;
+        }
+        
+        for (size_t s = 0; s < spans.size(); s++) {
+            const obj_chunk &chunk = chunks[spans[s].chunk];
+            size_t corner = spans[s].corner;
+            
+            for (size_t f = spans[s].begin; f < spans[s].end; f++) {
+                const vertex_index *face = &chunk.corners[corner];
+                size_t npolys = static_cast<size_t>(chunk.face_sizes[f]);
+                corner += npolys;
+                
+                if (triangulate) {
+                    vertex_index i0 = face[0];
+                    vertex_index i1(-1);
+                    vertex_index i2 = face[1];
+                    
+                    // Polygon -> triangle fan conversion
+                    for (size_t k = 2; k < npolys; k++) {
+                        i1 = i2;
+                        i2 = face[k];
+                        
+                        index_t idx0, idx1, idx2;
+                        idx0.vertex_index = i0.v_idx;
+                        idx0.normal_index = i0.vn_idx;
+                        idx0.texcoord_index = i0.vt_idx;
+                        idx1.vertex_index = i1.v_idx;
+                        idx1.normal_index = i1.vn_idx;
+                        idx1.texcoord_index = i1.vt_idx;
+                        idx2.vertex_index = i2.v_idx;
+                        idx2.normal_index = i2.vn_idx;
+                        idx2.texcoord_index = i2.vt_idx;
+                        
+                        shape->mesh.indices.push_back(idx0);
+                        shape->mesh.indices.push_back(idx1);
+                        shape->mesh.indices.push_back(idx2);
+                        
+                        shape->mesh.num_face_vertices.push_back(3);
+                        shape->mesh.material_ids.push_back(material_id);
+                    }
+                } else {
+                    for (size_t k = 0; k < npolys; k++) {
+                        index_t idx;
+                        idx.vertex_index = face[k].v_idx;
+                        idx.normal_index = face[k].vn_idx;
+                        idx.texcoord_index = face[k].vt_idx;
+                        shape->mesh.indices.push_back(idx);
+                    }
+                    
+                    shape->mesh.num_face_vertices.push_back(
+                                                            static_cast<unsigned char>(npolys));
+                    shape->mesh.material_ids.push_back(material_id);  // per face
+                }
+            }
+        }
+        
+        shape->name = name;
+        shape->mesh.tags = tags;
+        
+        return true;
+    }
+    
+    // Runs `fn(i)` for i in [0, count) on `num_threads` threads.
+    template <typename Fn>
+    static void parallelFor(unsigned int num_threads, size_t count, Fn fn) {
+        if (num_threads <= 1 || count <= 1) {
+            for (size_t i = 0; i < count; i++) fn(i);
+            return;
+        }
+        
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> workers;
+        unsigned int n = static_cast<unsigned int>(
+                                                   std::min(static_cast<size_t>(num_threads), count));
+        for (unsigned int t = 1; t < n; t++) {
+            workers.push_back(std::thread([&]() {
+                for (size_t i = next++; i < count; i = next++) fn(i);
+            }));
+        }
+        for (size_t i = next++; i < count; i = next++) fn(i);
+        for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+    }
+    
+    bool LoadObjParallel(attrib_t *attrib, std::vector<shape_t> *shapes,
+                         std::vector<material_t> *materials, std::string *err,
+                         const char *filename, const char *mtl_basepath,
+                         bool triangulate, unsigned int num_threads,
+                         std::vector<std::string> *mtl_filenames) {
+        attrib->vertices.clear();
+        attrib->normals.clear();
+        attrib->texcoords.clear();
+        shapes->clear();
+        
+        std::stringstream errss;
+        
+        std::ifstream ifs(filename, std::ios::binary);
+        if (!ifs) {
+            errss << "Cannot open file [" << filename << "]" << std::endl;
+            if (err) {
+                (*err) = errss.str();
+            }
+            return false;
+        }
+        
+        ifs.seekg(0, std::ios::end);
+        std::streamoff file_size = ifs.tellg();
+        ifs.seekg(0, std::ios::beg);
+        std::vector<char> text(static_cast<size_t>(file_size > 0 ? file_size : 0));
+        if (!text.empty()) {
+            ifs.read(&text[0], static_cast<std::streamsize>(text.size()));
+        }
+        ifs.close();
+        
+        std::string basePath;
+        if (mtl_basepath) {
+            basePath = mtl_basepath;
+        }
+        MaterialFileReader matFileReader(basePath);
+        
+        if (num_threads == 0) {
+            num_threads = std::thread::hardware_concurrency();
+        }
+        if (num_threads == 0) {
+            num_threads = 1;
+        }
+        
+        // Several chunks per thread keep the cores busy even though `v` and
+        // `f` lines (which differ in cost) are not spread evenly in the file.
+        const size_t min_chunk_size = 64 * 1024;
+        size_t chunk_count = num_threads == 1 ? 1 : num_threads * 4;
+        chunk_count = std::max(static_cast<size_t>(1),
+                               std::min(chunk_count, text.size() / min_chunk_size));
+        
+        std::vector<obj_chunk> chunks(chunk_count);
+        const char *text_begin = text.empty() ? NULL : &text[0];
+        const char *text_end = text_begin + text.size();
+        const char *cursor = text_begin;
+        for (size_t i = 0; i < chunk_count; i++) {
+            const char *split = text_begin + text.size() * (i + 1) / chunk_count;
+            if (split < cursor) split = cursor;
+            // move the split just past the next '\n'
+            while (split < text_end && split[-1] != '\n') split++;
+            chunks[i].text_begin = cursor;
+            chunks[i].text_end = (i + 1 == chunk_count) ? text_end : split;
+            cursor = chunks[i].text_end;
+        }
+        
+        parallelFor(num_threads, chunk_count,
+                    [&](size_t i) { parseObjChunk(&chunks[i]); });
+        
+        // prefix sums of the per-chunk attribute counts
+        std::vector<size_t> v_base(chunk_count + 1, 0);
+        std::vector<size_t> vn_base(chunk_count + 1, 0);
+        std::vector<size_t> vt_base(chunk_count + 1, 0);
+        for (size_t i = 0; i < chunk_count; i++) {
+            v_base[i + 1] = v_base[i] + chunks[i].v.size();
+            vn_base[i + 1] = vn_base[i] + chunks[i].vn.size();
+            vt_base[i + 1] = vt_base[i] + chunks[i].vt.size();
+        }
+        
+        // rebase relative indices onto the global counts
+        for (size_t i = 0; i < chunk_count; i++) {
+            obj_chunk &chunk = chunks[i];
+            for (size_t r = 0; r < chunk.relative.size(); r++) {
+                vertex_index &vi = chunk.corners[chunk.relative[r].corner];
+                int mask = chunk.relative[r].mask;
+                if (mask & 1) vi.v_idx += static_cast<int>(v_base[i] / 3);
+                if (mask & 2) vi.vt_idx += static_cast<int>(vt_base[i] / 2);
+                if (mask & 4) vi.vn_idx += static_cast<int>(vn_base[i] / 3);
+            }
+        }
+        
+        // replay the records in file order
+        std::map<std::string, int> material_map;
+        int material = -1;
+        std::string name;
+        std::vector<tag_t> tags;
+        std::vector<obj_face_span> faceGroup;
+        shape_t shape;
+        
+        for (size_t i = 0; i < chunk_count; i++) {
+            const obj_chunk &chunk = chunks[i];
+            for (size_t r = 0; r < chunk.records.size(); r++) {
+                const obj_chunk::record &rec = chunk.records[r];
+                switch (rec.type) {
+                    case obj_chunk::RECORD_FACES: {
+                        obj_face_span span;
+                        span.chunk = i;
+                        span.begin = rec.begin;
+                        span.end = rec.end;
+                        span.corner = rec.corner;
+                        faceGroup.push_back(span);
+                        break;
+                    }
+                    case obj_chunk::RECORD_USEMTL: {
+                        int newMaterialId = -1;
+                        std::map<std::string, int>::const_iterator it =
+                        material_map.find(chunk.strings[rec.begin]);
+                        if (it != material_map.end()) {
+                            newMaterialId = it->second;
+                        }
+                        
+                        if (newMaterialId != material) {
+                            exportFaceSpansToShape(&shape, chunks, faceGroup, tags, material,
+                                                   name, triangulate);
+                            faceGroup.clear();
+                            material = newMaterialId;
+                        }
+                        break;
+                    }
+                    case obj_chunk::RECORD_MTLLIB: {
+                        if (mtl_filenames) {
+                            // the path MaterialFileReader opens
+                            mtl_filenames->push_back(basePath + chunk.strings[rec.begin]);
+                        }
+                        std::string err_mtl;
+                        bool ok = matFileReader(chunk.strings[rec.begin], materials,
+                                                &material_map, &err_mtl);
+                        if (err) {
+                            (*err) += err_mtl;
+                        }
+                        
+                        if (!ok) {
+                            return false;
+                        }
+                        break;
+                    }
+                    case obj_chunk::RECORD_GROUP:
+                    case obj_chunk::RECORD_OBJECT: {
+                        // flush previous face group.
+                        bool ret = exportFaceSpansToShape(&shape, chunks, faceGroup, tags,
+                                                          material, name, triangulate);
+                        if (ret) {
+                            shapes->push_back(shape);
+                        }
+                        
+                        shape = shape_t();
+                        faceGroup.clear();
+                        name = chunk.strings[rec.begin];
+                        break;
+                    }
+                    case obj_chunk::RECORD_TAG:
+                        tags.push_back(chunk.tags[rec.begin]);
+                        break;
+                }
+            }
+        }
+        
+        bool ret = exportFaceSpansToShape(&shape, chunks, faceGroup, tags, material,
+                                          name, triangulate);
+        if (ret || shape.mesh.indices.size()) {
+            shapes->push_back(shape);
+        }
+        
+        // merge the attribute arrays at their prefix-sum offsets
+        attrib->vertices.resize(v_base[chunk_count]);
+        attrib->normals.resize(vn_base[chunk_count]);
+        attrib->texcoords.resize(vt_base[chunk_count]);
+        parallelFor(num_threads, chunk_count, [&](size_t i) {
+            const obj_chunk &chunk = chunks[i];
+            if (!chunk.v.empty())
+                memcpy(&attrib->vertices[v_base[i]], &chunk.v[0],
+                       chunk.v.size() * sizeof(float));
+            if (!chunk.vn.empty())
+                memcpy(&attrib->normals[vn_base[i]], &chunk.vn[0],
+                       chunk.vn.size() * sizeof(float));
+            if (!chunk.vt.empty())
+                memcpy(&attrib->texcoords[vt_base[i]], &chunk.vt[0],
+                       chunk.vt.size() * sizeof(float));
+        });
+        
+        if (err) {
+            (*err) += errss.str();
+        }
+        
+        return true;
+    }
+    
+    void ParseObjAttributes(const char *text, size_t length,
+                            std::vector<float> *values, bool reference) {
+        std::string linebuf;
+        const char *p = text;
+        const char *text_end = text + length;
+        
+        while (p < text_end) {
+            const char *line_begin = p;
+            const char *line_end = p;
+            while (line_end < text_end && *line_end != '\n' && *line_end != '\r')
+                line_end++;
+            p = line_end;
+            if (p < text_end) {
+                if (*p == '\r') {
+                    p++;
+                    if (p < text_end && *p == '\n') p++;
+                } else {
+                    p++;
+                }
+            }
+            
+            const char *token = line_begin;
+            while (token != line_end && IS_SPACE(*token)) token++;
+            
+            int count = 0;
+            if (line_end - token > 2 && token[0] == 'v' &&
+                (token[1] == 'n' || token[1] == 't') && IS_SPACE(token[2])) {
+                count = token[1] == 'n' ? 3 : 2;
+                token += 3;
+            } else if (line_end - token > 1 && token[0] == 'v' && IS_SPACE(token[1])) {
+                count = 3;
+                token += 2;
+            }
+            if (count == 0) continue;
+            
+            if (reference) {
+                // LoadObj() parses a terminated copy of every line
+                linebuf.assign(token, line_end);
+                const char *copy = linebuf.c_str();
+                for (int i = 0; i < count; i++) values->push_back(parseFloat(&copy));
+            } else {
+                for (int i = 0; i < count; i++)
+                    values->push_back(parseFloatInPlace(&token, line_end));
+            }
+        }
+    }
+    
     bool LoadObjWithCallback(std::istream &inStream, const callback_t &callback,
                              void *user_data /*= NULL*/,
                              MaterialReader *readMatFn /*= NULL*/,